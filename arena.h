@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Fixed-size run of objects allocated from an Arena; a view, copied freely.
+template <typename T>
+class ArenaArray {
+public:
+    ArenaArray() : items(nullptr), count(0) {}
+    ArenaArray(T* items, size_t count) : items(items), count(count) {}
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    T& operator[](size_t i) const { return items[i]; }
+    T* begin() const { return items; }
+    T* end() const { return items + count; }
+
+private:
+    T* items;
+    size_t count;
+};
+
+// Bump-pointer allocator for objects that all die together, such as the
+// nodes of one AST. Objects are never destroyed one by one: the arena frees
+// its chunks in one go, so only trivially destructible types may go in it.
+class Arena {
+public:
+    Arena() {}
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    template <typename T, typename... Args>
+    T* make(Args&&... args) {
+        static_assert(std::is_trivially_destructible<T>::value, "arena objects are never destroyed");
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    // Copies `items[from..]` into the arena.
+    template <typename T>
+    ArenaArray<T> copy(const std::vector<T>& items, size_t from = 0) {
+        static_assert(std::is_trivially_copyable<T>::value, "arena arrays are copied bytewise");
+        size_t count = items.size() - from;
+        if (count == 0) return ArenaArray<T>();
+        T* copy = (T*)allocate(count * sizeof(T), alignof(T));
+        memcpy((void*)copy, items.data() + from, count * sizeof(T));
+        return ArenaArray<T>(copy, count);
+    }
+
+    void* allocate(size_t size, size_t align) {
+        size_t start = (used + align - 1) & ~(align - 1);
+        if (!chunk || start + size > ChunkSize) {
+            // Large requests get a chunk of their own and leave the current one open.
+            if (size > ChunkSize / 4) {
+                chunks.emplace_back(new char[size]);
+                reserved += size;
+                return chunks.back().get();
+            }
+            chunks.emplace_back(new char[ChunkSize]);
+            reserved += ChunkSize;
+            chunk = chunks.back().get();
+            start = 0;
+        }
+        used = start + size;
+        return chunk + start;
+    }
+
+    // Takes over every chunk of `other`, so what was allocated there lives as
+    // long as this arena does; `other` is left empty.
+    void adopt(Arena& other) {
+        for (auto& c : other.chunks) chunks.push_back(std::move(c));
+        reserved += other.reserved;
+        other.chunks.clear();
+        other.chunk = nullptr;
+        other.used = 0;
+        other.reserved = 0;
+    }
+
+    // Bytes taken from the system so far.
+    size_t bytes_reserved() const { return reserved; }
+    size_t chunk_count() const { return chunks.size(); }
+
+private:
+    static constexpr size_t ChunkSize = 64 << 10;
+
+    std::vector<std::unique_ptr<char[]>> chunks;
+    char* chunk = nullptr;
+    size_t used = 0;
+    size_t reserved = 0;
+};
@@ -1,8 +1,12 @@
 #pragma once
 
+#include <cstdlib>
 #include <iostream>
 #include <string>
 #include <vector>
+#include <string_view>
+#include <type_traits>
+#include "arena.h"
 #include "tokens.h"
 
 using namespace std;
@@ -13,214 +17,157 @@ struct BlockStatement;
 struct Identifier;
 struct VariableDeclarationStatement;
 
+// Operators as the parser reads them. A compound assignment such as "+=" is
+// stored as the binary operator it applies, a plain "=" as Assign.
+enum class Operator : uint8_t {
+    Add, Subtract, Multiply, Divide, Modulo,
+    ShiftLeft, ShiftRight, BitAnd, BitOr, BitXor,
+    LogicalAnd, LogicalOr,
+    Equal, NotEqual, Less, Greater, LessEqual, GreaterEqual,
+    Not, Negate, BitNot, Increment, Decrement,
+    Assign
+};
+constexpr size_t OperatorCount = (size_t)Operator::Assign + 1;
+
+// The language has primitive types only, so a type is one of these.
+enum class Type : uint8_t { Void, Char, Int, Float, Double, Bool, String, Auto };
+constexpr size_t TypeCount = (size_t)Type::Auto + 1;
+
+inline string_view spelling(Operator op) {
+    static constexpr string_view names[OperatorCount] = {
+        "+", "-", "*", "/", "%",
+        "<<", ">>", "&", "|", "^",
+        "&&", "||",
+        "==", "!=", "<", ">", "<=", ">=",
+        "!", "-", "~", "++", "--",
+        "="
+    };
+    return names[(size_t)op];
+}
+
+inline string_view spelling(Type type) {
+    static constexpr string_view names[TypeCount] = { "void", "char", "int", "float", "double", "bool", "string", "auto" };
+    return names[(size_t)type];
+}
+
+inline ostream& operator<<(ostream& out, Operator op) { return out << spelling(op); }
+inline ostream& operator<<(ostream& out, Type type) { return out << spelling(type); }
+
+// The kind of each node struct below. Expressions and statements carry theirs
+// in `kind` for AstVisitor to switch on; a FlatTree tags its nodes the same
+// way.
+enum class NodeKind : uint8_t {
+    Program, Function, Parameter, Block, ExpressionStatement, VariableDeclaration,
+    If, While, For, Return, Break, Continue,
+    NumberLiteral, StringLiteral, BoolLiteral, Identifier, BinaryOperation, UnaryOp, Assignment, FunctionCall,
+    ErrorStatement, ErrorExpression
+};
+constexpr size_t NodeKindCount = (size_t)NodeKind::ErrorExpression + 1;
+
+// Nodes record where they start as a SourceLocation; the line shown in a dump
+// (ast_dump.h) is looked up in `sources` only when the tree is dumped.
+//
+// Every node lives in the Arena the Parser was given and is freed with it, so
+// nodes have no destructors: children are plain pointers, lists are
+// ArenaArrays and names are views into the source. There are no virtual
+// functions either: `kind` says which struct a node is.
 struct Expression {
-    int line; 
-    Expression(int l) : line(l) {}
-    virtual ~Expression() {} 
-    virtual void print(int indent = 0) const = 0;
+    NodeKind kind;
+    SourceLocation loc;
+    Expression(NodeKind k, SourceLocation l) : kind(k), loc(l) {}
 };
 
 struct NumberLiteral : Expression {
-    string value;
-    NumberLiteral(string val, int l) : value(val), Expression(l) {}
-    void print(int indent = 0) const override {
-        cout << string(indent, ' ') << "NumberLiteral(" << value << ") [line: " << line << "]" << endl;
-    }
+    string_view value;
+    NumberLiteral(string_view val, SourceLocation l) : value(val), Expression(NodeKind::NumberLiteral, l) {}
 };
 
 struct StringLiteral : Expression {
-    string value;
-    StringLiteral(string val, int l) : value(val), Expression(l) {}
-    void print(int indent = 0) const override {
-        cout << string(indent, ' ') << "StringLiteral(\"" << value << "\") [line: " << line << "]" << endl;
-    }
+    string_view value;
+    StringLiteral(string_view val, SourceLocation l) : value(val), Expression(NodeKind::StringLiteral, l) {}
 };
 struct BoolLiteral : Expression {
     bool value;
-    BoolLiteral(bool val, int l) : value(val), Expression(l) {}
-    void print(int indent = 0) const override {
-        cout << string(indent, ' ') << "BoolLiteral(" << (value ? "true" : "false") << ") [line: " << line << "]" << endl;
-    }
+    BoolLiteral(bool val, SourceLocation l) : value(val), Expression(NodeKind::BoolLiteral, l) {}
 };
 
 struct Identifier : Expression {
-    string name;
-    Identifier(string n, int l) : name(n), Expression(l) {}
-    void print(int indent = 0) const override {
-        cout << string(indent, ' ') << "Identifier(" << name << ") [line: " << line << "]" << endl;
-    }
+    SymbolID name;
+    Identifier(SymbolID n, SourceLocation l) : name(n), Expression(NodeKind::Identifier, l) {}
 };
 
 struct BinaryOperation : Expression {
     Expression* left;
-    string op;
+    Operator op;
     Expression* right;
 
-    BinaryOperation(Expression* l, string o, Expression* r, int ln) : left(l), op(o), right(r), Expression(ln) {}
-    
-    ~BinaryOperation() {
-        delete left;
-        delete right;
-    }
-
-    void print(int indent = 0) const override {
-        cout << string(indent, ' ') << "BinaryOperation(" << op << ") [line: " << line << "]" << endl;
-        left->print(indent + 2);
-        right->print(indent + 2);
-    }
+    BinaryOperation(Expression* l, Operator o, Expression* r, SourceLocation ln) : left(l), op(o), right(r), Expression(NodeKind::BinaryOperation, ln) {}
 };
 
 struct UnaryOp : Expression {
-    string op;
+    Operator op;
     Expression* right;
-    UnaryOp(string o, Expression* r, int l) : op(o), right(r), Expression(l) {}
-    
-    ~UnaryOp() {
-        delete right;
-    }
-
-    void print(int indent = 0) const override {
-        cout << string(indent, ' ') << "UnaryOp(" << op << ") [line: " << line << "]" << endl;
-        right->print(indent + 2);
-    }
+    UnaryOp(Operator o, Expression* r, SourceLocation l) : op(o), right(r), Expression(NodeKind::UnaryOp, l) {}
 };
 
+// `op` is Assign, or for a compound assignment such as "+=" the operator it
+// applies.
 struct Assignment : Expression {
     Identifier* identifier;
+    Operator op;
     Expression* value;
-    Assignment(Identifier* id, Expression* v, int l) : identifier(id), value(v), Expression(l) {}
-
-    ~Assignment() {
-        delete identifier;
-        delete value;
-    }
-
-    void print(int indent = 0) const override {
-        cout << string(indent, ' ') << "Assignment(" << identifier->name << ") [line: " << line << "]" << endl;
-        value->print(indent + 2);
-    }
+    Assignment(Identifier* id, Operator o, Expression* v, SourceLocation l) : identifier(id), op(o), value(v), Expression(NodeKind::Assignment, l) {}
 };
 
 struct FunctionCall : Expression {
-    string callee;
-    vector<Expression*> arguments;
-    FunctionCall(string c, vector<Expression*> args, int l) : callee(c), arguments(args), Expression(l) {}
+    SymbolID callee;
+    ArenaArray<Expression*> arguments;
+    FunctionCall(SymbolID c, ArenaArray<Expression*> args, SourceLocation l) : callee(c), arguments(args), Expression(NodeKind::FunctionCall, l) {}
+};
 
-    ~FunctionCall() {
-        for (auto arg : arguments) {
-            delete arg;
-        }
-    }
-     void print(int indent = 0) const override {
-        cout << string(indent, ' ') << "FunctionCall(" << callee << ") [line: " << line << "]" << endl;
-        if (!arguments.empty()) {
-            cout << string(indent + 2, ' ') << "Arguments:" << endl;
-            for(const auto& arg : arguments) {
-                arg->print(indent + 4);
-            }
-        }
-    }
+// Stands in for an initializer that failed to parse. The parser has reported
+// it, and later passes leave it alone.
+struct ErrorExpression : Expression {
+    ErrorExpression(SourceLocation l) : Expression(NodeKind::ErrorExpression, l) {}
 };
 
 struct Statement {
-    int line;
-    Statement(int l) : line(l) {}
-    virtual ~Statement() {}
-    virtual void print(int indent = 0) const = 0;
+    NodeKind kind;
+    SourceLocation loc;
+    Statement(NodeKind k, SourceLocation l) : kind(k), loc(l) {}
 };
 
 struct BlockStatement : Statement {
-    vector<Statement*> statements;
-    BlockStatement(vector<Statement*> stmts, int l) : statements(stmts), Statement(l) {}
-
-    ~BlockStatement() {
-        for (auto stmt : statements) {
-            delete stmt;
-        }
-    }
-     void print(int indent = 0) const override {
-        cout << string(indent, ' ') << "Block [line: " << line << "] {" << endl;
-        for(const auto& stmt : statements) {
-            stmt->print(indent + 2);
-        }
-        cout << string(indent, ' ') << "}" << endl;
-    }
+    ArenaArray<Statement*> statements;
+    BlockStatement(ArenaArray<Statement*> stmts, SourceLocation l) : statements(stmts), Statement(NodeKind::Block, l) {}
 };
 
 struct ExpressionStatement : Statement {
     Expression* expression;
-    ExpressionStatement(Expression* expr, int l) : expression(expr), Statement(l) {}
-    ~ExpressionStatement() {
-        delete expression;
-    }
-    void print(int indent = 0) const override {
-        cout << string(indent, ' ') << "ExpressionStatement [line: " << line << "]" << endl;
-        expression->print(indent + 2);
-    }
+    ExpressionStatement(Expression* expr, SourceLocation l) : expression(expr), Statement(NodeKind::ExpressionStatement, l) {}
 };
 
 struct VariableDeclarationStatement : Statement {
-    string type;
-    string name;
+    Type type;
+    SymbolID name;
     Expression* initializer; 
-    VariableDeclarationStatement(string t, string n, Expression* init, int l)
-        : type(t), name(n), initializer(init), Statement(l) {}
-    ~VariableDeclarationStatement() {
-        if (initializer) {
-            delete initializer;
-        }
-    }
-    void print(int indent = 0) const override {
-        cout << string(indent, ' ') << "VariableDeclaration(" << name << ", type: " << type << ") [line: " << line << "]" << endl;
-        if (initializer) {
-            cout << string(indent + 2, ' ') << "Initializer:" << endl;
-            initializer->print(indent + 4);
-        }
-    }
+    VariableDeclarationStatement(Type t, SymbolID n, Expression* init, SourceLocation l)
+        : type(t), name(n), initializer(init), Statement(NodeKind::VariableDeclaration, l) {}
 };
 
 struct IfStatement : Statement {
     Expression* condition;
     Statement* thenBranch;
     Statement* elseBranch; 
-    IfStatement(Expression* c, Statement* t, Statement* e, int l)
-        : condition(c), thenBranch(t), elseBranch(e), Statement(l) {}
-    ~IfStatement() {
-        delete condition;
-        delete thenBranch;
-        if (elseBranch) {
-            delete elseBranch;
-        }
-    }
-    void print(int indent = 0) const override {
-        cout << string(indent, ' ') << "IfStatement [line: " << line << "]" << endl;
-        cout << string(indent + 2, ' ') << "Condition:" << endl;
-        condition->print(indent + 4);
-        cout << string(indent + 2, ' ') << "Then:" << endl;
-        thenBranch->print(indent + 4);
-        if (elseBranch) {
-            cout << string(indent + 2, ' ') << "Else:" << endl;
-            elseBranch->print(indent + 4);
-        }
-    }
+    IfStatement(Expression* c, Statement* t, Statement* e, SourceLocation l)
+        : condition(c), thenBranch(t), elseBranch(e), Statement(NodeKind::If, l) {}
 };
 
 struct WhileStatement : Statement {
     Expression* condition;
     Statement* body;
-    WhileStatement(Expression* c, Statement* b, int l)
-        : condition(c), body(b), Statement(l) {}
-    ~WhileStatement() {
-        delete condition;
-        delete body;
-    }
-    void print(int indent = 0) const override {
-        cout << string(indent, ' ') << "WhileStatement [line: " << line << "]" << endl;
-        cout << string(indent + 2, ' ') << "Condition:" << endl;
-        condition->print(indent + 4);
-        cout << string(indent + 2, ' ') << "Body:" << endl;
-        body->print(indent + 4);
-    }
+    WhileStatement(Expression* c, Statement* b, SourceLocation l)
+        : condition(c), body(b), Statement(NodeKind::While, l) {}
 };
 
 struct ForStatement : Statement {
@@ -229,125 +176,130 @@ struct ForStatement : Statement {
     Expression* increment;
     Statement* body;
 
-    ForStatement(Statement* init, Expression* cond, Expression* inc, Statement* b, int l)
-        : initializer(init), condition(cond), increment(inc), body(b), Statement(l) {}
-    ~ForStatement() {
-        if(initializer) delete initializer;
-        if(condition) delete condition;
-        if(increment) delete increment;
-        delete body;
-    }
-    void print(int indent = 0) const override {
-        cout << string(indent, ' ') << "ForStatement [line: " << line << "]" << endl;
-        if(initializer) {
-            cout << string(indent + 2, ' ') << "Initializer:" << endl;
-            initializer->print(indent + 4);
-        }
-        if(condition) {
-            cout << string(indent + 2, ' ') << "Condition:" << endl;
-            condition->print(indent + 4);
-        }
-        if(increment) {
-            cout << string(indent + 2, ' ') << "Increment:" << endl;
-            increment->print(indent + 4);
-        }
-        cout << string(indent + 2, ' ') << "Body:" << endl;
-        body->print(indent + 4);
-    }
+    ForStatement(Statement* init, Expression* cond, Expression* inc, Statement* b, SourceLocation l)
+        : initializer(init), condition(cond), increment(inc), body(b), Statement(NodeKind::For, l) {}
 };
 struct ReturnStatement : Statement {
     Expression* returnValue;
-    ReturnStatement(Expression* val, int l) : returnValue(val), Statement(l) {}
-    ~ReturnStatement() {
-        if (returnValue) {
-            delete returnValue;
-        }
-    }
-    void print(int indent = 0) const override {
-        cout << string(indent, ' ') << "ReturnStatement [line: " << line << "]" << endl;
-        if (returnValue) {
-            returnValue->print(indent + 2);
-        }
-    }
+    ReturnStatement(Expression* val, SourceLocation l) : returnValue(val), Statement(NodeKind::Return, l) {}
 };
 struct BreakStatement : Statement {
-    BreakStatement(int l) : Statement(l) {}
-    void print(int indent = 0) const override {
-        cout << string(indent, ' ') << "BreakStatement [line: " << line << "]" << endl;
-    }
+    BreakStatement(SourceLocation l) : Statement(NodeKind::Break, l) {}
 };
 
 struct ContinueStatement : Statement {
-    ContinueStatement(int l) : Statement(l) {}
-     void print(int indent = 0) const override {
-        cout << string(indent, ' ') << "ContinueStatement [line: " << line << "]" << endl;
+    ContinueStatement(SourceLocation l) : Statement(NodeKind::Continue, l) {}
+};
+
+// Stands in for a statement that failed to parse, from where it started up to
+// where the parser picked up again.
+struct ErrorStatement : Statement {
+    ErrorStatement(SourceLocation l) : Statement(NodeKind::ErrorStatement, l) {}
+};
+
+// Base of every pass over expressions and statements, in the CRTP style:
+// dispatch() switches on a node's kind and calls the visit() that `Pass`
+// declares for that node type, const or not as the node is, returning what
+// it returns. A pass declares visit() for every node type, the ones it
+// ignores too. One taking a plain Expression* or Statement* instead would
+// catch kinds silently and does not compile, so adding a node kind breaks
+// the build of every pass that does not handle it. Passes with private
+// visit() functions make AstVisitor<Pass> a friend.
+template <typename Pass>
+class AstVisitor {
+protected:
+    decltype(auto) dispatch(Expression* node) { return dispatch_kind(node); }
+    decltype(auto) dispatch(const Expression* node) { return dispatch_kind(node); }
+    decltype(auto) dispatch(Statement* node) { return dispatch_kind(node); }
+    decltype(auto) dispatch(const Statement* node) { return dispatch_kind(node); }
+
+private:
+    template <typename Node>
+    decltype(auto) dispatch_kind(Node* node) {
+        static_assert(!takes<Expression>(0) && !takes<Statement>(0), "a pass must have a visit() for each node type instead");
+        Pass& pass = static_cast<Pass&>(*this);
+        // Both switches name every NodeKind and have no default, so -Wswitch
+        // reports a kind added without a case. A kind of the other group, or
+        // of no node dispatch() takes, is a corrupt tree.
+        if constexpr (is_base_of<Expression, Node>::value) {
+            switch (node->kind) {
+            case NodeKind::NumberLiteral: return pass.visit(cast<NumberLiteral>(node));
+            case NodeKind::StringLiteral: return pass.visit(cast<StringLiteral>(node));
+            case NodeKind::BoolLiteral: return pass.visit(cast<BoolLiteral>(node));
+            case NodeKind::Identifier: return pass.visit(cast<Identifier>(node));
+            case NodeKind::BinaryOperation: return pass.visit(cast<BinaryOperation>(node));
+            case NodeKind::UnaryOp: return pass.visit(cast<UnaryOp>(node));
+            case NodeKind::Assignment: return pass.visit(cast<Assignment>(node));
+            case NodeKind::FunctionCall: return pass.visit(cast<FunctionCall>(node));
+            case NodeKind::ErrorExpression: return pass.visit(cast<ErrorExpression>(node));
+            case NodeKind::Program: case NodeKind::Function: case NodeKind::Parameter:
+            case NodeKind::Block: case NodeKind::ExpressionStatement: case NodeKind::VariableDeclaration:
+            case NodeKind::If: case NodeKind::While: case NodeKind::For: case NodeKind::Return:
+            case NodeKind::Break: case NodeKind::Continue: case NodeKind::ErrorStatement:
+                break;
+            }
+        } else {
+            switch (node->kind) {
+            case NodeKind::Block: return pass.visit(cast<BlockStatement>(node));
+            case NodeKind::ExpressionStatement: return pass.visit(cast<ExpressionStatement>(node));
+            case NodeKind::VariableDeclaration: return pass.visit(cast<VariableDeclarationStatement>(node));
+            case NodeKind::If: return pass.visit(cast<IfStatement>(node));
+            case NodeKind::While: return pass.visit(cast<WhileStatement>(node));
+            case NodeKind::For: return pass.visit(cast<ForStatement>(node));
+            case NodeKind::Return: return pass.visit(cast<ReturnStatement>(node));
+            case NodeKind::Break: return pass.visit(cast<BreakStatement>(node));
+            case NodeKind::Continue: return pass.visit(cast<ContinueStatement>(node));
+            case NodeKind::ErrorStatement: return pass.visit(cast<ErrorStatement>(node));
+            case NodeKind::Program: case NodeKind::Function: case NodeKind::Parameter:
+            case NodeKind::NumberLiteral: case NodeKind::StringLiteral: case NodeKind::BoolLiteral:
+            case NodeKind::Identifier: case NodeKind::BinaryOperation: case NodeKind::UnaryOp:
+            case NodeKind::Assignment: case NodeKind::FunctionCall: case NodeKind::ErrorExpression:
+                break;
+            }
+        }
+        abort();
+    }
+
+    // `node` as a T, keeping its constness.
+    template <typename T, typename Node>
+    static auto cast(Node* node) {
+        return static_cast<typename conditional<is_const<Node>::value, const T, T>::type*>(node);
     }
+
+    // Whether Pass has a visit() that accepts the base class itself.
+    template <typename Base, typename P = Pass>
+    static constexpr auto takes(int) -> decltype(declval<P&>().visit(declval<const Base*>()), true) { return true; }
+    template <typename Base, typename P = Pass>
+    static constexpr auto takes(long) -> decltype(declval<P&>().visit(declval<Base*>()), true) { return true; }
+    template <typename Base>
+    static constexpr bool takes(...) { return false; }
 };
 
 struct Parameter {
-    string type;
-    string name;
-    int line;
-    Parameter(string t, string n, int l) : type(t), name(n), line(l) {}
-    void print(int indent = 0) const {
-        cout << string(indent, ' ') << "Param(" << name << ", type: " << type << ") [line: " << line << "]" << endl;
-    }
+    Type type;
+    SymbolID name;
+    SourceLocation loc;
+    Parameter(Type t, SymbolID n, SourceLocation l) : type(t), name(n), loc(l) {}
 };
 
 struct FunctionDeclaration {
-    string returnType;
-    string name;
-    vector<Parameter> params;
+    Type returnType;
+    SymbolID name;
+    ArenaArray<Parameter> params;
     BlockStatement* body;
-    int line;
-
-    FunctionDeclaration(string rt, string n, vector<Parameter> p, BlockStatement* b, int l)
-        : returnType(rt), name(n), params(p), body(b), line(l) {}
-
-    ~FunctionDeclaration() {
-        delete body;
-    }
-    void print(int indent = 0) const {
-        cout << string(indent, ' ') << "FunctionDeclaration(" << name << ", returns: " << returnType << ") [line: " << line << "]" << endl;
-        if (!params.empty()) {
-            cout << string(indent + 2, ' ') << "Parameters:" << endl;
-            for (const auto& param : params) {
-                param.print(indent + 4);
-            }
-        }
-        if (body) {
-            body->print(indent + 2);
-        }
-    }
+    SourceLocation loc;
+    // With ParserOptions::lazy_bodies, the tokens of the body from '{' to
+    // '}', and `body` is NULL until a BodyParser parses them.
+    ArenaArray<Token> deferred;
+
+    FunctionDeclaration(Type rt, SymbolID n, ArenaArray<Parameter> p, BlockStatement* b, SourceLocation l,
+                        ArenaArray<Token> d = ArenaArray<Token>())
+        : returnType(rt), name(n), params(p), body(b), loc(l), deferred(d) {}
 };
 
 struct Program {
-    vector<FunctionDeclaration*> functions;
-    vector<VariableDeclarationStatement*> globals;
+    ArenaArray<FunctionDeclaration*> functions;
+    ArenaArray<VariableDeclarationStatement*> globals;
 
-    ~Program() {
-        for (auto func : functions) {
-            delete func;
-        }
-        for (auto glob : globals) {
-            delete glob;
-        }
-    }
-    void print(int indent = 0) const {
-        cout << string(indent, ' ') << "Program" << endl;
-        
-        if (!globals.empty()) {
-             cout << string(indent + 2, ' ') << "Globals:" << endl;
-             for(const auto& glob : globals) {
-                 glob->print(indent + 4);
-             }
-        }
-        
-        if (!functions.empty()) {
-            cout << string(indent + 2, ' ') << "Functions:" << endl;
-             for(const auto& func : functions) {
-                 func->print(indent + 4);
-             }
-        }
-    }
+    Program(ArenaArray<FunctionDeclaration*> f, ArenaArray<VariableDeclarationStatement*> g) : functions(f), globals(g) {}
 };
\ No newline at end of file
@@ -0,0 +1,560 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "arena.h"
+#include "ast.h"
+#include "flat_ast.h"
+#include "source_manager.h"
+
+using namespace std;
+
+// FNV-1a over 8-byte words, folded so every byte reaches the low bits. Not
+// cryptographic: it tells a changed file from an unchanged one.
+inline uint64_t content_checksum(string_view text) {
+    const uint64_t prime = 1099511628211ull;
+    uint64_t hash = 14695981039346656037ull ^ text.size();
+    size_t i = 0;
+    for (; i + 8 <= text.size(); i += 8) {
+        uint64_t word;
+        memcpy(&word, text.data() + i, 8);
+        hash = (hash ^ word) * prime;
+        hash ^= hash >> 29;
+    }
+    for (; i < text.size(); i++) hash = (hash ^ (uint8_t)text[i]) * prime;
+    return hash ^ (hash >> 32);
+}
+
+// An AST cache file is this header and then, each starting on an 8-byte
+// boundary: the files the tree came from, the FlatTree arrays (kinds, ends,
+// locations, data words), the text, declaration and symbol tables, and the
+// bytes of every string. Numbers are in the writer's byte order; a reader
+// with another order or version treats the file as missing.
+struct AstCacheHeader {
+    static constexpr uint32_t Version = 2;
+    static constexpr uint32_t ByteOrder = 0x01020304;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    // What the file was written under: the compiled file and the options.
+    uint64_t key;
+    // content_checksum() of everything after the header.
+    uint64_t payload;
+    uint32_t nodes;
+    uint32_t texts;
+    uint32_t declarations;
+    uint32_t symbols;
+    uint32_t files;
+    uint32_t blob;
+};
+
+// A string in the blob.
+struct AstCacheString {
+    uint32_t offset;
+    uint32_t length;
+};
+
+// A file the tree's tokens came from, with its contents when written.
+struct AstCacheFile {
+    uint64_t checksum;
+    uint64_t size;
+    AstCacheString name;
+};
+
+// `file` is 1 + the index of the file, 0 for no location.
+struct AstCacheLocation {
+    uint32_t file;
+    uint32_t offset;
+};
+
+// The Type's value and an index into the symbol table.
+struct AstCacheDeclaration {
+    uint32_t type;
+    uint32_t name;
+};
+
+// Where each section starts, from the counts in the header.
+struct AstCacheLayout {
+    size_t files, kinds, ends, locs, data, texts, declarations, symbols, blob, size;
+
+    explicit AstCacheLayout(const AstCacheHeader& h) {
+        size_t at = sizeof(AstCacheHeader);
+        files = place(at, h.files * sizeof(AstCacheFile));
+        kinds = place(at, h.nodes * sizeof(NodeKind));
+        ends = place(at, h.nodes * sizeof(NodeIndex));
+        locs = place(at, h.nodes * sizeof(AstCacheLocation));
+        data = place(at, h.nodes * sizeof(uint32_t));
+        texts = place(at, h.texts * sizeof(AstCacheString));
+        declarations = place(at, h.declarations * sizeof(AstCacheDeclaration));
+        symbols = place(at, h.symbols * sizeof(AstCacheString));
+        blob = place(at, h.blob);
+        size = at;
+    }
+
+private:
+    static size_t place(size_t& at, size_t bytes) {
+        size_t start = (at + 7) & ~(size_t)7;
+        at = start + bytes;
+        return start;
+    }
+};
+
+// Writes `program` to `path` for AstCache to load. `files` are the files its
+// tokens came from, the compiled file first. Returns false, writing nothing,
+// if the tree cannot be cached: a body kept as tokens, a location outside
+// `files`, or a file too large for 32-bit offsets. The file is written next
+// to `path` and renamed into place, so a reader never sees half of one.
+inline bool write_ast_cache(const string& path, uint64_t key, const Program& program, const SourceManager& sources,
+                            const vector<FileID>& files) {
+    for (const FunctionDeclaration* function : program.functions) {
+        if (!function->body && !function->deferred.empty()) return false;
+    }
+    FlatTree tree(program);
+    size_t nodes = tree.size();
+
+    string blob;
+    auto add_string = [&](string_view text) {
+        AstCacheString s{(uint32_t)blob.size(), (uint32_t)text.size()};
+        blob.append(text);
+        return s;
+    };
+    vector<AstCacheString> texts;
+    unordered_map<string_view, uint32_t> text_ids;
+    auto text = [&](string_view value) {
+        auto it = text_ids.emplace(value, (uint32_t)texts.size());
+        if (it.second) texts.push_back(add_string(value));
+        return it.first->second;
+    };
+    vector<AstCacheString> symbols;
+    unordered_map<SymbolID, uint32_t> symbol_ids;
+    auto symbol = [&](SymbolID id) {
+        auto it = symbol_ids.emplace(id, (uint32_t)symbols.size());
+        if (it.second) symbols.push_back(add_string(symbol_name(id)));
+        return it.first->second;
+    };
+
+    vector<AstCacheFile> cached_files;
+    unordered_map<FileID, uint32_t> slots;
+    for (FileID id : files) {
+        const SourceFile& file = sources.file(id);
+        if (file.size() > UINT32_MAX) return false;
+        if (!slots.emplace(id, (uint32_t)cached_files.size() + 1).second) continue;
+        cached_files.push_back(AstCacheFile{content_checksum(file.text()), file.size(), add_string(file.name())});
+    }
+
+    vector<NodeKind> kinds(nodes);
+    vector<NodeIndex> ends(nodes);
+    vector<AstCacheLocation> locs(nodes);
+    vector<uint32_t> data(nodes);
+    vector<AstCacheDeclaration> declarations;
+    for (NodeIndex i = 0; i < nodes; i++) {
+        FlatNode node = tree.node(i);
+        kinds[i] = node.kind();
+        ends[i] = node.end();
+        if (node.loc() != 0) {
+            const SourceFile& file = sources.file_at(node.loc());
+            auto slot = slots.find(file.id());
+            if (slot == slots.end()) return false;
+            locs[i] = AstCacheLocation{slot->second, (uint32_t)(node.loc() - file.start())};
+        }
+        switch (node.kind()) {
+        case NodeKind::Identifier:
+        case NodeKind::FunctionCall:
+            data[i] = symbol(node.symbol());
+            break;
+        case NodeKind::NumberLiteral:
+        case NodeKind::StringLiteral:
+            data[i] = text(node.text());
+            break;
+        case NodeKind::Function:
+        case NodeKind::Parameter:
+        case NodeKind::VariableDeclaration:
+            data[i] = (uint32_t)declarations.size();
+            declarations.push_back(AstCacheDeclaration{(uint32_t)node.declaration().type, symbol(node.declaration().name)});
+            break;
+        default:
+            data[i] = node.data();
+        }
+    }
+    if (blob.size() > UINT32_MAX) return false;
+
+    AstCacheHeader header = {};
+    memcpy(header.magic, "ASTCACHE", 8);
+    header.version = AstCacheHeader::Version;
+    header.byte_order = AstCacheHeader::ByteOrder;
+    header.key = key;
+    header.nodes = (uint32_t)nodes;
+    header.texts = (uint32_t)texts.size();
+    header.declarations = (uint32_t)declarations.size();
+    header.symbols = (uint32_t)symbols.size();
+    header.files = (uint32_t)cached_files.size();
+    header.blob = (uint32_t)blob.size();
+    AstCacheLayout layout(header);
+
+    string out(layout.size, '\0');
+    auto put = [&](size_t at, const void* bytes, size_t size) { if (size) memcpy(&out[at], bytes, size); };
+    put(0, &header, sizeof(header));
+    put(layout.files, cached_files.data(), cached_files.size() * sizeof(AstCacheFile));
+    put(layout.kinds, kinds.data(), nodes * sizeof(NodeKind));
+    put(layout.ends, ends.data(), nodes * sizeof(NodeIndex));
+    put(layout.locs, locs.data(), nodes * sizeof(AstCacheLocation));
+    put(layout.data, data.data(), nodes * sizeof(uint32_t));
+    put(layout.texts, texts.data(), texts.size() * sizeof(AstCacheString));
+    put(layout.declarations, declarations.data(), declarations.size() * sizeof(AstCacheDeclaration));
+    put(layout.symbols, symbols.data(), symbols.size() * sizeof(AstCacheString));
+    put(layout.blob, blob.data(), blob.size());
+    header.payload = content_checksum(string_view(out).substr(sizeof(header)));
+    put(0, &header, sizeof(header));
+
+    string temporary = path + ".tmp";
+    FILE* file = fopen(temporary.c_str(), "wb");
+    if (!file) return false;
+    bool written = fwrite(out.data(), 1, out.size(), file) == out.size();
+    written &= fclose(file) == 0;
+    if (!written || rename(temporary.c_str(), path.c_str()) != 0) {
+        remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+// A cache file mapped into memory. Its arrays are read where they lie, and
+// load() builds the pointer tree from them; literal text in that tree is a
+// view into the mapping, so the AstCache must
+// outlive it.
+class AstCache {
+public:
+    // NULL unless `path` is a whole cache file of this version written under
+    // `key`.
+    static unique_ptr<AstCache> open(const string& path, uint64_t key) {
+        unique_ptr<AstCache> cache(new AstCache);
+#ifdef SOURCE_MANAGER_POSIX
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return NULL;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || (size_t)st.st_size < sizeof(AstCacheHeader)) {
+            close(fd);
+            return NULL;
+        }
+        void* mapped = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapped == MAP_FAILED) return NULL;
+        cache->mapped = mapped;
+        cache->bytes = (const char*)mapped;
+        cache->size = (size_t)st.st_size;
+#else
+        std::ifstream in(path, std::ios::binary);
+        if (!in.is_open()) return NULL;
+        char chunk[1 << 16];
+        while (in.read(chunk, sizeof(chunk)) || in.gcount() > 0) cache->owned.append(chunk, in.gcount());
+        cache->bytes = cache->owned.data();
+        cache->size = cache->owned.size();
+        if (cache->size < sizeof(AstCacheHeader)) return NULL;
+#endif
+        const AstCacheHeader& h = cache->header();
+        if (memcmp(h.magic, "ASTCACHE", 8) != 0 || h.version != AstCacheHeader::Version ||
+            h.byte_order != AstCacheHeader::ByteOrder || h.key != key || AstCacheLayout(h).size != cache->size ||
+            content_checksum(string_view(cache->bytes, cache->size).substr(sizeof(AstCacheHeader))) != h.payload) {
+            return NULL;
+        }
+        return cache;
+    }
+
+    ~AstCache() {
+#ifdef SOURCE_MANAGER_POSIX
+        if (mapped) munmap(mapped, size);
+#endif
+    }
+
+    AstCache(const AstCache&) = delete;
+    AstCache& operator=(const AstCache&) = delete;
+
+    size_t bytes_mapped() const { return size; }
+
+    // Checks that every file the tree came from is as it was, loading those
+    // other than `source` into `sources`, then builds the tree in `arena`.
+    // NULL if a file changed or the cache file does not hold a valid tree.
+    Program* load(Arena& arena, SourceManager& sources, const SourceFile& source) {
+        const AstCacheHeader& h = header();
+        AstCacheLayout layout(h);
+        if (h.files == 0) return NULL;
+
+        files.clear();
+        const AstCacheFile* cached_files = section<AstCacheFile>(layout.files);
+        for (uint32_t i = 0; i < h.files; i++) {
+            string_view name;
+            if (!blob_string(cached_files[i].name, name)) return NULL;
+            const SourceFile* file = &source;
+            if (i > 0) {
+                try {
+                    file = &sources.file(sources.load(string(name)));
+                } catch (const std::exception&) {
+                    return NULL;
+                }
+            }
+            if (file->size() != cached_files[i].size || content_checksum(file->text()) != cached_files[i].checksum) return NULL;
+            files.push_back(file);
+        }
+
+        texts.resize(h.texts);
+        const AstCacheString* cached_texts = section<AstCacheString>(layout.texts);
+        for (uint32_t i = 0; i < h.texts; i++) {
+            if (!blob_string(cached_texts[i], texts[i])) return NULL;
+        }
+        symbols.resize(h.symbols);
+        const AstCacheString* cached_symbols = section<AstCacheString>(layout.symbols);
+        for (uint32_t i = 0; i < h.symbols; i++) {
+            string_view name;
+            if (!blob_string(cached_symbols[i], name)) return NULL;
+            symbols[i] = Interner::global().intern(name);
+        }
+        return inflate(arena, layout);
+    }
+
+private:
+    const char* bytes = nullptr;
+    size_t size = 0;
+    void* mapped = nullptr;
+    string owned;
+
+    vector<const SourceFile*> files;
+    vector<string_view> texts;
+    vector<SymbolID> symbols;
+
+    AstCache() {}
+
+    const AstCacheHeader& header() const { return *(const AstCacheHeader*)bytes; }
+
+    template <typename T>
+    const T* section(size_t offset) const { return (const T*)(bytes + offset); }
+
+    bool blob_string(AstCacheString s, string_view& out) const {
+        if ((uint64_t)s.offset + s.length > header().blob) return false;
+        out = string_view(section<char>(AstCacheLayout(header()).blob) + s.offset, s.length);
+        return true;
+    }
+
+    static bool is_statement(NodeKind kind) {
+        return (kind >= NodeKind::Block && kind <= NodeKind::Continue) || kind == NodeKind::ErrorStatement;
+    }
+    static bool is_expression(NodeKind kind) {
+        return (kind >= NodeKind::NumberLiteral && kind <= NodeKind::FunctionCall) || kind == NodeKind::ErrorExpression;
+    }
+
+    // A finished subtree waiting for its parent. Statements and expressions
+    // are kept as Statement* and Expression*.
+    struct Built {
+        NodeIndex index;
+        void* node;
+    };
+
+    // Builds the nodes last to first, so each node's children are finished
+    // before it and sit on top of `stack`, first child topmost. Every count,
+    // index and child kind is checked on the way.
+    Program* inflate(Arena& arena, const AstCacheLayout& layout) {
+        const AstCacheHeader& h = header();
+        const NodeKind* kinds = section<NodeKind>(layout.kinds);
+        const NodeIndex* ends = section<NodeIndex>(layout.ends);
+        const AstCacheLocation* locs = section<AstCacheLocation>(layout.locs);
+        const uint32_t* data = section<uint32_t>(layout.data);
+        const AstCacheDeclaration* declarations = section<AstCacheDeclaration>(layout.declarations);
+        size_t nodes = h.nodes;
+
+        vector<Built> stack;
+        vector<Built> kids;
+        vector<Statement*> statements;
+        vector<Expression*> expressions;
+        vector<Parameter> params;
+        vector<VariableDeclarationStatement*> globals;
+        vector<FunctionDeclaration*> functions;
+        for (size_t i = nodes; i-- > 0;) {
+            NodeKind kind = kinds[i];
+            if (kind > NodeKind::ErrorExpression || ends[i] <= i || ends[i] > nodes) return NULL;
+            kids.clear();
+            NodeIndex child = (NodeIndex)i + 1;
+            while (child < ends[i]) {
+                if (kids.size() == stack.size() || stack[stack.size() - 1 - kids.size()].index != child) return NULL;
+                kids.push_back(stack[stack.size() - 1 - kids.size()]);
+                child = ends[child];
+            }
+            if (child != ends[i]) return NULL;
+            stack.resize(stack.size() - kids.size());
+
+            auto kid_kind = [&](size_t k) { return kinds[kids[k].index]; };
+            auto statement = [&](size_t k) -> Statement* {
+                return k < kids.size() && is_statement(kid_kind(k)) ? (Statement*)kids[k].node : NULL;
+            };
+            auto expression = [&](size_t k) -> Expression* {
+                return k < kids.size() && is_expression(kid_kind(k)) ? (Expression*)kids[k].node : NULL;
+            };
+            auto text = [&](string_view& out) {
+                if (data[i] >= texts.size()) return false;
+                out = texts[data[i]];
+                return true;
+            };
+            auto symbol = [&](uint32_t index, SymbolID& out) {
+                if (index >= symbols.size()) return false;
+                out = symbols[index];
+                return true;
+            };
+            auto op = [&](Operator& out) {
+                if (data[i] >= OperatorCount) return false;
+                out = Operator(data[i]);
+                return true;
+            };
+            auto declaration = [&](Type& type, SymbolID& name) {
+                if (data[i] >= h.declarations || declarations[data[i]].type >= TypeCount) return false;
+                type = Type(declarations[data[i]].type);
+                return symbol(declarations[data[i]].name, name);
+            };
+
+            SourceLocation loc = 0;
+            if (locs[i].file != 0) {
+                if (locs[i].file > files.size() || locs[i].offset > files[locs[i].file - 1]->size()) return NULL;
+                loc = files[locs[i].file - 1]->location(locs[i].offset);
+            }
+
+            void* node = NULL;
+            string_view value;
+            Operator applied;
+            Type type;
+            SymbolID name;
+            switch (kind) {
+            case NodeKind::Program: {
+                if (data[i] > kids.size()) return NULL;
+                globals.clear();
+                functions.clear();
+                for (size_t k = 0; k < kids.size(); k++) {
+                    NodeKind expected = k < data[i] ? NodeKind::VariableDeclaration : NodeKind::Function;
+                    if (kid_kind(k) != expected) return NULL;
+                    if (k < data[i]) globals.push_back(static_cast<VariableDeclarationStatement*>((Statement*)kids[k].node));
+                    else functions.push_back((FunctionDeclaration*)kids[k].node);
+                }
+                node = arena.make<Program>(arena.copy(functions), arena.copy(globals));
+                break;
+            }
+            case NodeKind::Function: {
+                params.clear();
+                size_t k = 0;
+                for (; k < kids.size() && kid_kind(k) == NodeKind::Parameter; k++) params.push_back(*(Parameter*)kids[k].node);
+                BlockStatement* body = NULL;
+                if (k < kids.size()) {
+                    if (k + 1 != kids.size() || kid_kind(k) != NodeKind::Block) return NULL;
+                    body = static_cast<BlockStatement*>((Statement*)kids[k].node);
+                }
+                if (!declaration(type, name)) return NULL;
+                node = arena.make<FunctionDeclaration>(type, name, arena.copy(params), body, loc);
+                break;
+            }
+            case NodeKind::Parameter:
+                if (!kids.empty() || !declaration(type, name)) return NULL;
+                node = arena.make<Parameter>(type, name, loc);
+                break;
+            case NodeKind::Block:
+                statements.clear();
+                for (size_t k = 0; k < kids.size(); k++) {
+                    if (!statement(k)) return NULL;
+                    statements.push_back(statement(k));
+                }
+                node = (Statement*)arena.make<BlockStatement>(arena.copy(statements), loc);
+                break;
+            case NodeKind::ExpressionStatement:
+                if (kids.size() != 1 || !expression(0)) return NULL;
+                node = (Statement*)arena.make<ExpressionStatement>(expression(0), loc);
+                break;
+            case NodeKind::VariableDeclaration:
+                if (kids.size() > 1 || (kids.size() == 1 && !expression(0)) || !declaration(type, name)) return NULL;
+                node = (Statement*)arena.make<VariableDeclarationStatement>(type, name, expression(0), loc);
+                break;
+            case NodeKind::If:
+                if (data[i] > 1 || kids.size() != 2 + data[i] || !expression(0) || !statement(1) || (data[i] && !statement(2))) return NULL;
+                node = (Statement*)arena.make<IfStatement>(expression(0), statement(1), statement(2), loc);
+                break;
+            case NodeKind::While:
+                if (kids.size() != 2 || !expression(0) || !statement(1)) return NULL;
+                node = (Statement*)arena.make<WhileStatement>(expression(0), statement(1), loc);
+                break;
+            case NodeKind::For: {
+                if (data[i] > (ForInitializer | ForCondition | ForIncrement)) return NULL;
+                size_t k = 0;
+                Statement* initializer = NULL;
+                Expression* condition = NULL;
+                Expression* increment = NULL;
+                if ((data[i] & ForInitializer) && !(initializer = statement(k++))) return NULL;
+                if ((data[i] & ForCondition) && !(condition = expression(k++))) return NULL;
+                if ((data[i] & ForIncrement) && !(increment = expression(k++))) return NULL;
+                if (k + 1 != kids.size() || !statement(k)) return NULL;
+                node = (Statement*)arena.make<ForStatement>(initializer, condition, increment, statement(k), loc);
+                break;
+            }
+            case NodeKind::Return:
+                if (kids.size() > 1 || (kids.size() == 1 && !expression(0))) return NULL;
+                node = (Statement*)arena.make<ReturnStatement>(expression(0), loc);
+                break;
+            case NodeKind::Break:
+                if (!kids.empty()) return NULL;
+                node = (Statement*)arena.make<BreakStatement>(loc);
+                break;
+            case NodeKind::Continue:
+                if (!kids.empty()) return NULL;
+                node = (Statement*)arena.make<ContinueStatement>(loc);
+                break;
+            case NodeKind::ErrorStatement:
+                if (!kids.empty()) return NULL;
+                node = (Statement*)arena.make<ErrorStatement>(loc);
+                break;
+            case NodeKind::NumberLiteral:
+                if (!kids.empty() || !text(value)) return NULL;
+                node = (Expression*)arena.make<NumberLiteral>(value, loc);
+                break;
+            case NodeKind::StringLiteral:
+                if (!kids.empty() || !text(value)) return NULL;
+                node = (Expression*)arena.make<StringLiteral>(value, loc);
+                break;
+            case NodeKind::BoolLiteral:
+                if (!kids.empty() || data[i] > 1) return NULL;
+                node = (Expression*)arena.make<BoolLiteral>(data[i] != 0, loc);
+                break;
+            case NodeKind::Identifier:
+                if (!kids.empty() || !symbol(data[i], name)) return NULL;
+                node = (Expression*)arena.make<Identifier>(name, loc);
+                break;
+            case NodeKind::BinaryOperation:
+                if (kids.size() != 2 || !expression(0) || !expression(1) || !op(applied)) return NULL;
+                node = (Expression*)arena.make<BinaryOperation>(expression(0), applied, expression(1), loc);
+                break;
+            case NodeKind::UnaryOp:
+                if (kids.size() != 1 || !expression(0) || !op(applied)) return NULL;
+                node = (Expression*)arena.make<UnaryOp>(applied, expression(0), loc);
+                break;
+            case NodeKind::Assignment:
+                if (kids.size() != 2 || kid_kind(0) != NodeKind::Identifier || !expression(1) || !op(applied)) return NULL;
+                node = (Expression*)arena.make<Assignment>(static_cast<Identifier*>(expression(0)), applied, expression(1), loc);
+                break;
+            case NodeKind::FunctionCall:
+                expressions.clear();
+                for (size_t k = 0; k < kids.size(); k++) {
+                    if (!expression(k)) return NULL;
+                    expressions.push_back(expression(k));
+                }
+                if (!symbol(data[i], name)) return NULL;
+                node = (Expression*)arena.make<FunctionCall>(name, arena.copy(expressions), loc);
+                break;
+            case NodeKind::ErrorExpression:
+                if (!kids.empty()) return NULL;
+                node = (Expression*)arena.make<ErrorExpression>(loc);
+                break;
+            }
+            stack.push_back(Built{(NodeIndex)i, node});
+        }
+        if (stack.size() != 1 || nodes == 0 || kinds[0] != NodeKind::Program) return NULL;
+        return (Program*)stack.back().node;
+    }
+};
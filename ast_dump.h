@@ -0,0 +1,450 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+#include "ast.h"
+#include "output_buffer.h"
+
+enum class DumpFormat : uint8_t { Text, Json, SExpression };
+
+// Writes a Program to an OutputBuffer in one of three formats:
+//
+//   Text         the indented tree, one node per line, with labels such as
+//                "Condition:" above some children.
+//   Json         one object per node: "kind", "line", the node's attributes,
+//                then a member per child, or an array for a list of them.
+//                A missing optional child is null.
+//   SExpression  (kind :line N :attribute value ... :child (...) :list (...)),
+//                with nil for a missing child.
+//
+// JSON and S-expressions use the kind names of the text dump and are written
+// on one line. The walk keeps one Frame per level of the tree, saying how far
+// through its node's children it has got, so memory grows with the depth of
+// the tree, not its size, and the call stack stays flat.
+class AstDumper : private AstVisitor<AstDumper> {
+public:
+    AstDumper(const SourceManager& sources, OutputBuffer& out, DumpFormat format)
+        : sources(sources), out(out), format(format) {}
+
+    void dump(const Program* program) {
+        open(NodeRef{NodeKind::Program, program}, 0);
+        while (!frames.empty()) {
+            Frame& frame = frames.back();
+            Slot slot = slot_of(frame.node, frame.slot, frame.item);
+            if (!slot.key) {
+                close(frame);
+                frames.pop_back();
+                continue;
+            }
+            if (frame.item == 0) begin_slot(frame, slot);
+            if (frame.item < slot.count) {
+                if (frame.item > 0 && format != DumpFormat::Text) out.put(format == DumpFormat::Json ? ',' : ' ');
+                frame.item++;
+                open(slot.child, frame.indent + (slot.label && format == DumpFormat::Text ? 4 : 2));
+                continue;
+            }
+            if (slot.list && format != DumpFormat::Text) out.put(format == DumpFormat::Json ? ']' : ')');
+            frame.slot++;
+            frame.item = 0;
+        }
+        if (format != DumpFormat::Text) out.put('\n');
+    }
+
+private:
+    friend class AstVisitor<AstDumper>;
+
+    // A node of any of the types below Program, with its kind.
+    struct NodeRef {
+        NodeKind kind;
+        const void* node;
+    };
+
+    // A node being written and the child it is up to: item `item` of slot
+    // `slot`. `indent` is the node's indent in the text format.
+    struct Frame {
+        NodeRef node;
+        uint32_t indent;
+        uint32_t slot;
+        size_t item;
+    };
+
+    // One of a node's named children, or a list of them. `child` is the
+    // item asked for if there is one; `key` is NULL past a node's last slot.
+    // In text, `label` is printed above a slot that is not empty and its
+    // nodes go 4 deeper than their parent instead of 2.
+    struct Slot {
+        const char* key = NULL;
+        const char* label = NULL;
+        bool list = false;
+        size_t count = 0;
+        NodeRef child = NodeRef();
+    };
+
+    const SourceManager& sources;
+    OutputBuffer& out;
+    DumpFormat format;
+    vector<Frame> frames;
+    // Header state for the node being opened.
+    bool has_attributes = false;
+    char scratch[4];
+    // The line of the last node written spans [line_begin, line_end).
+    // Nodes come in source order, so most are on the line before them.
+    SourceLocation line_begin = 0;
+    SourceLocation line_end = 0;
+    uint32_t last_line = 0;
+
+    static constexpr const char* names[NodeKindCount] = {
+        "Program", "FunctionDeclaration", "Param", "Block", "ExpressionStatement", "VariableDeclaration",
+        "IfStatement", "WhileStatement", "ForStatement", "ReturnStatement", "BreakStatement", "ContinueStatement",
+        "NumberLiteral", "StringLiteral", "BoolLiteral", "Identifier", "BinaryOperation", "UnaryOp", "Assignment", "FunctionCall",
+        "ErrorStatement", "ErrorExpression"
+    };
+
+    static NodeRef ref(const Expression* node) { return NodeRef{node->kind, node}; }
+    static NodeRef ref(const Statement* node) { return NodeRef{node->kind, node}; }
+    static NodeRef ref(const FunctionDeclaration* node) { return NodeRef{NodeKind::Function, node}; }
+    static NodeRef ref(const Parameter& node) { return NodeRef{NodeKind::Parameter, &node}; }
+
+    template <typename T>
+    static Slot list(const char* key, const char* label, ArenaArray<T> items, size_t i) {
+        Slot slot;
+        slot.key = key;
+        slot.label = label;
+        slot.list = true;
+        slot.count = items.size();
+        if (i < items.size()) slot.child = ref(items[i]);
+        return slot;
+    }
+
+    template <typename T>
+    static Slot single(const char* key, const char* label, const T* node) {
+        Slot slot;
+        slot.key = key;
+        slot.label = label;
+        if (node) {
+            slot.count = 1;
+            slot.child = ref(node);
+        }
+        return slot;
+    }
+
+    static bool is_expression(NodeKind kind) {
+        return (kind >= NodeKind::NumberLiteral && kind <= NodeKind::FunctionCall) || kind == NodeKind::ErrorExpression;
+    }
+
+    // Slot `s` of `node`, with item `i` of it as `child`.
+    static Slot slot_of(NodeRef node, uint32_t s, size_t i) {
+        switch (node.kind) {
+        case NodeKind::Program: {
+            const Program* p = (const Program*)node.node;
+            if (s == 0) return list("globals", "Globals:", p->globals, i);
+            if (s == 1) return list("functions", "Functions:", p->functions, i);
+            break;
+        }
+        case NodeKind::Function: {
+            const FunctionDeclaration* p = (const FunctionDeclaration*)node.node;
+            if (s == 0) return list("parameters", "Parameters:", p->params, i);
+            if (s == 1) return single("body", NULL, p->body);
+            break;
+        }
+        case NodeKind::Block:
+            if (s == 0) return list("statements", NULL, ((const BlockStatement*)node.node)->statements, i);
+            break;
+        case NodeKind::ExpressionStatement:
+            if (s == 0) return single("expression", NULL, ((const ExpressionStatement*)node.node)->expression);
+            break;
+        case NodeKind::VariableDeclaration:
+            if (s == 0) return single("initializer", "Initializer:", ((const VariableDeclarationStatement*)node.node)->initializer);
+            break;
+        case NodeKind::If: {
+            const IfStatement* p = (const IfStatement*)node.node;
+            if (s == 0) return single("condition", "Condition:", p->condition);
+            if (s == 1) return single("then", "Then:", p->thenBranch);
+            if (s == 2) return single("else", "Else:", p->elseBranch);
+            break;
+        }
+        case NodeKind::While: {
+            const WhileStatement* p = (const WhileStatement*)node.node;
+            if (s == 0) return single("condition", "Condition:", p->condition);
+            if (s == 1) return single("body", "Body:", p->body);
+            break;
+        }
+        case NodeKind::For: {
+            const ForStatement* p = (const ForStatement*)node.node;
+            if (s == 0) return single("initializer", "Initializer:", p->initializer);
+            if (s == 1) return single("condition", "Condition:", p->condition);
+            if (s == 2) return single("increment", "Increment:", p->increment);
+            if (s == 3) return single("body", "Body:", p->body);
+            break;
+        }
+        case NodeKind::Return:
+            if (s == 0) return single("value", NULL, ((const ReturnStatement*)node.node)->returnValue);
+            break;
+        case NodeKind::BinaryOperation: {
+            const BinaryOperation* p = (const BinaryOperation*)node.node;
+            if (s == 0) return single("left", NULL, p->left);
+            if (s == 1) return single("right", NULL, p->right);
+            break;
+        }
+        case NodeKind::UnaryOp:
+            if (s == 0) return single("operand", NULL, ((const UnaryOp*)node.node)->right);
+            break;
+        case NodeKind::Assignment:
+            if (s == 0) return single("value", NULL, ((const Assignment*)node.node)->value);
+            break;
+        case NodeKind::FunctionCall:
+            if (s == 0) return list("arguments", "Arguments:", ((const FunctionCall*)node.node)->arguments, i);
+            break;
+        default:
+            break;
+        }
+        return Slot();
+    }
+
+    void open(NodeRef node, uint32_t indent) {
+        frames.push_back(Frame{node, indent, 0, 0});
+        switch (node.kind) {
+        case NodeKind::Program: visit((const Program*)node.node); break;
+        case NodeKind::Function: visit((const FunctionDeclaration*)node.node); break;
+        case NodeKind::Parameter: visit((const Parameter*)node.node); break;
+        default:
+            if (is_expression(node.kind)) dispatch((const Expression*)node.node);
+            else dispatch((const Statement*)node.node);
+        }
+    }
+
+    void begin_slot(const Frame& frame, const Slot& slot) {
+        if (format == DumpFormat::Text) {
+            if (slot.label && slot.count > 0) {
+                out.spaces(frame.indent + 2);
+                out.write(slot.label);
+                out.put('\n');
+            }
+            return;
+        }
+        bool json = format == DumpFormat::Json;
+        out.write(json ? ",\"" : " :");
+        out.write(slot.key);
+        out.write(json ? "\":" : " ");
+        if (slot.list) out.put(json ? '[' : '(');
+        else if (slot.count == 0) out.write(json ? "null" : "nil");
+    }
+
+    void close(const Frame& frame) {
+        if (format != DumpFormat::Text) {
+            out.put(format == DumpFormat::Json ? '}' : ')');
+            return;
+        }
+        if (frame.node.kind == NodeKind::Block) {
+            out.spaces(frame.indent);
+            out.write("}\n");
+        } else if (frame.node.kind == NodeKind::Function) {
+            const FunctionDeclaration* p = (const FunctionDeclaration*)frame.node.node;
+            if (!p->body && !p->deferred.empty()) {
+                out.spaces(frame.indent + 2);
+                out.write("Body: ");
+                out.number(p->deferred.size());
+                out.write(" tokens, not parsed\n");
+            }
+        }
+    }
+
+    // Each visit() writes the header of its node: begin(), the attributes,
+    // then end(). In text an attribute is written after `text_before`, or
+    // left out if that is NULL, and the header ends with `text_after` if it
+    // had any.
+    void begin(NodeKind kind) {
+        has_attributes = false;
+        if (format == DumpFormat::Text) {
+            out.spaces(frames.back().indent);
+            out.write(names[(size_t)kind]);
+            return;
+        }
+        out.write(format == DumpFormat::Json ? "{\"kind\":\"" : "(");
+        out.write(names[(size_t)kind]);
+        if (format == DumpFormat::Json) out.put('"');
+    }
+
+    void begin(NodeKind kind, SourceLocation loc) {
+        begin(kind);
+        if (format != DumpFormat::Text) number("line", line_of(loc));
+    }
+
+    void attribute(const char* key, string_view value, const char* text_before = "(", bool quoted = true) {
+        if (format == DumpFormat::Text) {
+            if (!text_before) return;
+            out.write(text_before);
+            out.write(value);
+            has_attributes = true;
+            return;
+        }
+        start_attribute(key);
+        if (quoted) quote(value);
+        else out.write(value);
+    }
+
+    void number(const char* key, uint64_t value) {
+        if (format == DumpFormat::Text) return;
+        start_attribute(key);
+        out.number(value);
+    }
+
+    void start_attribute(const char* key) {
+        bool json = format == DumpFormat::Json;
+        out.write(json ? ",\"" : " :");
+        out.write(key);
+        out.write(json ? "\":" : " ");
+    }
+
+    void end(SourceLocation loc, const char* text_after = ")") {
+        if (format != DumpFormat::Text) return;
+        if (has_attributes) out.write(text_after);
+        out.write(" [line: ");
+        out.number(line_of(loc));
+        out.write("]\n");
+    }
+
+    uint32_t line_of(SourceLocation loc) {
+        if (loc >= line_begin && loc < line_end) return last_line;
+        const SourceFile& file = sources.file_at(loc);
+        last_line = file.line_of(loc - file.start());
+        line_begin = file.location(file.line_start(last_line));
+        line_end = last_line < file.line_count() ? file.location(file.line_start(last_line + 1)) : file.location(file.size()) + 1;
+        return last_line;
+    }
+
+    // `text` as a string literal of the format.
+    void quote(string_view text) {
+        out.put('"');
+        size_t start = 0;
+        for (size_t i = 0; i < text.size(); i++) {
+            unsigned char c = text[i];
+            bool control = c < 0x20 && format == DumpFormat::Json;
+            if (c != '"' && c != '\\' && !control) continue;
+            out.write(text.substr(start, i - start));
+            start = i + 1;
+            if (control) {
+                static const char hex[] = "0123456789abcdef";
+                out.write("\\u00");
+                out.put(hex[c >> 4]);
+                out.put(hex[c & 15]);
+            } else {
+                out.put('\\');
+                out.put(c);
+            }
+        }
+        out.write(text.substr(start));
+        out.put('"');
+    }
+
+    void visit(const Program*) {
+        begin(NodeKind::Program);
+        if (format == DumpFormat::Text) out.put('\n');
+    }
+
+    void visit(const FunctionDeclaration* p) {
+        begin(NodeKind::Function, p->loc);
+        attribute("name", symbol_name(p->name));
+        attribute("returns", spelling(p->returnType), ", returns: ");
+        if (!p->body && !p->deferred.empty()) number("deferred_tokens", p->deferred.size());
+        end(p->loc);
+    }
+
+    void visit(const Parameter* p) {
+        begin(NodeKind::Parameter, p->loc);
+        attribute("name", symbol_name(p->name));
+        attribute("type", spelling(p->type), ", type: ");
+        end(p->loc);
+    }
+
+    void visit(const NumberLiteral* p) {
+        begin(p->kind, p->loc);
+        attribute("value", p->value);
+        end(p->loc);
+    }
+
+    void visit(const StringLiteral* p) {
+        begin(p->kind, p->loc);
+        attribute("value", p->value, "(\"");
+        end(p->loc, "\")");
+    }
+
+    void visit(const BoolLiteral* p) {
+        begin(p->kind, p->loc);
+        attribute("value", p->value ? "true" : "false", "(", false);
+        end(p->loc);
+    }
+
+    void visit(const Identifier* p) {
+        begin(p->kind, p->loc);
+        attribute("name", symbol_name(p->name));
+        end(p->loc);
+    }
+
+    void visit(const BinaryOperation* p) {
+        begin(p->kind, p->loc);
+        attribute("op", spelling(p->op));
+        end(p->loc);
+    }
+
+    void visit(const UnaryOp* p) {
+        begin(p->kind, p->loc);
+        attribute("op", spelling(p->op));
+        end(p->loc);
+    }
+
+    // Text shows a compound assignment's operator only.
+    void visit(const Assignment* p) {
+        begin(p->kind, p->loc);
+        attribute("target", symbol_name(p->identifier->name));
+        string_view op = "=";
+        if (p->op != Operator::Assign) {
+            string_view applied = spelling(p->op);
+            memcpy(scratch, applied.data(), applied.size());
+            scratch[applied.size()] = '=';
+            op = string_view(scratch, applied.size() + 1);
+        }
+        attribute("op", op, p->op == Operator::Assign ? NULL : " ");
+        end(p->loc);
+    }
+
+    void visit(const FunctionCall* p) {
+        begin(p->kind, p->loc);
+        attribute("callee", symbol_name(p->callee));
+        end(p->loc);
+    }
+
+    void visit(const VariableDeclarationStatement* p) {
+        begin(p->kind, p->loc);
+        attribute("name", symbol_name(p->name));
+        attribute("type", spelling(p->type), ", type: ");
+        end(p->loc);
+    }
+
+    // "Block [line: N] {", closed by a "}" line.
+    void visit(const BlockStatement* p) {
+        begin(p->kind, p->loc);
+        if (format != DumpFormat::Text) return;
+        out.write(" [line: ");
+        out.number(line_of(p->loc));
+        out.write("] {\n");
+    }
+
+    void visit(const ErrorExpression* p) { bare(p->kind, p->loc); }
+    void visit(const ExpressionStatement* p) { bare(p->kind, p->loc); }
+    void visit(const IfStatement* p) { bare(p->kind, p->loc); }
+    void visit(const WhileStatement* p) { bare(p->kind, p->loc); }
+    void visit(const ForStatement* p) { bare(p->kind, p->loc); }
+    void visit(const ReturnStatement* p) { bare(p->kind, p->loc); }
+    void visit(const BreakStatement* p) { bare(p->kind, p->loc); }
+    void visit(const ContinueStatement* p) { bare(p->kind, p->loc); }
+    void visit(const ErrorStatement* p) { bare(p->kind, p->loc); }
+
+    // A header with no attributes.
+    void bare(NodeKind kind, SourceLocation loc) {
+        begin(kind, loc);
+        end(loc);
+    }
+};
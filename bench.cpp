@@ -0,0 +1,1180 @@
+// Throughput benchmarks for the front end.
+//
+//   g++ -O2 bench.cpp -o bench
+//   ./bench scan [--mb N] [files...]
+//   ./bench expr [--mb N]
+//   ./bench ast [--mb N]
+//   ./bench visit [--mb N]
+//   ./bench deep [--mb N]
+//   ./bench parse [--mb N]
+//   ./bench lazy [--mb N]
+//   ./bench cache [--mb N]
+//   ./bench dump [--mb N]
+//
+// Inputs default to sample_C_code/*.c and are concatenated until the corpus is
+// at least N megabytes (default 16), so small samples still give stable numbers.
+// All modes but `scan` generate their own input instead.
+
+#include "lexer_backends.cpp"
+#include "preprocessor.h"
+#include "parser.h"
+#include "parallel_parser.h"
+#include "flat_ast.h"
+#include "typechecker.h"
+#include "ast_cache.h"
+#include "ast_dump.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <dirent.h>
+#include <fcntl.h>
+#include <filesystem>
+
+static vector<string> default_inputs()
+{
+    vector<string> paths;
+    if (DIR *dir = opendir("sample_C_code"))
+    {
+        while (dirent *entry = readdir(dir))
+        {
+            string name = entry->d_name;
+            if (name.size() > 2 && name.compare(name.size() - 2, 2, ".c") == 0)
+                paths.push_back("sample_C_code/" + name);
+        }
+        closedir(dir);
+    }
+    sort(paths.begin(), paths.end());
+    return paths;
+}
+
+static string build_corpus(const vector<string> &paths, size_t bytes)
+{
+    SourceManager sources;
+    string sample;
+    for (const string &path : paths)
+    {
+        sample += sources.file(sources.load(path)).text();
+        sample += '\n';
+    }
+    if (sample.empty())
+        throw runtime_error("no input files");
+    string corpus;
+    corpus.reserve(bytes + sample.size());
+    while (corpus.size() < bytes)
+        corpus += sample;
+    return corpus;
+}
+
+template <typename F>
+static double best_seconds(int runs, F &&body)
+{
+    double best = 1e30;
+    for (int r = 0; r < runs; r++)
+    {
+        auto start = chrono::steady_clock::now();
+        body();
+        chrono::duration<double> took = chrono::steady_clock::now() - start;
+        best = min(best, took.count());
+    }
+    return best;
+}
+
+// Splits the corpus into the runs the raw lexer skips with the kernels alone,
+// leaving out token construction and keyword/operator lookup.
+static size_t walk_runs(const ScanKernels &kernels, string_view text)
+{
+    const char *p = text.data();
+    const char *end = p + text.size();
+    size_t runs = 0;
+    while (p < end)
+    {
+        char c = *p;
+        if (simd_scan::is_space(c))
+            p = kernels.skip_whitespace(p, end);
+        else if (RawLexer::isalpha(c) || c == '_')
+            p = kernels.skip_identifier(p, end);
+        else if (RawLexer::isdigit(c))
+            p = kernels.skip_digits(p, end);
+        else if (c == '/' && p + 1 < end && p[1] == '/')
+            p = min(kernels.find_byte(p, end, '\n') + 1, end);
+        else if (c == '/' && p + 1 < end && p[1] == '*')
+            p = min(kernels.find_comment_end(p, end) + 2, end);
+        else
+            p++;
+        runs++;
+    }
+    return runs;
+}
+
+// Kernel and raw lexer throughput at each scan level; Scalar is the byte-at-a-time baseline.
+static int bench_scan(const string &corpus)
+{
+    SourceManager sources;
+    const SourceFile &file = sources.file(sources.add_buffer("<corpus>", corpus));
+    size_t expected = 0;
+    double walkBaseline = 0, lexBaseline = 0;
+    for (ScanLevel level : {ScanLevel::Scalar, ScanLevel::SSE2, ScanLevel::AVX2})
+    {
+        const ScanKernels &kernels = scan_kernels(level);
+        if (kernels.level != level)
+        {
+            cout << "scan/" << (level == ScanLevel::AVX2 ? "avx2" : "sse2") << ": not supported\n";
+            continue;
+        }
+        size_t runs = 0;
+        double walk = best_seconds(5, [&] { runs = walk_runs(kernels, corpus); });
+        size_t count = 0;
+        double lex = best_seconds(5, [&] {
+            RawLexer lexer(file, 0, kernels);
+            count = 1;
+            while (lexer.next().type != T_EOF)
+                count++;
+        });
+        if (!expected)
+        {
+            expected = count;
+            walkBaseline = walk;
+            lexBaseline = lex;
+        }
+        else if (count != expected)
+        {
+            cerr << "scan/" << kernels.name << ": token count " << count << " != " << expected << endl;
+            return 1;
+        }
+        printf("scan/%-6s runs  %8.1f MB/s  %10zu runs    %.2fx\n", kernels.name,
+               corpus.size() / walk / 1e6, runs, walkBaseline / walk);
+#ifdef SIMD_SCAN_X86
+        // The vector class skips the kernel set passes over for the scalar ones.
+        if (level != ScanLevel::Scalar)
+        {
+            ScanKernels vector = kernels;
+            bool avx2 = level == ScanLevel::AVX2;
+            vector.skip_whitespace = avx2 ? simd_scan::skip_whitespace_avx2 : simd_scan::skip_whitespace_sse2;
+            vector.skip_identifier = avx2 ? simd_scan::skip_identifier_avx2 : simd_scan::skip_identifier_sse2;
+            vector.skip_digits = avx2 ? simd_scan::skip_digits_avx2 : simd_scan::skip_digits_sse2;
+            double vectorWalk = best_seconds(5, [&] { walk_runs(vector, corpus); });
+            printf("scan/%-6s runs  %8.1f MB/s  vector class skips  %.2fx\n", kernels.name,
+                   corpus.size() / vectorWalk / 1e6, walkBaseline / vectorWalk);
+        }
+#endif
+        printf("scan/%-6s lexer %8.1f MB/s  %10zu tokens  %.2fx\n", kernels.name,
+               corpus.size() / lex / 1e6, count, lexBaseline / lex);
+    }
+    return 0;
+}
+
+// Random expression over the parameters a, b and c; every binary operator,
+// unary operators, calls and parentheses, nested up to `depth`.
+static void write_expression(string &out, uint64_t &seed, int depth)
+{
+    static const char *const binary[] = {"||", "&&", "|", "^", "&", "==", "!=", "<", ">", "<=", ">=",
+                                         "<<", ">>", "+", "-", "*", "/", "%"};
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    unsigned pick = seed >> 33;
+    if (depth == 0 || pick % 8 == 0)
+    {
+        static const char *const leaves[] = {"a", "b", "c", "1", "42", "2.5"};
+        out += leaves[pick / 8 % 6];
+        return;
+    }
+    switch (pick % 8)
+    {
+    case 1:
+        out += '(';
+        write_expression(out, seed, depth - 1);
+        out += ')';
+        return;
+    case 2:
+        out += pick / 8 % 2 ? '-' : '!';
+        write_expression(out, seed, depth - 1);
+        return;
+    case 3:
+        out += "f(";
+        write_expression(out, seed, depth - 1);
+        out += ", ";
+        write_expression(out, seed, depth - 1);
+        out += ')';
+        return;
+    default:
+        write_expression(out, seed, depth - 1);
+        out += ' ';
+        out += binary[pick / 8 % 18];
+        out += ' ';
+        write_expression(out, seed, depth - 1);
+    }
+}
+
+static string build_expression_corpus(size_t bytes)
+{
+    static const char *const assign[] = {"=", "+=", "-=", "*=", "<<=", "|=", "^="};
+    string corpus;
+    uint64_t seed = 1;
+    for (size_t function = 0; corpus.size() < bytes; function++)
+    {
+        corpus += "int f" + to_string(function) + "(int a, int b, int c) {\n    int x = ";
+        write_expression(corpus, seed, 6);
+        corpus += ";\n";
+        for (int i = 0; i < 16; i++)
+        {
+            corpus += "    x ";
+            corpus += assign[(seed >> 40) % 7];
+            corpus += ' ';
+            write_expression(corpus, seed, 6);
+            corpus += ";\n";
+        }
+        corpus += "    return x;\n}\n";
+    }
+    return corpus;
+}
+
+// Random statement nesting up to `depth`: every statement kind, with blocks,
+// declarations and expressions from write_expression().
+static void write_statement(string &out, uint64_t &seed, int depth, int indent)
+{
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    unsigned pick = seed >> 33;
+    out.append(indent, ' ');
+    switch (depth == 0 ? pick % 3 : pick % 8)
+    {
+    case 0:
+        out += "x = ";
+        write_expression(out, seed, 3);
+        out += ";\n";
+        return;
+    case 1:
+        out += "int y = ";
+        write_expression(out, seed, 3);
+        out += ";\n";
+        return;
+    case 2:
+        out += "f(a, ";
+        write_expression(out, seed, 2);
+        out += ");\n";
+        return;
+    case 3:
+        out += "if (";
+        write_expression(out, seed, 2);
+        out += ") {\n";
+        write_statement(out, seed, depth - 1, indent + 4);
+        out.append(indent, ' ');
+        out += "} else\n";
+        write_statement(out, seed, depth - 1, indent + 4);
+        return;
+    case 4:
+        out += "while (a < b) {\n";
+        write_statement(out, seed, depth - 1, indent + 4);
+        write_statement(out, seed, depth - 1, indent + 4);
+        out.append(indent, ' ');
+        out += "}\n";
+        return;
+    case 5:
+        out += "for (int i = 0; i < c; i += 1)\n";
+        write_statement(out, seed, depth - 1, indent + 4);
+        return;
+    case 6:
+        out += pick / 8 % 2 ? "break;\n" : "return x;\n";
+        return;
+    default:
+        out += "{\n";
+        write_statement(out, seed, depth - 1, indent + 4);
+        write_statement(out, seed, depth - 1, indent + 4);
+        out.append(indent, ' ');
+        out += "}\n";
+    }
+}
+
+static string build_statement_corpus(size_t bytes)
+{
+    string corpus;
+    uint64_t seed = 1;
+    for (size_t function = 0; corpus.size() < bytes; function++)
+    {
+        corpus += "int g" + to_string(function) + " = 1;\n";
+        corpus += "int f" + to_string(function) + "(int a, int b, int c) {\n    int x = 0;\n";
+        for (int i = 0; i < 8; i++)
+            write_statement(corpus, seed, 4, 4);
+        corpus += "    return x;\n}\n";
+    }
+    return corpus;
+}
+
+// What a pass over the tree finds: the node count, the identifier uses and a
+// checksum of their names, so the walks below can be checked against each other.
+struct Census
+{
+    size_t nodes = 0;
+    size_t identifiers = 0;
+    uint64_t names = 0;
+
+    bool operator==(const Census &other) const
+    {
+        return nodes == other.nodes && identifiers == other.identifiers && names == other.names;
+    }
+};
+
+// Walks the pointer tree with the AstVisitor dispatch every pass uses: one
+// switch on the node's kind.
+struct PointerCensus : AstVisitor<PointerCensus>
+{
+    Census census;
+
+    template <typename Node>
+    void walk(const Node *node)
+    {
+        census.nodes++;
+        dispatch(node);
+    }
+
+    void visit(const NumberLiteral *) {}
+    void visit(const StringLiteral *) {}
+    void visit(const BoolLiteral *) {}
+    void visit(const ErrorExpression *) {}
+    void visit(const Identifier *p)
+    {
+        census.identifiers++;
+        census.names += p->name;
+    }
+    void visit(const BinaryOperation *p)
+    {
+        walk(p->left);
+        walk(p->right);
+    }
+    void visit(const UnaryOp *p) { walk(p->right); }
+    void visit(const Assignment *p)
+    {
+        walk(p->identifier);
+        walk(p->value);
+    }
+    void visit(const FunctionCall *p)
+    {
+        for (const Expression *arg : p->arguments)
+            walk(arg);
+    }
+
+    void visit(const BreakStatement *) {}
+    void visit(const ContinueStatement *) {}
+    void visit(const ErrorStatement *) {}
+    void visit(const BlockStatement *p)
+    {
+        for (const Statement *statement : p->statements)
+            walk(statement);
+    }
+    void visit(const ExpressionStatement *p) { walk(p->expression); }
+    void visit(const VariableDeclarationStatement *p)
+    {
+        if (p->initializer)
+            walk(p->initializer);
+    }
+    void visit(const IfStatement *p)
+    {
+        walk(p->condition);
+        walk(p->thenBranch);
+        if (p->elseBranch)
+            walk(p->elseBranch);
+    }
+    void visit(const WhileStatement *p)
+    {
+        walk(p->condition);
+        walk(p->body);
+    }
+    void visit(const ForStatement *p)
+    {
+        if (p->initializer)
+            walk(p->initializer);
+        if (p->condition)
+            walk(p->condition);
+        if (p->increment)
+            walk(p->increment);
+        walk(p->body);
+    }
+    void visit(const ReturnStatement *p)
+    {
+        if (p->returnValue)
+            walk(p->returnValue);
+    }
+};
+
+static Census countPointerTree(const Program &program)
+{
+    PointerCensus walker;
+    walker.census.nodes = 1;
+    for (const VariableDeclarationStatement *global : program.globals)
+        walker.walk(global);
+    for (const FunctionDeclaration *function : program.functions)
+    {
+        walker.census.nodes += 1 + function->params.size();
+        walker.walk(function->body);
+    }
+    return walker.census;
+}
+
+// The same walk through the cursor API, child by child.
+static void countFlatTree(FlatNode node, Census &census)
+{
+    census.nodes++;
+    if (node.kind() == NodeKind::Identifier)
+    {
+        census.identifiers++;
+        census.names += node.symbol();
+    }
+    for (FlatNode child : node.children())
+        countFlatTree(child, census);
+}
+
+// A pass that needs no tree shape is a scan of the preorder arrays.
+static Census scanFlatTree(const FlatTree &tree)
+{
+    Census census;
+    census.nodes = tree.size();
+    for (NodeIndex i = 0; i < tree.size(); i++)
+    {
+        if (tree.kind(i) == NodeKind::Identifier)
+        {
+            census.identifiers++;
+            census.names += tree.node(i).symbol();
+        }
+    }
+    return census;
+}
+
+template <typename Print>
+static string captureOutput(Print &&print)
+{
+    ostringstream captured;
+    streambuf *saved = cout.rdbuf(captured.rdbuf());
+    print();
+    cout.rdbuf(saved);
+    return captured.str();
+}
+
+// The tree as main.cpp dumps it with --dump-ast.
+static string dumpTree(const Program *program, const SourceManager &sources, DumpFormat format = DumpFormat::Text)
+{
+    ostringstream dumped;
+    {
+        OutputBuffer out(dumped);
+        AstDumper(sources, out, format).dump(program);
+    }
+    return dumped.str();
+}
+
+// Writes the dump of `program` to /dev/null through an OutputBuffer.
+static void dumpToNull(const Program *program, const SourceManager &sources, DumpFormat format)
+{
+    int fd = open("/dev/null", O_WRONLY);
+    {
+        OutputBuffer out(fd);
+        AstDumper(sources, out, format).dump(program);
+    }
+    close(fd);
+}
+
+// Random integer expression over a, b and x: arithmetic, bitwise and shift
+// operators, unary minus and complement, calls of g and parentheses, so the
+// whole corpus type checks.
+static void write_int_expression(string &out, uint64_t &seed, int depth)
+{
+    static const char *const binary[] = {"+", "-", "*", "/", "%", "&", "|", "^", "<<", ">>"};
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    unsigned pick = seed >> 33;
+    if (depth == 0 || pick % 8 == 0)
+    {
+        static const char *const leaves[] = {"a", "b", "x", "1", "42"};
+        out += leaves[pick / 8 % 5];
+        return;
+    }
+    switch (pick % 8)
+    {
+    case 1:
+        out += '(';
+        write_int_expression(out, seed, depth - 1);
+        out += ')';
+        return;
+    case 2:
+        out += pick / 8 % 2 ? "-(" : "~(";
+        write_int_expression(out, seed, depth - 1);
+        out += ')';
+        return;
+    case 3:
+        out += "g(";
+        write_int_expression(out, seed, depth - 1);
+        out += ", ";
+        write_int_expression(out, seed, depth - 1);
+        out += ')';
+        return;
+    default:
+        write_int_expression(out, seed, depth - 1);
+        out += ' ';
+        out += binary[pick / 8 % 10];
+        out += ' ';
+        write_int_expression(out, seed, depth - 1);
+    }
+}
+
+// Functions of declarations, assignments, loops and conditions over
+// write_int_expression(), free of scope and type errors.
+static string build_typed_corpus(size_t bytes)
+{
+    string corpus = "int g(int a, int b) {\n    return a + b;\n}\n";
+    uint64_t seed = 1;
+    for (size_t function = 0; corpus.size() < bytes; function++)
+    {
+        corpus += "int f" + to_string(function) + "(int a, int b) {\n    int x = 0;\n    x = ";
+        write_int_expression(corpus, seed, 5);
+        corpus += ";\n    while (x < a && !(x == b)) {\n        x += ";
+        write_int_expression(corpus, seed, 4);
+        corpus += ";\n    }\n    for (int i = 0; i < a; i += 1) {\n        int y = ";
+        write_int_expression(corpus, seed, 4);
+        corpus += ";\n        if (y > x || y <= b)\n            x = y;\n        else\n            x ^= ";
+        write_int_expression(corpus, seed, 3);
+        corpus += ";\n    }\n    return x;\n}\n";
+    }
+    return corpus;
+}
+
+// Time per node of the passes over the pointer tree: a bare walk with the
+// AstVisitor dispatch, scope analysis and type checking.
+static int bench_visit(const string &corpus)
+{
+    SourceManager sources;
+    const SourceFile &file = sources.file(sources.add_buffer("<typed>", corpus));
+    Arena arena;
+    RawLexer lexer(file);
+    Parser parser(lexer, arena);
+    Program *program = parser.parse_program();
+    if (!parser.diagnostics().empty())
+    {
+        cerr << "visit: " << parser.diagnostics().front().message << endl;
+        return 1;
+    }
+    Census census;
+    double walk = best_seconds(5, [&] { census = countPointerTree(*program); });
+    double scope = best_seconds(5, [&] {
+        ScopeAnalyzer scopes(sources);
+        scopes.analyze(program);
+        delete scopes.global_scope;
+    });
+    ScopeAnalyzer scopes(sources);
+    scopes.analyze(program);
+    double types = best_seconds(5, [&] {
+        TypeChecker checker(scopes.global_scope, sources);
+        checker.check(program);
+    });
+    delete scopes.global_scope;
+
+    size_t nodes = census.nodes;
+    printf("visit: %zu nodes, %zu identifiers, no scope or type errors\n", nodes, census.identifiers);
+    printf("visit/walk   %7.2f ns/node\n", walk / nodes * 1e9);
+    printf("visit/scope  %7.2f ns/node\n", scope / nodes * 1e9);
+    printf("visit/types  %7.2f ns/node\n", types / nodes * 1e9);
+    return 0;
+}
+
+// Memory and traversal time of the pointer AST against the flat encoding of
+// the same tree, after checking that both print the same.
+static int bench_ast(const string &corpus)
+{
+    SourceManager sources;
+    const SourceFile &file = sources.file(sources.add_buffer("<statements>", corpus));
+    Arena arena;
+    RawLexer lexer(file);
+    Parser parser(lexer, arena);
+    Program *program = parser.parse_program();
+    FlatTree *flat = nullptr;
+    double build = best_seconds(3, [&] {
+        delete flat;
+        flat = new FlatTree(*program);
+    });
+    unique_ptr<FlatTree> owned(flat);
+
+    if (dumpTree(program, sources) != captureOutput([&] { flat->print(sources); }))
+    {
+        cerr << "ast: the flat tree prints differently" << endl;
+        return 1;
+    }
+    Census pointerCensus, cursorCensus, scanCensus;
+    double pointer = best_seconds(5, [&] { pointerCensus = countPointerTree(*program); });
+    double cursor = best_seconds(5, [&] {
+        cursorCensus = Census();
+        countFlatTree(flat->root(), cursorCensus);
+    });
+    double scan = best_seconds(5, [&] { scanCensus = scanFlatTree(*flat); });
+    if (!(pointerCensus == cursorCensus) || !(pointerCensus == scanCensus))
+    {
+        cerr << "ast: walks disagree: " << pointerCensus.nodes << ", " << cursorCensus.nodes << ", " << scanCensus.nodes << " nodes" << endl;
+        return 1;
+    }
+    size_t nodes = flat->size();
+    printf("ast: %zu nodes, %zu identifiers, print output identical\n", nodes, scanCensus.identifiers);
+    printf("ast/pointer  %10zu bytes  %5.1f bytes/node  walk %6.2f ns/node\n", arena.bytes_reserved(),
+           (double)arena.bytes_reserved() / nodes, pointer / nodes * 1e9);
+    printf("ast/flat     %10zu bytes  %5.1f bytes/node  walk %6.2f ns/node  scan %6.2f ns/node  build %6.2f ns/node\n",
+           flat->bytes(), (double)flat->bytes() / nodes, cursor / nodes * 1e9, scan / nodes * 1e9, build / nodes * 1e9);
+    return 0;
+}
+
+// Parse throughput on expression-heavy input, next to lexing the same input
+// alone, so the difference is the time spent building expression trees. The
+// parse time includes freeing the tree.
+static int bench_expr(const string &corpus)
+{
+    SourceManager sources;
+    const SourceFile &file = sources.file(sources.add_buffer("<expressions>", corpus));
+    size_t count = 0;
+    double lex = best_seconds(5, [&] {
+        RawLexer lexer(file);
+        count = 1;
+        while (lexer.next().type != T_EOF)
+            count++;
+    });
+    size_t read = 0;
+    double parse = best_seconds(5, [&] {
+        RawLexer lexer(file);
+        Arena arena;
+        Parser parser(lexer, arena);
+        parser.parse_program();
+        read = parser.tokens_read() + 1;
+    });
+    if (read != count)
+    {
+        cerr << "expr: parser read " << read << " of " << count << " tokens" << endl;
+        return 1;
+    }
+    printf("expr/lex   %8.1f MB/s  %10zu tokens  %6.1f ns/token\n", corpus.size() / lex / 1e6, count, lex / count * 1e9);
+    printf("expr/parse %8.1f MB/s  %10zu tokens  %6.1f ns/token\n", corpus.size() / parse / 1e6, count, parse / count * 1e9);
+    return 0;
+}
+
+static string repeat(const string &text, size_t count)
+{
+    string out;
+    out.reserve(text.size() * count);
+    for (size_t i = 0; i < count; i++)
+        out += text;
+    return out;
+}
+
+// `int x = a + a - a * a / ...` with `terms` operands: a left-leaning tree as
+// deep as the chain is long, though the source does not nest at all.
+static string build_chain(size_t terms)
+{
+    static const char *ops[] = {" + ", " - ", " * ", " / "};
+    string source = "int f(int a) {\n    int x = a";
+    for (size_t i = 1; i < terms; i++)
+    {
+        source += ops[i % 4];
+        source += 'a';
+    }
+    return source + ";\n    return x;\n}\n";
+}
+
+static string wrap_body(const string &body)
+{
+    return "int f(int a) {\n" + body + "\n    return a;\n}\n";
+}
+
+// Parses `source` and runs every pass over the tree, timing each, and checks
+// the number of syntax errors.
+static bool run_deep(const string &name, const string &source, size_t expectedErrors)
+{
+    SourceManager sources;
+    const SourceFile &file = sources.file(sources.add_buffer("<" + name + ">", source));
+    Arena arena;
+    RawLexer lexer(file);
+    Parser parser(lexer, arena);
+    Program *program = nullptr;
+    double parse = best_seconds(1, [&] { program = parser.parse_program(); });
+    ScopeAnalyzer scopes(sources);
+    double scope = best_seconds(1, [&] { scopes.analyze(program); });
+    TypeChecker types(scopes.global_scope, sources);
+    double check = best_seconds(1, [&] { types.check(program); });
+    unique_ptr<FlatTree> flat;
+    double flatten = best_seconds(1, [&] { flat.reset(new FlatTree(*program)); });
+    double dump = best_seconds(1, [&] { dumpToNull(program, sources, DumpFormat::Json); });
+    delete scopes.global_scope;
+
+    size_t errors = parser.diagnostics().size();
+    printf("deep/%-7s %9zu tokens %9zu nodes  %zu syntax error(s)  parse %7.2f ms  scope %7.2f ms  types %7.2f ms  flat %7.2f ms  json %7.2f ms\n",
+           name.c_str(), parser.tokens_read() + 1, flat->size(), errors, parse * 1e3, scope * 1e3, check * 1e3, flatten * 1e3, dump * 1e3);
+    if (errors)
+        printf("             %s\n", parser.diagnostics().front().message.c_str());
+    if (errors != expectedErrors)
+    {
+        cerr << "deep: " << name << " expected " << expectedErrors << " syntax error(s)" << endl;
+        return false;
+    }
+    return true;
+}
+
+// Machine-generated shapes far deeper than the nesting limit or than a call
+// stack would take: a long operator chain goes through every pass, and nesting
+// past ParserOptions::max_nesting is one syntax error, not a crash.
+static int bench_deep(size_t bytes)
+{
+    size_t limit = ParserOptions().max_nesting;
+    size_t deep = 100000;
+    bool ok = run_deep("chain", build_chain(bytes / 4), 0);
+    // An if and its block are two levels each, and the function body is one.
+    ok &= run_deep("if", wrap_body(repeat("if (a < 1) {\n", limit / 2 - 1) + "a = 1;\n" + repeat("}\n", limit / 2 - 1)), 0);
+    ok &= run_deep("if-deep", wrap_body(repeat("if (a < 1) {\n", deep) + "a = 1;\n" + repeat("}\n", deep)), 1);
+    ok &= run_deep("else-if", wrap_body(repeat("if (a < 1) a = 1; else ", deep) + "a = 2;"), 0);
+    ok &= run_deep("parens", wrap_body("a = " + repeat("(", deep) + "a" + repeat(")", deep) + ";"), 1);
+    ok &= run_deep("unary", wrap_body("a = " + repeat("- ", deep) + "a;"), 1);
+    ok &= run_deep("assign", wrap_body(repeat("a = ", deep) + "a;"), 1);
+    ok &= run_deep("calls", "int g(int a) { return a; }\n" + wrap_body("a = " + repeat("g(", deep) + "a" + repeat(")", deep) + ";"), 1);
+
+    // Printing is quadratic in the depth, so it is only compared on a short chain.
+    SourceManager sources;
+    const SourceFile &file = sources.file(sources.add_buffer("<chain>", build_chain(2000)));
+    Arena arena;
+    RawLexer lexer(file);
+    Parser parser(lexer, arena);
+    Program *program = parser.parse_program();
+    FlatTree flat(*program);
+    if (dumpTree(program, sources) != captureOutput([&] { flat.print(sources); }))
+    {
+        cerr << "deep: the flat tree prints differently" << endl;
+        ok = false;
+    }
+    return ok ? 0 : 1;
+}
+
+static TokenStream lexAll(const SourceFile &file)
+{
+    TokenStream tokens(file);
+    RawLexer lexer(file);
+    Token token;
+    do
+    {
+        token = lexer.next();
+        tokens.push(token);
+    } while (token.type != T_EOF);
+    return tokens;
+}
+
+// Sequential parsing against ParallelParser on 1, 2, 4... threads, from the
+// same tokens so only parsing is timed. Every run must print the same tree,
+// and a syntax error must give the sequential parser's diagnostics.
+// Parses a file that includes headers and uses # and ## through a
+// Preprocessor, sequentially and on `threads` workers. The workers look up
+// the files of tokens while the preprocessor goes on loading headers and
+// making buffers for the pasted and stringized text.
+static bool parsePreprocessed(size_t threads)
+{
+    filesystem::path dir = filesystem::temp_directory_path() / "bench_parse_includes";
+    filesystem::create_directories(dir);
+    string text = "#include \"common.h\"\n#define S(x) #x\n#define C(a, b) a##b\n";
+    for (int i = 0; i < 3000; i++)
+    {
+        string n = to_string(i);
+        text += "int C(f, " + n + ")(int a) { string s = S(v" + n + "); int C(x, " + n + ") = a + " + n + "; return C(x, " + n + "); }\n";
+        if (i % 100 == 0)
+        {
+            ofstream(dir / ("h" + n + ".h")) << "int g" << n << " = " << n << ";\n";
+            text += "#include \"h" + n + ".h\"\n";
+        }
+    }
+    ofstream(dir / "common.h") << "#pragma once\nint common = 1;\n";
+    ofstream(dir / "main.c") << text;
+
+    SourceManager sources;
+    HeaderCache headers(sources);
+    PreprocessorOptions options;
+    options.backend = &raw_backend;
+    const SourceFile &file = sources.file(sources.load((dir / "main.c").string()));
+    Arena sequentialArena, parallelArena;
+    Preprocessor sequentialInput(headers, file, unique_ptr<TokenSource>(new RawLexer(file)), options);
+    Parser parser(sequentialInput, sequentialArena);
+    string expected = dumpTree(parser.parse_program(), sources);
+    Preprocessor parallelInput(headers, file, unique_ptr<TokenSource>(new RawLexer(file)), options);
+    ThreadPool pool(threads);
+    ParallelParser parallel(parallelInput, parallelArena, pool);
+    string printed = dumpTree(parallel.parse_program(), sources);
+    filesystem::remove_all(dir);
+    if (!parser.diagnostics().empty() || !parallel.diagnostics().empty() || printed != expected)
+    {
+        cerr << "parse: a preprocessed file parses differently in parallel" << endl;
+        return false;
+    }
+    printf("parse: preprocessed file with includes, # and ## identical in parallel\n");
+    return true;
+}
+
+// The tokens `source` preprocesses to, separated by spaces.
+static string preprocessed(const string &source)
+{
+    SourceManager sources;
+    HeaderCache headers(sources);
+    PreprocessorOptions options;
+    options.backend = &raw_backend;
+    const SourceFile &file = sources.file(sources.add_buffer("<macros>", source));
+    Preprocessor input(headers, file, unique_ptr<TokenSource>(new RawLexer(file)), options);
+    string text;
+    for (Token token = input.next(); token.type != T_EOF; token = input.next())
+    {
+        if (!text.empty())
+            text += ' ';
+        text += token.lexeme;
+    }
+    return text;
+}
+
+// A macro name met while its own expansion is rescanned must stay
+// unexpanded, also after it is substituted for another macro's argument.
+static bool expandsOnce()
+{
+    string macros = "#define gval (gval + 0)\n#define ID(x) x\n#define V(...) __VA_ARGS__\n#define TWICE(x) x x\n";
+    const pair<const char *, const char *> cases[] = {
+        {"gval", "( gval + 0 )"},
+        {"ID(gval)", "( gval + 0 )"},
+        {"ID(ID(gval))", "( gval + 0 )"},
+        {"V(gval, ID(gval))", "( gval + 0 ) , ( gval + 0 )"},
+        {"TWICE(ID(1))", "1 1"},
+    };
+    for (const auto &check : cases)
+    {
+        string printed = preprocessed(macros + check.first + "\n");
+        if (printed != check.second)
+        {
+            cerr << "parse: " << check.first << " expands to " << printed << ", not " << check.second << endl;
+            return false;
+        }
+    }
+    printf("parse: self-referencing macros expand once through arguments\n");
+    return true;
+}
+
+static int bench_parse(const string &corpus)
+{
+    SourceManager sources;
+    const SourceFile &file = sources.file(sources.add_buffer("<statements>", corpus));
+    TokenStream tokens = lexAll(file);
+    string expected;
+    double sequential = best_seconds(3, [&] {
+        TokenStreamSource input(tokens);
+        Arena arena;
+        Parser parser(input, arena);
+        Program *program = parser.parse_program();
+        if (expected.empty())
+            expected = dumpTree(program, sources);
+    });
+    printf("parse/sequential %8.1f MB/s  %10zu tokens\n", corpus.size() / sequential / 1e6, tokens.size());
+
+    size_t most = max<size_t>(4, thread::hardware_concurrency());
+    for (size_t threads = 1; threads <= most; threads *= 2)
+    {
+        ThreadPool pool(threads);
+        string printed;
+        double parallel = best_seconds(3, [&] {
+            TokenStreamSource input(tokens);
+            Arena arena;
+            ParallelParser parser(input, arena, pool);
+            Program *program = parser.parse_program();
+            if (printed.empty())
+                printed = dumpTree(program, sources);
+        });
+        if (printed != expected)
+        {
+            cerr << "parse: " << threads << " thread(s) give a different tree" << endl;
+            return 1;
+        }
+        printf("parse/%-2zu threads %8.1f MB/s  %5.2fx sequential\n", threads, corpus.size() / parallel / 1e6,
+               sequential / parallel);
+    }
+
+    // A stray token in the middle of the file sends it back to the sequential parser.
+    string broken = corpus;
+    broken.insert(broken.find("int f", broken.size() / 2), "int ;\n");
+    const SourceFile &brokenFile = sources.file(sources.add_buffer("<broken>", broken));
+    TokenStream brokenTokens = lexAll(brokenFile);
+    TokenStreamSource sequentialInput(brokenTokens), parallelInput(brokenTokens);
+    Arena sequentialArena, parallelArena;
+    Parser parser(sequentialInput, sequentialArena);
+    ThreadPool pool(most);
+    ParallelParser parallel(parallelInput, parallelArena, pool);
+    string sequentialTree = dumpTree(parser.parse_program(), sources);
+    string parallelTree = dumpTree(parallel.parse_program(), sources);
+    bool same = sequentialTree == parallelTree && parser.diagnostics().size() == parallel.diagnostics().size();
+    for (size_t i = 0; same && i < parser.diagnostics().size(); i++)
+        same = parser.diagnostics()[i].message == parallel.diagnostics()[i].message;
+    if (!same || parser.diagnostics().empty())
+    {
+        cerr << "parse: a syntax error is reported differently in parallel" << endl;
+        return 1;
+    }
+    printf("parse: trees identical, %zu syntax error(s) reported as sequentially\n", parser.diagnostics().size());
+    return parsePreprocessed(most) && expandsOnce() ? 0 : 1;
+}
+
+// Parses `file` with every body and again with lazy_bodies, then parses the
+// kept bodies with a BodyParser. Both trees must print the same and report
+// the same syntax errors.
+static bool sameAsEager(const SourceManager &sources, const SourceFile &file)
+{
+    Arena eagerArena, lazyArena;
+    RawLexer eagerLexer(file), lazyLexer(file);
+    Parser eager(eagerLexer, eagerArena);
+    ParserOptions options;
+    options.lazy_bodies = true;
+    Parser lazy(lazyLexer, lazyArena, options);
+    Program *eagerProgram = eager.parse_program();
+    Program *lazyProgram = lazy.parse_program();
+    BodyParser bodies(lazyLexer, lazyArena);
+    bodies.parse_all(lazyProgram);
+    vector<ParseDiagnostic> errors = lazy.diagnostics();
+    errors.insert(errors.end(), bodies.diagnostics().begin(), bodies.diagnostics().end());
+    if (errors.size() != eager.diagnostics().size())
+        return false;
+    for (size_t i = 0; i < errors.size(); i++)
+        if (errors[i].message != eager.diagnostics()[i].message)
+            return false;
+    return dumpTree(eagerProgram, sources) == dumpTree(lazyProgram, sources);
+}
+
+// Lexing alone, a full parse, and a parse that keeps function bodies as
+// tokens followed by the signature pass of scope analysis, which is what a
+// symbol index needs. Then checks that parsing the kept bodies on demand
+// gives the full parse's tree and errors.
+static int bench_lazy(const string &corpus)
+{
+    SourceManager sources;
+    const SourceFile &file = sources.file(sources.add_buffer("<statements>", corpus));
+    size_t count = 0;
+    double lex = best_seconds(3, [&] {
+        RawLexer lexer(file);
+        count = 1;
+        while (lexer.next().type != T_EOF)
+            count++;
+    });
+    double eager = best_seconds(3, [&] {
+        RawLexer lexer(file);
+        Arena arena;
+        Parser parser(lexer, arena);
+        parser.parse_program();
+    });
+    size_t functions = 0;
+    double signatures = best_seconds(3, [&] {
+        RawLexer lexer(file);
+        Arena arena;
+        ParserOptions options;
+        options.lazy_bodies = true;
+        Parser parser(lexer, arena, options);
+        Program *program = parser.parse_program();
+        ScopeAnalyzer scopes(sources);
+        scopes.analyze(program);
+        delete scopes.global_scope;
+        functions = program->functions.size();
+    });
+    printf("lazy/lex         %8.1f MB/s  %10zu tokens\n", corpus.size() / lex / 1e6, count);
+    printf("lazy/parse       %8.1f MB/s  %5.2fx lexing time\n", corpus.size() / eager / 1e6, eager / lex);
+    printf("lazy/signatures  %8.1f MB/s  %5.2fx lexing time  %zu functions\n", corpus.size() / signatures / 1e6,
+           signatures / lex, functions);
+
+    string broken = corpus;
+    broken.erase(broken.find("    return x;", broken.size() / 2) + 12, 1);
+    const SourceFile &brokenFile = sources.file(sources.add_buffer("<broken>", broken));
+    if (!sameAsEager(sources, file) || !sameAsEager(sources, brokenFile))
+    {
+        cerr << "lazy: bodies parsed on demand differ from the full parse" << endl;
+        return 1;
+    }
+    printf("lazy: bodies parsed on demand give the same tree and errors\n");
+    return 0;
+}
+
+// Writes a parsed tree to an AST cache file and loads it back, timing both
+// against lexing and parsing, and checks that the loaded tree prints the
+// same. Then checks that a changed source or a damaged file is a miss.
+static int bench_cache(const string &corpus)
+{
+    SourceManager sources;
+    const SourceFile &file = sources.file(sources.add_buffer("<statements>", corpus));
+    Arena arena;
+    Program *program = nullptr;
+    double parse = best_seconds(3, [&] {
+        RawLexer lexer(file);
+        Arena scratch;
+        Parser parser(lexer, scratch);
+        parser.parse_program();
+    });
+    RawLexer lexer(file);
+    Parser parser(lexer, arena);
+    program = parser.parse_program();
+
+    string path = (filesystem::temp_directory_path() / "bench_ast_cache.ast").string();
+    uint64_t key = content_checksum(corpus);
+    bool written = false;
+    double write = best_seconds(3, [&] { written = write_ast_cache(path, key, *program, sources, {file.id()}); });
+    if (!written)
+    {
+        cerr << "cache: could not write " << path << endl;
+        return 1;
+    }
+    size_t bytes = 0;
+    Program *loaded = nullptr;
+    unique_ptr<AstCache> cache;
+    unique_ptr<Arena> loadedArena;
+    double load = best_seconds(3, [&] {
+        loadedArena.reset(new Arena);
+        cache = AstCache::open(path, key);
+        loaded = cache ? cache->load(*loadedArena, sources, file) : nullptr;
+    });
+    if (!loaded)
+    {
+        cerr << "cache: could not load " << path << endl;
+        return 1;
+    }
+    bytes = cache->bytes_mapped();
+    string expected = dumpTree(program, sources);
+    if (dumpTree(loaded, sources) != expected ||
+        captureOutput([&] { FlatTree(*loaded).print(sources); }) != expected)
+    {
+        cerr << "cache: the loaded tree prints differently" << endl;
+        return 1;
+    }
+    printf("cache/parse  %8.2f ms  lexing and parsing\n", parse * 1e3);
+    printf("cache/write  %8.2f ms  %10zu bytes  %5.1f bytes/node\n", write * 1e3, bytes, (double)bytes / FlatTree(*program).size());
+    printf("cache/load   %8.2f ms  %5.2fx faster than parsing\n", load * 1e3, parse / load);
+
+    string changed = corpus;
+    changed[changed.size() / 2] = changed[changed.size() / 2] == ' ' ? '\t' : ' ';
+    const SourceFile &changedFile = sources.file(sources.add_buffer("<statements>", changed));
+    Arena missArena;
+    cache = AstCache::open(path, key);
+    bool staleHit = cache && cache->load(missArena, sources, changedFile);
+    {
+        fstream damage(path, ios::in | ios::out | ios::binary);
+        damage.seekp(bytes / 2);
+        damage.put('\x7f');
+    }
+    bool damagedHit = AstCache::open(path, key) != nullptr;
+    remove(path.c_str());
+    if (staleHit || damagedHit)
+    {
+        cerr << "cache: a " << (staleHit ? "changed source" : "damaged file") << " was loaded" << endl;
+        return 1;
+    }
+    printf("cache: round trip identical; changed source and damaged file are misses\n");
+    return 0;
+}
+
+// Time to dump a tree in each format to /dev/null, next to printing it with
+// cout and endl a line at a time as the tree used to be printed (FlatTree
+// still prints that way). Checks that the text dump is the printed tree.
+static int bench_dump(const string &corpus)
+{
+    SourceManager sources;
+    const SourceFile &file = sources.file(sources.add_buffer("<statements>", corpus));
+    Arena arena;
+    RawLexer lexer(file);
+    Parser parser(lexer, arena);
+    Program *program = parser.parse_program();
+    FlatTree flat(*program);
+    string text = dumpTree(program, sources);
+    if (text != captureOutput([&] { flat.print(sources); }))
+    {
+        cerr << "dump: the text dump differs from the printed tree" << endl;
+        return 1;
+    }
+
+    ofstream null("/dev/null");
+    streambuf *saved = cout.rdbuf(null.rdbuf());
+    double printed = best_seconds(3, [&] { flat.print(sources); });
+    cout.rdbuf(saved);
+    size_t nodes = flat.size();
+    printf("dump: %zu nodes, text dump identical to the printed tree\n", nodes);
+    printf("dump/endl   %8.1f MB/s  %6.1f ns/node\n", text.size() / printed / 1e6, printed / nodes * 1e9);
+    static const pair<const char *, DumpFormat> formats[] = {
+        {"text", DumpFormat::Text}, {"json", DumpFormat::Json}, {"sexpr", DumpFormat::SExpression}};
+    for (const auto &format : formats)
+    {
+        size_t size = dumpTree(program, sources, format.second).size();
+        double seconds = best_seconds(3, [&] { dumpToNull(program, sources, format.second); });
+        printf("dump/%-6s %8.1f MB/s  %6.1f ns/node  %10zu bytes\n", format.first, size / seconds / 1e6, seconds / nodes * 1e9, size);
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        cerr << "Usage: " << argv[0] << " scan|expr|ast|visit|deep|parse|lazy|cache|dump [--mb N] [files...]" << endl;
+        return 1;
+    }
+    string mode = argv[1];
+    size_t megabytes = 16;
+    vector<string> paths;
+    for (int i = 2; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "--mb" && i + 1 < argc)
+            megabytes = stoul(argv[++i]);
+        else
+            paths.push_back(arg);
+    }
+    if (paths.empty())
+        paths = default_inputs();
+
+    try
+    {
+        if (mode == "expr")
+        {
+            string corpus = build_expression_corpus(megabytes << 20);
+            cout << "corpus: " << corpus.size() << " bytes of generated expressions\n";
+            return bench_expr(corpus);
+        }
+        if (mode == "ast")
+        {
+            string corpus = build_statement_corpus(megabytes << 20);
+            cout << "corpus: " << corpus.size() << " bytes of generated statements\n";
+            return bench_ast(corpus);
+        }
+        if (mode == "deep")
+            return bench_deep(megabytes << 20);
+        if (mode == "parse")
+        {
+            string corpus = build_statement_corpus(megabytes << 20);
+            cout << "corpus: " << corpus.size() << " bytes of generated statements\n";
+            return bench_parse(corpus);
+        }
+        if (mode == "visit")
+        {
+            string corpus = build_typed_corpus(megabytes << 20);
+            cout << "corpus: " << corpus.size() << " bytes of generated well-typed functions\n";
+            return bench_visit(corpus);
+        }
+        if (mode == "lazy")
+        {
+            string corpus = build_statement_corpus(megabytes << 20);
+            cout << "corpus: " << corpus.size() << " bytes of generated statements\n";
+            return bench_lazy(corpus);
+        }
+        if (mode == "cache")
+        {
+            string corpus = build_statement_corpus(megabytes << 20);
+            cout << "corpus: " << corpus.size() << " bytes of generated statements\n";
+            return bench_cache(corpus);
+        }
+        if (mode == "dump")
+        {
+            string corpus = build_statement_corpus(megabytes << 20);
+            cout << "corpus: " << corpus.size() << " bytes of generated statements\n";
+            return bench_dump(corpus);
+        }
+        string corpus = build_corpus(paths, megabytes << 20);
+        cout << "corpus: " << corpus.size() << " bytes from " << paths.size() << " file(s)\n";
+        if (mode == "scan")
+            return bench_scan(corpus);
+        cerr << "Unknown mode: " << mode << endl;
+    }
+    catch (const exception &e)
+    {
+        cerr << "Error: " << e.what() << endl;
+    }
+    return 1;
+}
@@ -0,0 +1,428 @@
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "ast.h"
+
+using namespace std;
+
+typedef uint32_t NodeIndex;
+
+// Which optional parts a For node has, as the bits of its data word.
+enum ForParts : uint32_t { ForInitializer = 1, ForCondition = 2, ForIncrement = 4 };
+
+// Type and name of a Function, Parameter or VariableDeclaration.
+struct FlatDeclaration {
+    Type type;
+    SymbolID name;
+};
+
+class FlatTree;
+
+// Position in a FlatTree. A node's children follow it directly in preorder,
+// and each child's subtree ends where its next sibling starts.
+class FlatNode {
+public:
+    FlatNode(const FlatTree& tree, NodeIndex index) : tree(&tree), at(index) {}
+
+    NodeIndex index() const { return at; }
+    inline NodeKind kind() const;
+    inline SourceLocation loc() const;
+    // One past the last node of this subtree.
+    inline NodeIndex end() const;
+    bool has_children() const { return end() > at + 1; }
+    FlatNode first_child() const { return FlatNode(*tree, at + 1); }
+    FlatNode next_sibling() const { return FlatNode(*tree, end()); }
+    inline FlatNode child(size_t k) const;
+
+    // Identifier and FunctionCall: the name.
+    inline SymbolID symbol() const;
+    // NumberLiteral and StringLiteral: their text.
+    inline string_view text() const;
+    // BinaryOperation, UnaryOp and Assignment: the operator.
+    Operator op() const { return Operator(data()); }
+    // Function, Parameter and VariableDeclaration.
+    inline const FlatDeclaration& declaration() const;
+    // BoolLiteral: the value; If: whether there is an else branch; For: its
+    // ForParts; Program: the number of globals before the functions.
+    inline uint32_t data() const;
+
+    class Iterator {
+    public:
+        Iterator(const FlatTree& tree, NodeIndex index) : tree(&tree), at(index) {}
+        FlatNode operator*() const { return FlatNode(*tree, at); }
+        inline Iterator& operator++();
+        bool operator!=(const Iterator& other) const { return at != other.at; }
+
+    private:
+        const FlatTree* tree;
+        NodeIndex at;
+    };
+
+    struct Children {
+        Iterator first, last;
+        Iterator begin() const { return first; }
+        Iterator end() const { return last; }
+    };
+    Children children() const { return Children{Iterator(*tree, at + 1), Iterator(*tree, end())}; }
+
+    bool operator==(const FlatNode& other) const { return at == other.at; }
+
+private:
+    const FlatTree* tree;
+    NodeIndex at;
+};
+
+// The AST of a Program encoded in preorder in parallel arrays, indexed by
+// NodeIndex, with names and literal text in side tables. A pass that does not
+// need the tree's shape can scan `kinds` front to back.
+class FlatTree : AstVisitor<FlatTree> {
+public:
+    explicit FlatTree(const Program& program) {
+        add(NodeKind::Program, 0, (uint32_t)program.globals.size());
+        for (const VariableDeclarationStatement* global : program.globals) flatten(global);
+        for (const FunctionDeclaration* function : program.functions) flatten(function);
+        close(0);
+        flattening = vector<FlattenStep>();
+        kinds.shrink_to_fit();
+        ends.shrink_to_fit();
+        locs.shrink_to_fit();
+        data.shrink_to_fit();
+        texts.shrink_to_fit();
+        declarations.shrink_to_fit();
+        text_ids = unordered_map<string_view, uint32_t>();
+    }
+
+    size_t size() const { return kinds.size(); }
+    FlatNode root() const { return FlatNode(*this, 0); }
+    FlatNode node(NodeIndex index) const { return FlatNode(*this, index); }
+    NodeKind kind(NodeIndex index) const { return kinds[index]; }
+
+    // Bytes held by the arrays and side tables.
+    size_t bytes() const {
+        return kinds.size() * sizeof(NodeKind) + ends.size() * sizeof(NodeIndex) + locs.size() * sizeof(SourceLocation) +
+               data.size() * sizeof(uint32_t) + texts.size() * sizeof(string_view) + declarations.size() * sizeof(FlatDeclaration);
+    }
+
+    // Same output as Program::print(), also without recursing.
+    void print(const SourceManager& sources) const {
+        vector<DumpStep> pending(1, DumpStep{NULL, 0, 0});
+        vector<DumpStep> next;
+        while (!pending.empty()) {
+            DumpStep step = pending.back();
+            pending.pop_back();
+            if (step.label) {
+                cout << string(step.indent, ' ') << step.label << endl;
+                continue;
+            }
+            print_line(sources, node(step.node), step.indent, next);
+            pending.insert(pending.end(), next.rbegin(), next.rend());
+            next.clear();
+        }
+    }
+
+private:
+    friend class FlatNode;
+    friend class AstVisitor<FlatTree>;
+
+    vector<NodeKind> kinds;
+    vector<NodeIndex> ends;
+    vector<SourceLocation> locs;
+    vector<uint32_t> data;
+    vector<string_view> texts;
+    vector<FlatDeclaration> declarations;
+
+    NodeIndex add(NodeKind kind, SourceLocation loc, uint32_t word) {
+        kinds.push_back(kind);
+        ends.push_back(0);
+        locs.push_back(loc);
+        data.push_back(word);
+        return (NodeIndex)(kinds.size() - 1);
+    }
+    void close(NodeIndex index) { ends[index] = (NodeIndex)kinds.size(); }
+
+    // Literals repeat, so each distinct spelling is stored once.
+    unordered_map<string_view, uint32_t> text_ids;
+
+    uint32_t text(string_view value) {
+        auto it = text_ids.emplace(value, (uint32_t)texts.size());
+        if (it.second) texts.push_back(value);
+        return it.first->second;
+    }
+    uint32_t declaration(Type type, SymbolID name) {
+        declarations.push_back(FlatDeclaration{type, name});
+        return (uint32_t)(declarations.size() - 1);
+    }
+
+    void leaf(NodeKind kind, SourceLocation loc, uint32_t word) { close(add(kind, loc, word)); }
+
+    void flatten(const FunctionDeclaration* node) {
+        NodeIndex index = add(NodeKind::Function, node->loc, declaration(node->returnType, node->name));
+        for (const Parameter& param : node->params) leaf(NodeKind::Parameter, param.loc, declaration(param.type, param.name));
+        if (node->body) flatten(node->body);
+        close(index);
+    }
+
+    // Flattening runs off an explicit stack rather than recursing, so a deep
+    // tree cannot overflow the call stack. A step adds a node, or closes
+    // the one at `close` once its children are in.
+    struct FlattenStep {
+        const Statement* statement;
+        const Expression* expression;
+        NodeIndex close;
+    };
+
+    vector<FlattenStep> flattening;
+
+    void flatten(const Statement* root) {
+        flattening.assign(1, FlattenStep{root, NULL, 0});
+        while (!flattening.empty()) {
+            FlattenStep step = flattening.back();
+            flattening.pop_back();
+            if (step.statement) dispatch(step.statement);
+            else if (step.expression) dispatch(step.expression);
+            else close(step.close);
+        }
+    }
+
+    // Each visit() adds its node and pushes its closing step and then its
+    // children, last first.
+    void later(const Statement* child) { flattening.push_back(FlattenStep{child, NULL, 0}); }
+    void later(const Expression* child) { flattening.push_back(FlattenStep{NULL, child, 0}); }
+    void open(NodeKind kind, SourceLocation loc, uint32_t word) { flattening.push_back(FlattenStep{NULL, NULL, add(kind, loc, word)}); }
+
+    void visit(const BlockStatement* p) {
+        open(NodeKind::Block, p->loc, 0);
+        for (size_t i = p->statements.size(); i-- > 0;) later(p->statements[i]);
+    }
+    void visit(const ExpressionStatement* p) {
+        open(NodeKind::ExpressionStatement, p->loc, 0);
+        later(p->expression);
+    }
+    void visit(const VariableDeclarationStatement* p) {
+        open(NodeKind::VariableDeclaration, p->loc, declaration(p->type, p->name));
+        if (p->initializer) later(p->initializer);
+    }
+    void visit(const IfStatement* p) {
+        open(NodeKind::If, p->loc, p->elseBranch != NULL);
+        if (p->elseBranch) later(p->elseBranch);
+        later(p->thenBranch);
+        later(p->condition);
+    }
+    void visit(const WhileStatement* p) {
+        open(NodeKind::While, p->loc, 0);
+        later(p->body);
+        later(p->condition);
+    }
+    void visit(const ForStatement* p) {
+        uint32_t parts = (p->initializer ? uint32_t(ForInitializer) : 0u) | (p->condition ? uint32_t(ForCondition) : 0u) | (p->increment ? uint32_t(ForIncrement) : 0u);
+        open(NodeKind::For, p->loc, parts);
+        later(p->body);
+        if (p->increment) later(p->increment);
+        if (p->condition) later(p->condition);
+        if (p->initializer) later(p->initializer);
+    }
+    void visit(const ReturnStatement* p) {
+        open(NodeKind::Return, p->loc, 0);
+        if (p->returnValue) later(p->returnValue);
+    }
+    void visit(const BreakStatement* p) { leaf(NodeKind::Break, p->loc, 0); }
+    void visit(const ContinueStatement* p) { leaf(NodeKind::Continue, p->loc, 0); }
+    void visit(const ErrorStatement* p) { leaf(NodeKind::ErrorStatement, p->loc, 0); }
+
+    void visit(const BinaryOperation* p) {
+        open(NodeKind::BinaryOperation, p->loc, (uint32_t)p->op);
+        later(p->right);
+        later(p->left);
+    }
+    void visit(const Assignment* p) {
+        open(NodeKind::Assignment, p->loc, (uint32_t)p->op);
+        later(p->value);
+        later(p->identifier);
+    }
+    void visit(const FunctionCall* p) {
+        open(NodeKind::FunctionCall, p->loc, p->callee);
+        for (size_t i = p->arguments.size(); i-- > 0;) later(p->arguments[i]);
+    }
+    void visit(const UnaryOp* p) {
+        open(NodeKind::UnaryOp, p->loc, (uint32_t)p->op);
+        later(p->right);
+    }
+    void visit(const Identifier* p) { leaf(NodeKind::Identifier, p->loc, p->name); }
+    void visit(const NumberLiteral* p) { leaf(NodeKind::NumberLiteral, p->loc, text(p->value)); }
+    void visit(const StringLiteral* p) { leaf(NodeKind::StringLiteral, p->loc, text(p->value)); }
+    void visit(const BoolLiteral* p) { leaf(NodeKind::BoolLiteral, p->loc, p->value); }
+    void visit(const ErrorExpression* p) { leaf(NodeKind::ErrorExpression, p->loc, 0); }
+
+    static void line(const SourceManager& sources, FlatNode node, int indent, const string& head) {
+        cout << string(indent, ' ') << head << " [line: " << sources.line_of(node.loc()) << "]" << endl;
+    }
+
+    // A line still to be printed: the label, or else the subtree at `node`.
+    struct DumpStep {
+        const char* label;
+        NodeIndex node;
+        int indent;
+    };
+
+    // Prints the line for `node` and appends what goes under it to `next`.
+    void print_line(const SourceManager& sources, FlatNode node, int indent, vector<DumpStep>& next) const {
+        auto label = [&](int at, const char* name) { next.push_back(DumpStep{name, 0, at}); };
+        auto later = [&](FlatNode child, int at) { next.push_back(DumpStep{NULL, child.index(), at}); };
+        switch (node.kind()) {
+        case NodeKind::Program: {
+            cout << string(indent, ' ') << "Program" << endl;
+            uint32_t globals = node.data();
+            uint32_t k = 0;
+            for (FlatNode child : node.children()) {
+                if (k == 0 && globals > 0) label(indent + 2, "Globals:");
+                if (k == globals) label(indent + 2, "Functions:");
+                later(child, indent + 4);
+                k++;
+            }
+            break;
+        }
+        case NodeKind::Function: {
+            const FlatDeclaration& d = node.declaration();
+            line(sources, node, indent, "FunctionDeclaration(" + string(symbol_name(d.name)) + ", returns: " + string(spelling(d.type)) + ")");
+            bool first = true;
+            for (FlatNode child : node.children()) {
+                if (child.kind() == NodeKind::Parameter) {
+                    if (first) label(indent + 2, "Parameters:");
+                    first = false;
+                    later(child, indent + 4);
+                } else {
+                    later(child, indent + 2);
+                }
+            }
+            break;
+        }
+        case NodeKind::Parameter: {
+            const FlatDeclaration& d = node.declaration();
+            line(sources, node, indent, "Param(" + string(symbol_name(d.name)) + ", type: " + string(spelling(d.type)) + ")");
+            break;
+        }
+        case NodeKind::Block:
+            cout << string(indent, ' ') << "Block [line: " << sources.line_of(node.loc()) << "] {" << endl;
+            for (FlatNode child : node.children()) later(child, indent + 2);
+            label(indent, "}");
+            break;
+        case NodeKind::ExpressionStatement:
+            line(sources, node, indent, "ExpressionStatement");
+            later(node.first_child(), indent + 2);
+            break;
+        case NodeKind::VariableDeclaration: {
+            const FlatDeclaration& d = node.declaration();
+            line(sources, node, indent, "VariableDeclaration(" + string(symbol_name(d.name)) + ", type: " + string(spelling(d.type)) + ")");
+            if (node.has_children()) {
+                label(indent + 2, "Initializer:");
+                later(node.first_child(), indent + 4);
+            }
+            break;
+        }
+        case NodeKind::If: {
+            line(sources, node, indent, "IfStatement");
+            static const char* const labels[] = {"Condition:", "Then:", "Else:"};
+            int k = 0;
+            for (FlatNode child : node.children()) {
+                label(indent + 2, labels[k++]);
+                later(child, indent + 4);
+            }
+            break;
+        }
+        case NodeKind::While:
+            line(sources, node, indent, "WhileStatement");
+            label(indent + 2, "Condition:");
+            later(node.child(0), indent + 4);
+            label(indent + 2, "Body:");
+            later(node.child(1), indent + 4);
+            break;
+        case NodeKind::For: {
+            line(sources, node, indent, "ForStatement");
+            FlatNode child = node.first_child();
+            static const char* const labels[] = {"Initializer:", "Condition:", "Increment:"};
+            for (int part = 0; part < 3; part++) {
+                if (!(node.data() & (1u << part))) continue;
+                label(indent + 2, labels[part]);
+                later(child, indent + 4);
+                child = child.next_sibling();
+            }
+            label(indent + 2, "Body:");
+            later(child, indent + 4);
+            break;
+        }
+        case NodeKind::Return:
+            line(sources, node, indent, "ReturnStatement");
+            if (node.has_children()) later(node.first_child(), indent + 2);
+            break;
+        case NodeKind::Break:
+            line(sources, node, indent, "BreakStatement");
+            break;
+        case NodeKind::Continue:
+            line(sources, node, indent, "ContinueStatement");
+            break;
+        case NodeKind::ErrorStatement:
+            line(sources, node, indent, "ErrorStatement");
+            break;
+        case NodeKind::ErrorExpression:
+            line(sources, node, indent, "ErrorExpression");
+            break;
+        case NodeKind::NumberLiteral:
+            line(sources, node, indent, "NumberLiteral(" + string(node.text()) + ")");
+            break;
+        case NodeKind::StringLiteral:
+            line(sources, node, indent, "StringLiteral(\"" + string(node.text()) + "\")");
+            break;
+        case NodeKind::BoolLiteral:
+            line(sources, node, indent, node.data() ? "BoolLiteral(true)" : "BoolLiteral(false)");
+            break;
+        case NodeKind::Identifier:
+            line(sources, node, indent, "Identifier(" + string(symbol_name(node.symbol())) + ")");
+            break;
+        case NodeKind::BinaryOperation:
+            line(sources, node, indent, "BinaryOperation(" + string(spelling(node.op())) + ")");
+            for (FlatNode child : node.children()) later(child, indent + 2);
+            break;
+        case NodeKind::UnaryOp:
+            line(sources, node, indent, "UnaryOp(" + string(spelling(node.op())) + ")");
+            later(node.first_child(), indent + 2);
+            break;
+        case NodeKind::Assignment: {
+            string op = node.op() == Operator::Assign ? "" : " " + string(spelling(node.op())) + "=";
+            line(sources, node, indent, "Assignment(" + string(symbol_name(node.first_child().symbol())) + op + ")");
+            later(node.child(1), indent + 2);
+            break;
+        }
+        case NodeKind::FunctionCall:
+            line(sources, node, indent, "FunctionCall(" + string(symbol_name(node.symbol())) + ")");
+            if (node.has_children()) {
+                label(indent + 2, "Arguments:");
+                for (FlatNode child : node.children()) later(child, indent + 4);
+            }
+            break;
+        }
+    }
+};
+
+NodeKind FlatNode::kind() const { return tree->kinds[at]; }
+SourceLocation FlatNode::loc() const { return tree->locs[at]; }
+NodeIndex FlatNode::end() const { return tree->ends[at]; }
+SymbolID FlatNode::symbol() const { return tree->data[at]; }
+string_view FlatNode::text() const { return tree->texts[tree->data[at]]; }
+const FlatDeclaration& FlatNode::declaration() const { return tree->declarations[tree->data[at]]; }
+uint32_t FlatNode::data() const { return tree->data[at]; }
+
+FlatNode FlatNode::child(size_t k) const {
+    FlatNode node = first_child();
+    while (k--) node = node.next_sibling();
+    return node;
+}
+
+FlatNode::Iterator& FlatNode::Iterator::operator++() {
+    at = tree->ends[at];
+    return *this;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+typedef uint32_t SymbolID;
+
+// Process-wide table of identifier spellings. Every distinct spelling gets one
+// SymbolID for the life of the process, so later phases hash and compare names
+// as integers and keep no copies of the text. Safe to call from several
+// threads at once: a lookup locks only the shard its spelling hashes to, and
+// name() takes no lock at all.
+class Interner {
+public:
+    // The id of the empty spelling; used for "no name".
+    static constexpr SymbolID None = 0;
+
+    static Interner& global() {
+        static Interner interner;
+        return interner;
+    }
+
+    SymbolID intern(std::string_view text) {
+        if (text.empty()) return None;
+        Shard& shard = shards[std::hash<std::string_view>()(text) % ShardCount];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.ids.find(text);
+        if (it != shard.ids.end()) return it->second;
+        SymbolID id = store(text);
+        shard.ids.emplace(name(id), id);
+        return id;
+    }
+
+    std::string_view name(SymbolID id) const { return names[id / PageNames][id % PageNames]; }
+
+    size_t size() const { return count.load(std::memory_order_acquire); }
+
+private:
+    static constexpr size_t ShardCount = 64;
+    static constexpr size_t ChunkSize = 64 << 10;
+    static constexpr size_t PageNames = 4096;
+    static constexpr size_t MaxPages = 1 << 16;
+
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<std::string_view, SymbolID> ids;
+    };
+
+    Shard shards[ShardCount];
+
+    // Spellings are copied into chunks that never move, so the views in
+    // `names` and in the shards stay valid. Spelling k is
+    // names[k / PageNames][k % PageNames]; a page is filled in before any id
+    // on it is handed out and is never moved, so name() needs no lock. Only
+    // new spellings take storage_mutex.
+    std::mutex storage_mutex;
+    std::unique_ptr<std::string_view[]> names[MaxPages];
+    std::atomic<size_t> count{1};
+    std::vector<std::unique_ptr<char[]>> chunks;
+    char* chunk = nullptr;
+    size_t chunk_used = 0;
+
+    Interner() { names[0].reset(new std::string_view[PageNames]); }
+
+    SymbolID store(std::string_view text) {
+        std::lock_guard<std::mutex> lock(storage_mutex);
+        size_t id = count.load(std::memory_order_relaxed);
+        if (id == PageNames * MaxPages) throw std::runtime_error("Too many identifiers");
+        std::unique_ptr<std::string_view[]>& page = names[id / PageNames];
+        if (!page) page.reset(new std::string_view[PageNames]);
+        char* copy;
+        if (text.size() > ChunkSize / 4) {
+            chunks.emplace_back(new char[text.size()]);
+            copy = chunks.back().get();
+        } else {
+            if (!chunk || chunk_used + text.size() > ChunkSize) {
+                chunks.emplace_back(new char[ChunkSize]);
+                chunk = chunks.back().get();
+                chunk_used = 0;
+            }
+            copy = chunk + chunk_used;
+            chunk_used += text.size();
+        }
+        memcpy(copy, text.data(), text.size());
+        page[id % PageNames] = std::string_view(copy, text.size());
+        count.store(id + 1, std::memory_order_release);
+        return (SymbolID)id;
+    }
+};
+
+inline SymbolID intern(std::string_view text) { return Interner::global().intern(text); }
+inline std::string_view symbol_name(SymbolID id) { return Interner::global().name(id); }
@@ -0,0 +1,270 @@
+// Differential checks for the lexer.
+//
+//   g++ -O2 -pthread lexcheck.cpp -o lexcheck
+//   ./lexcheck parallel [--jobs N] [--mb N] [files...]
+//   ./lexcheck incremental [--edits N] [--mb N] [files...]
+//   ./lexcheck backends [--mb N] [files...]
+//
+// `parallel` lexes every input with tokenize() and tokenize_parallel() and
+// reports the first token where they differ. Besides the inputs (default
+// sample_C_code/*.c) it checks the inputs concatenated up to N megabytes
+// (default 8) and generated text full of multi-line literals and comments,
+// so that many piece boundaries fall in awkward places.
+//
+// `incremental` applies N random edits (default 2000) in a row to each input
+// and to generated text, including edits that open and close literals and
+// comments, and checks relex() against tokenize() after every one. It then
+// times single edits in the middle of the N-megabyte scaled inputs.
+//
+// `backends` lexes the same inputs with every lexer backend, reports the first
+// token (or error) where a backend departs from the default one, and the
+// throughput of each backend over all inputs.
+
+#include "lexer_backends.cpp"
+
+#include <chrono>
+#include <random>
+#include <dirent.h>
+
+static vector<string> default_inputs() {
+    vector<string> paths;
+    if (DIR* dir = opendir("sample_C_code")) {
+        while (dirent* entry = readdir(dir)) {
+            string name = entry->d_name;
+            if (name.size() > 2 && name.compare(name.size() - 2, 2, ".c") == 0) paths.push_back("sample_C_code/" + name);
+        }
+        closedir(dir);
+    }
+    sort(paths.begin(), paths.end());
+    return paths;
+}
+
+static string generated_text(size_t bytes, unsigned seed) {
+    static const char* fragments[] = {
+        "int x = 42;\n", "float y = 3.5e2 + x;\n", "return a <= b && c != d;\n", "if (p) { q++; }\n",
+        "\"a string\"", "\"spans\nlines\"", "\"escaped \\\" quote\\\n\"", "'c'", "'\\n'", "'\\''",
+        "// comment with \" and ' and /*\n", "/* block\n comment // \" */", "/* * ** \n*/",
+        "#include <stdio.h>\n", "#define N 10 /* a comment */\n", "\n", "    ", "\n\n\t",
+        "name_1 ", "_under ", "x/y ", "a*b ", "a / *p ", "= ",
+    };
+    mt19937 rng(seed);
+    uniform_int_distribution<size_t> pick(0, sizeof(fragments) / sizeof(fragments[0]) - 1);
+    string text;
+    while (text.size() < bytes) text += fragments[pick(rng)];
+    // Odd seeds also check that invalid characters come out as the same tokens.
+    if (seed % 2) text.insert(text.find('\n', text.size() / 2) + 1, "@");
+    return text;
+}
+
+static string describe(const TokenStream& tokens, size_t i) {
+    if (i >= tokens.size()) return "<none>";
+    return tokenToString(tokens[i]) + " at " + to_string(tokens.line(i)) + ":" + to_string(tokens.column(i));
+}
+
+// Lexes `file` both ways; prints the first difference and returns false if any.
+static bool check_parallel(const SourceFile& file, ThreadPool& pool) {
+    auto start = chrono::steady_clock::now();
+    TokenStream expected = tokenize(file);
+    auto middle = chrono::steady_clock::now();
+    TokenStream actual = tokenize_parallel(file, pool);
+    chrono::duration<double> sequential = middle - start, parallel = chrono::steady_clock::now() - middle;
+
+    size_t count = max(expected.size(), actual.size());
+    for (size_t i = 0; i < count; i++) {
+        if (i >= expected.size() || i >= actual.size() || expected.type(i) != actual.type(i) ||
+            expected.offset(i) != actual.offset(i) || expected.lexeme(i) != actual.lexeme(i) ||
+            expected.symbol(i) != actual.symbol(i)) {
+            cout << file.name() << ": token " << i << " is " << describe(expected, i)
+                 << " sequentially but " << describe(actual, i) << " in parallel\n";
+            return false;
+        }
+    }
+    size_t errors = expected.diagnostics().size();
+    printf("%-24s %10llu bytes %9zu tokens  sequential %7.1f MB/s  parallel %7.1f MB/s", file.name().c_str(),
+           (unsigned long long)file.size(), expected.size(), file.size() / sequential.count() / 1e6,
+           file.size() / parallel.count() / 1e6);
+    printf(errors ? "  (%zu lexical errors)\n" : "\n", errors);
+    return true;
+}
+
+static TextEdit random_edit(mt19937& rng, size_t size) {
+    static const char* inserts[] = {
+        "", "x", "1", ".", "e", " ", "\n", "\"", "'", "/", "*", "/*", "*/", "//", "#", "\\",
+        "int y;", "a + b", "3.5", "\"str\"", "'c'", "foo(1, 2);\n", "/* note */", "// note\n",
+    };
+    TextEdit edit;
+    edit.offset = uniform_int_distribution<size_t>(0, size)(rng);
+    edit.removed = min(uniform_int_distribution<size_t>(0, 6)(rng), size - edit.offset);
+    edit.inserted = inserts[uniform_int_distribution<size_t>(0, sizeof(inserts) / sizeof(inserts[0]) - 1)(rng)];
+    return edit;
+}
+
+static bool same_tokens(const TokenStream& a, const TokenStream& b, size_t& first_difference) {
+    size_t count = max(a.size(), b.size());
+    for (size_t i = 0; i < count; i++) {
+        if (i >= a.size() || i >= b.size() || a.type(i) != b.type(i) || a.offset(i) != b.offset(i) ||
+            a.lexeme(i) != b.lexeme(i) || a.symbol(i) != b.symbol(i)) {
+            first_difference = i;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Applies `edits` random edits in a row to `file`, comparing relex() with
+// tokenize() after each one. Edits may leave invalid tokens behind; relex()
+// must reproduce those too.
+static bool check_incremental(SourceManager& sources, const SourceFile& file, size_t edits, unsigned seed) {
+    mt19937 rng(seed);
+    const SourceFile* current = &file;
+    TokenStream tokens = tokenize(file);
+    size_t relexed = 0, invalid = 0;
+    for (size_t n = 0; n < edits; n++) {
+        TextEdit edit = random_edit(rng, current->size());
+        const SourceFile& edited = sources.file(sources.add_buffer(file.name(), apply_edit(current->text(), edit)));
+        TokenStream expected = tokenize(edited);
+        Relexed result = relex(tokens, edited, edit);
+        size_t difference;
+        if (!same_tokens(expected, result.tokens, difference)) {
+            cout << file.name() << ": after edit " << n << " (offset " << edit.offset << ", removed " << edit.removed
+                 << ", inserted \"" << edit.inserted << "\") token " << difference << " is "
+                 << describe(expected, difference) << " but relex gave " << describe(result.tokens, difference) << "\n";
+            return false;
+        }
+        relexed += result.new_end - result.first;
+        invalid += !expected.diagnostics().empty();
+        tokens = result.tokens;
+        current = &edited;
+    }
+    printf("%-24s %6zu edits (%zu with lexical errors)  %.1f tokens re-lexed per edit\n", file.name().c_str(), edits,
+           invalid, (double)relexed / max<size_t>(1, edits));
+    return true;
+}
+
+// Per-backend totals for the summary line.
+struct BackendTotals {
+    double seconds = 0;
+    size_t bytes = 0;
+    size_t mismatches = 0;
+};
+
+// Lexes `file` with every backend, best of three runs each, and compares each
+// result with the default backend's.
+static bool check_backends(const SourceFile& file, vector<BackendTotals>& totals) {
+    const vector<const LexerBackend*>& backends = lexer_backends();
+    TokenStream expected(file);
+    bool same = true;
+    printf("%-24s %10llu bytes", file.name().c_str(), (unsigned long long)file.size());
+    for (size_t b = 0; b < backends.size(); b++) {
+        TokenStream actual(file);
+        double best = 1e30;
+        for (int run = 0; run < 3; run++) {
+            auto start = chrono::steady_clock::now();
+            actual = tokenize(file, *backends[b]);
+            best = min(best, chrono::duration<double>(chrono::steady_clock::now() - start).count());
+        }
+        totals[b].seconds += best;
+        totals[b].bytes += file.size();
+        printf("  %s %7.1f MB/s", backends[b]->name, file.size() / best / 1e6);
+        if (b == 0) {
+            expected = actual;
+            continue;
+        }
+        size_t difference;
+        if (!same_tokens(expected, actual, difference)) {
+            string problem = "token " + to_string(difference) + " is " + describe(expected, difference) + " but " + describe(actual, difference);
+            printf("\n  %s differs from %s: %s", backends[b]->name, backends[0]->name, problem.c_str());
+            totals[b].mismatches++;
+            same = false;
+        }
+    }
+    size_t errors = expected.diagnostics().size();
+    printf(errors ? "  (%zu lexical errors)\n" : "\n", errors);
+    return same;
+}
+
+static void time_incremental(SourceManager& sources, const SourceFile& file) {
+    if (file.size() < (64 << 10)) return;
+    TokenStream tokens = tokenize(file);
+    double full = 0, incremental = 0;
+    size_t timed = 0;
+    for (size_t n = 0; n < 10; n++) {
+        TextEdit edit = {file.size() / 2 + n * 997, 1, "x"};
+        const SourceFile& edited = sources.file(sources.add_buffer(file.name(), apply_edit(file.text(), edit)));
+        auto start = chrono::steady_clock::now();
+        TokenStream expected = tokenize(edited);
+        auto middle = chrono::steady_clock::now();
+        Relexed result = relex(tokens, edited, edit);
+        auto end = chrono::steady_clock::now();
+        full += chrono::duration<double>(middle - start).count();
+        incremental += chrono::duration<double>(end - middle).count();
+        timed++;
+    }
+    if (timed) {
+        printf("%-24s %10llu bytes  tokenize %8.3f ms  relex %8.3f ms per edit\n", file.name().c_str(),
+               (unsigned long long)file.size(), full / timed * 1e3, incremental / timed * 1e3);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    string mode = argc > 1 ? argv[1] : "";
+    if (mode != "parallel" && mode != "incremental" && mode != "backends") {
+        cerr << "Usage: " << argv[0] << " parallel [--jobs N] [--mb N] [files...]" << endl;
+        cerr << "       " << argv[0] << " incremental [--edits N] [--mb N] [files...]" << endl;
+        cerr << "       " << argv[0] << " backends [--mb N] [files...]" << endl;
+        return 1;
+    }
+    size_t jobs = 0, megabytes = 8, edits = 2000;
+    vector<string> paths;
+    for (int i = 2; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--jobs" && i + 1 < argc) jobs = stoul(argv[++i]);
+        else if (arg == "--mb" && i + 1 < argc) megabytes = stoul(argv[++i]);
+        else if (arg == "--edits" && i + 1 < argc) edits = stoul(argv[++i]);
+        else paths.push_back(arg);
+    }
+    if (paths.empty()) paths = default_inputs();
+
+    try {
+        SourceManager sources;
+        ThreadPool pool(jobs);
+        vector<BackendTotals> totals(lexer_backends().size());
+        size_t failures = 0;
+        string sample;
+        for (const string& path : paths) {
+            const SourceFile& file = sources.file(sources.load(path));
+            sample += file.text();
+            sample += '\n';
+            if (mode == "parallel") failures += !check_parallel(file, pool);
+            else if (mode == "backends") failures += !check_backends(file, totals);
+            else failures += !check_incremental(sources, file, edits, 1);
+        }
+        string corpus;
+        while (!sample.empty() && corpus.size() < (megabytes << 20)) corpus += sample;
+        const SourceFile& scaled = sources.file(sources.add_buffer("<scaled inputs>", corpus));
+        if (mode == "parallel") failures += !check_parallel(scaled, pool);
+        else if (mode == "backends") failures += !check_backends(scaled, totals);
+        else time_incremental(sources, scaled);
+        for (unsigned seed = 1; seed <= 8; seed++) {
+            string name = "<generated " + to_string(seed) + ">";
+            if (mode == "parallel") {
+                failures += !check_parallel(sources.file(sources.add_buffer(name, generated_text(megabytes << 20, seed))), pool);
+            } else if (mode == "backends") {
+                failures += !check_backends(sources.file(sources.add_buffer(name, generated_text(megabytes << 20, seed))), totals);
+            } else {
+                failures += !check_incremental(sources, sources.file(sources.add_buffer(name, generated_text(16 << 10, seed * 2))), edits, seed);
+            }
+        }
+        if (mode == "backends") {
+            for (size_t b = 0; b < totals.size(); b++) {
+                printf("%-8s %8.1f MB/s over %llu bytes, %zu mismatch(es)\n", lexer_backends()[b]->name,
+                       totals[b].bytes / totals[b].seconds / 1e6, (unsigned long long)totals[b].bytes, totals[b].mismatches);
+            }
+        }
+        cout << (failures ? to_string(failures) + " mismatch(es)" : "no mismatches") << endl;
+        return failures ? 1 : 0;
+    } catch (const exception& e) {
+        cerr << "Error: " << e.what() << endl;
+        return 1;
+    }
+}
@@ -0,0 +1,16 @@
+#include "lexer_regex.cpp"
+#include "lexer_raw.cpp"
+
+const vector<const LexerBackend*>& lexer_backends() {
+    static const vector<const LexerBackend*> backends = {&dfa_backend, &raw_backend};
+    return backends;
+}
+
+const LexerBackend& lexer_backend(string_view name) {
+    for (const LexerBackend* backend : lexer_backends()) {
+        if (name == backend->name) return *backend;
+    }
+    string known;
+    for (const LexerBackend* backend : lexer_backends()) known += string(known.empty() ? "" : ", ") + backend->name;
+    throw invalid_argument("Unknown lexer '" + string(name) + "' (expected one of: " + known + ")");
+}
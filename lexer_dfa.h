@@ -0,0 +1,443 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <bitset>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+#include "tokens.h"
+
+using namespace std;
+
+// One entry of a lexer spec. Patterns use a small regex dialect: literals,
+// escapes (\d \s \S \w and escaped metacharacters), [...] classes with ranges
+// and ^ negation, '.', grouping, '|', '*', '+' and '?'. A trailing \b makes the
+// rule accept only at a word boundary. Matches always start at a token
+// boundary, so a leading \b is implied and must not be written.
+struct LexRule {
+    const char* pattern;
+    TokenType type;
+};
+
+// Compiles a list of LexRules into a minimized DFA once, then scans with a
+// single table-driven pass. Among all matches the longest wins; ties go to the
+// rule listed first.
+class LexerDFA {
+public:
+    LexerDFA(const vector<LexRule>& rules) : rules(rules) {
+        vector<NfaState> nfa;
+        int nfa_start = build_nfa(nfa);
+        build_dfa(nfa, nfa_start);
+        minimize();
+        compress_columns();
+    }
+
+    // Longest match of any rule at `pos`. Returns the rule index, or -1 if no
+    // rule matches; `length` receives the match length.
+    int longest_match(string_view input, size_t pos, size_t& length) const {
+        int state = start;
+        int best = -1;
+        length = 0;
+        for (size_t i = pos; i < input.size(); i++) {
+            state = table[state * num_classes + byte_class[(unsigned char)input[i]]];
+            if (state == DEAD) break;
+            int rule = accept_plain[state];
+            int b = accept_boundary[state];
+            if (b >= 0 && (rule < 0 || b < rule) && at_word_boundary(input, i + 1)) {
+                rule = b;
+            }
+            if (rule >= 0) {
+                best = rule;
+                length = i + 1 - pos;
+            }
+        }
+        return best;
+    }
+
+    TokenType rule_type(int rule) const { return rules[rule].type; }
+    size_t state_count() const { return accept_plain.size(); }
+    size_t class_count() const { return num_classes; }
+
+private:
+    static constexpr int DEAD = 0;
+
+    struct NfaState {
+        vector<int> eps;
+        bitset<256> chars;
+        int next = -1;
+        int accept = -1;
+        bool boundary = false;
+    };
+
+    struct Fragment {
+        int start;
+        int end;
+    };
+
+    vector<LexRule> rules;
+    vector<int> table;
+    vector<int> accept_plain;
+    vector<int> accept_boundary;
+    uint8_t byte_class[256];
+    int num_classes = 0;
+    int start = 1;
+
+    static bool is_word(char c) {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+    }
+
+    static bool at_word_boundary(string_view input, size_t pos) {
+        bool before = pos > 0 && is_word(input[pos - 1]);
+        bool after = pos < input.size() && is_word(input[pos]);
+        return before != after;
+    }
+
+    // ---- regex -> NFA (Thompson construction) ----
+
+    struct RegexParser {
+        const string& src;
+        size_t pos;
+        vector<NfaState>& nfa;
+        bool boundary;
+
+        RegexParser(const string& s, vector<NfaState>& n) : src(s), pos(0), nfa(n), boundary(false) {}
+
+        int new_state() {
+            nfa.push_back(NfaState());
+            return nfa.size() - 1;
+        }
+
+        Fragment chars(const bitset<256>& set) {
+            int s = new_state();
+            int e = new_state();
+            nfa[s].chars = set;
+            nfa[s].next = e;
+            return {s, e};
+        }
+
+        void fail(const string& what) {
+            throw logic_error("Lexer spec: " + what + " in pattern '" + src + "'");
+        }
+
+        bool at_end() { return pos >= src.size(); }
+        char peek() { return src[pos]; }
+
+        Fragment parse_alternation() {
+            Fragment left = parse_concatenation();
+            while (!at_end() && peek() == '|') {
+                pos++;
+                Fragment right = parse_concatenation();
+                int s = new_state();
+                int e = new_state();
+                nfa[s].eps = {left.start, right.start};
+                nfa[left.end].eps.push_back(e);
+                nfa[right.end].eps.push_back(e);
+                left = {s, e};
+            }
+            return left;
+        }
+
+        Fragment parse_concatenation() {
+            int s = new_state();
+            Fragment result = {s, s};
+            while (!at_end() && peek() != '|' && peek() != ')') {
+                if (peek() == '\\' && pos + 2 == src.size() && src[pos + 1] == 'b') {
+                    boundary = true;
+                    pos += 2;
+                    break;
+                }
+                Fragment next = parse_repetition();
+                nfa[result.end].eps.push_back(next.start);
+                result.end = next.end;
+            }
+            return result;
+        }
+
+        Fragment parse_repetition() {
+            Fragment f = parse_atom();
+            while (!at_end() && (peek() == '*' || peek() == '+' || peek() == '?')) {
+                char op = src[pos++];
+                int s = new_state();
+                int e = new_state();
+                nfa[s].eps.push_back(f.start);
+                nfa[f.end].eps.push_back(e);
+                if (op != '+') nfa[s].eps.push_back(e);
+                if (op != '?') nfa[f.end].eps.push_back(f.start);
+                f = {s, e};
+            }
+            return f;
+        }
+
+        Fragment parse_atom() {
+            char c = src[pos++];
+            if (c == '(') {
+                Fragment f = parse_alternation();
+                if (at_end() || peek() != ')') fail("missing ')'");
+                pos++;
+                return f;
+            }
+            if (c == '[') return chars(parse_class());
+            if (c == '.') {
+                bitset<256> set;
+                set.set();
+                set.reset('\n');
+                set.reset('\r');
+                return chars(set);
+            }
+            if (c == '\\') return chars(parse_escape());
+            if (c == '*' || c == '+' || c == '?' || c == ')') fail(string("unexpected '") + c + "'");
+            bitset<256> set;
+            set.set((unsigned char)c);
+            return chars(set);
+        }
+
+        bitset<256> parse_escape() {
+            if (at_end()) fail("dangling '\\'");
+            char c = src[pos++];
+            bitset<256> set;
+            switch (c) {
+                case 'd':
+                    for (int ch = '0'; ch <= '9'; ch++) set.set(ch);
+                    break;
+                case 's':
+                case 'S':
+                    for (char ch : string(" \t\n\v\f\r")) set.set((unsigned char)ch);
+                    if (c == 'S') set.flip();
+                    break;
+                case 'w':
+                    for (int ch = 0; ch < 256; ch++) if (is_word((char)ch)) set.set(ch);
+                    break;
+                case 'n': set.set('\n'); break;
+                case 't': set.set('\t'); break;
+                case 'r': set.set('\r'); break;
+                case 'b': fail("\\b is only supported at the end of a pattern"); break;
+                default:
+                    if (isalnum((unsigned char)c)) fail(string("unknown escape '\\") + c + "'");
+                    set.set((unsigned char)c);
+            }
+            return set;
+        }
+
+        bitset<256> parse_class() {
+            bitset<256> set;
+            bool negate = false;
+            if (!at_end() && peek() == '^') {
+                negate = true;
+                pos++;
+            }
+            bool first = true;
+            while (!at_end() && (peek() != ']' || first)) {
+                first = false;
+                if (peek() == '\\') {
+                    pos++;
+                    set |= parse_escape();
+                    continue;
+                }
+                unsigned char lo = src[pos++];
+                if (pos + 1 < src.size() && peek() == '-' && src[pos + 1] != ']') {
+                    unsigned char hi = src[pos + 1];
+                    pos += 2;
+                    for (int ch = lo; ch <= hi; ch++) set.set(ch);
+                } else {
+                    set.set(lo);
+                }
+            }
+            if (at_end()) fail("missing ']'");
+            pos++;
+            if (negate) set.flip();
+            return set;
+        }
+    };
+
+    int build_nfa(vector<NfaState>& nfa) {
+        nfa.push_back(NfaState());
+        int nfa_start = 0;
+        for (size_t i = 0; i < rules.size(); i++) {
+            string pattern = rules[i].pattern;
+            RegexParser parser(pattern, nfa);
+            Fragment f = parser.parse_alternation();
+            if (!parser.at_end()) parser.fail("unbalanced ')'");
+            nfa[f.end].accept = i;
+            nfa[f.end].boundary = parser.boundary;
+            nfa[nfa_start].eps.push_back(f.start);
+        }
+        return nfa_start;
+    }
+
+    // ---- NFA -> DFA (subset construction over byte classes) ----
+
+    static void closure(const vector<NfaState>& nfa, vector<int>& set) {
+        vector<bool> seen(nfa.size(), false);
+        vector<int> stack = set;
+        for (int s : set) seen[s] = true;
+        while (!stack.empty()) {
+            int s = stack.back();
+            stack.pop_back();
+            for (int t : nfa[s].eps) {
+                if (!seen[t]) {
+                    seen[t] = true;
+                    set.push_back(t);
+                    stack.push_back(t);
+                }
+            }
+        }
+        sort(set.begin(), set.end());
+    }
+
+    // Splits the 256 byte values into classes that no NFA edge distinguishes.
+    static vector<int> nfa_byte_classes(const vector<NfaState>& nfa, int& count) {
+        vector<int> cls(256, 0);
+        count = 1;
+        for (const NfaState& s : nfa) {
+            if (s.next < 0) continue;
+            map<pair<int, bool>, int> split;
+            for (int b = 0; b < 256; b++) {
+                auto key = make_pair(cls[b], (bool)s.chars[b]);
+                auto it = split.find(key);
+                if (it == split.end()) it = split.insert({key, (int)split.size()}).first;
+                cls[b] = it->second;
+            }
+            count = split.size();
+        }
+        return cls;
+    }
+
+    void build_dfa(const vector<NfaState>& nfa, int nfa_start) {
+        int nclasses;
+        vector<int> cls = nfa_byte_classes(nfa, nclasses);
+        vector<int> representative(nclasses, -1);
+        for (int b = 0; b < 256; b++) {
+            if (representative[cls[b]] < 0) representative[cls[b]] = b;
+        }
+
+        map<vector<int>, int> ids;
+        vector<vector<int>> sets;
+        auto intern = [&](vector<int>& set) {
+            auto it = ids.find(set);
+            if (it != ids.end()) return it->second;
+            int id = sets.size();
+            ids[set] = id;
+            sets.push_back(set);
+            int plain = -1, boundary = -1;
+            for (int s : set) {
+                int rule = nfa[s].accept;
+                if (rule < 0) continue;
+                int& slot = nfa[s].boundary ? boundary : plain;
+                if (slot < 0 || rule < slot) slot = rule;
+            }
+            accept_plain.push_back(plain);
+            accept_boundary.push_back(boundary);
+            return id;
+        };
+
+        vector<int> dead;
+        intern(dead);
+        vector<int> initial = {nfa_start};
+        closure(nfa, initial);
+        start = intern(initial);
+
+        vector<vector<int>> moves;
+        for (size_t d = 0; d < sets.size(); d++) {
+            moves.push_back(vector<int>(nclasses, DEAD));
+            for (int c = 0; c < nclasses; c++) {
+                vector<int> target;
+                for (int s : sets[d]) {
+                    if (nfa[s].next >= 0 && nfa[s].chars[representative[c]]) target.push_back(nfa[s].next);
+                }
+                if (target.empty()) continue;
+                closure(nfa, target);
+                moves[d][c] = intern(target);
+            }
+        }
+
+        num_classes = 256;
+        table.assign(sets.size() * 256, DEAD);
+        for (size_t d = 0; d < sets.size(); d++) {
+            for (int b = 0; b < 256; b++) table[d * 256 + b] = moves[d][cls[b]];
+        }
+        for (int b = 0; b < 256; b++) byte_class[b] = b;
+    }
+
+    // ---- DFA minimization (Moore partition refinement) ----
+
+    void minimize() {
+        size_t n = accept_plain.size();
+        vector<int> block(n);
+        map<pair<int, int>, int> initial;
+        for (size_t s = 0; s < n; s++) {
+            auto key = make_pair(accept_plain[s], accept_boundary[s]);
+            // The dead state keeps a block of its own so it stays state 0.
+            if (s == DEAD) key = make_pair(-2, -2);
+            auto it = initial.find(key);
+            if (it == initial.end()) it = initial.insert({key, (int)initial.size()}).first;
+            block[s] = it->second;
+        }
+
+        size_t blocks = initial.size();
+        while (true) {
+            map<vector<int>, int> signatures;
+            vector<int> next(n);
+            for (size_t s = 0; s < n; s++) {
+                vector<int> sig;
+                sig.reserve(num_classes + 1);
+                sig.push_back(block[s]);
+                for (int c = 0; c < num_classes; c++) sig.push_back(block[table[s * num_classes + c]]);
+                auto it = signatures.find(sig);
+                if (it == signatures.end()) it = signatures.insert({sig, (int)signatures.size()}).first;
+                next[s] = it->second;
+            }
+            block = next;
+            if (signatures.size() == blocks) break;
+            blocks = signatures.size();
+        }
+
+        // Renumber so the dead state is 0, then rebuild the table per block.
+        vector<int> renumber(blocks, -1);
+        int count = 0;
+        renumber[block[DEAD]] = count++;
+        for (size_t s = 0; s < n; s++) {
+            if (renumber[block[s]] < 0) renumber[block[s]] = count++;
+        }
+
+        vector<int> new_table(blocks * num_classes, DEAD);
+        vector<int> new_plain(blocks, -1), new_boundary(blocks, -1);
+        for (size_t s = 0; s < n; s++) {
+            int b = renumber[block[s]];
+            new_plain[b] = accept_plain[s];
+            new_boundary[b] = accept_boundary[s];
+            for (int c = 0; c < num_classes; c++) {
+                new_table[b * num_classes + c] = renumber[block[table[s * num_classes + c]]];
+            }
+        }
+        start = renumber[block[start]];
+        table.swap(new_table);
+        accept_plain.swap(new_plain);
+        accept_boundary.swap(new_boundary);
+    }
+
+    // Merges input bytes whose columns are identical in the minimized table.
+    void compress_columns() {
+        size_t n = accept_plain.size();
+        map<vector<int>, int> columns;
+        vector<int> column_of(num_classes);
+        for (int c = 0; c < num_classes; c++) {
+            vector<int> column(n);
+            for (size_t s = 0; s < n; s++) column[s] = table[s * num_classes + c];
+            auto it = columns.find(column);
+            if (it == columns.end()) it = columns.insert({column, (int)columns.size()}).first;
+            column_of[c] = it->second;
+        }
+
+        int merged = columns.size();
+        vector<int> new_table(n * merged, DEAD);
+        for (size_t s = 0; s < n; s++) {
+            for (int c = 0; c < num_classes; c++) new_table[s * merged + column_of[c]] = table[s * num_classes + c];
+        }
+        for (int b = 0; b < 256; b++) byte_class[b] = column_of[byte_class[b]];
+        table.swap(new_table);
+        num_classes = merged;
+    }
+};
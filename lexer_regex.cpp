@@ -1,175 +1,133 @@
 #include "tokens.h"
+#include "lexer_dfa.h"
+#include "token_spec.h"
+#include "thread_pool.h"
 #include <iostream>
-#include <fstream>
-#include <regex>
 #include <cctype>
 #include <algorithm>
+#include <exception>
+#include <cstring>
 
 using namespace std;
 
-const map<string, TokenType> keywordMap = {
-    {"static_assert", T_KW_STATIC_ASSERT},
-    {"thread_local", T_KW_THREAD_LOCAL},
-    {"constexpr", T_KW_CONSTEXPR},
-    {"continue", T_KW_CONTINUE},
-    {"register", T_KW_REGISTER},
-    {"restrict", T_KW_RESTRICT},
-    {"unsigned", T_KW_UNSIGNED},
-    {"volatile", T_KW_VOLATILE},
-    {"alignas", T_KW_ALIGNAS},
-    {"alignof", T_KW_ALIGNOF},
-    {"default", T_KW_DEFAULT},
-    {"nullptr", T_KW_NULLPTR},
-    {"typedef", T_KW_TYPEDEF},
-    {"extern", T_KW_EXTERN},
-    {"sizeof", T_KW_SIZEOF},
-    {"static", T_KW_STATIC},
-    {"struct", T_KW_STATIC_ASSERT},
-    {"switch", T_KW_SWITCH},
-    {"return", T_KW_RETURN},
-    {"double", T_KW_DOUBLE},
-    {"typeof", T_KW_TYPEOF},
-    {"inline", T_KW_INLINE},
-    {"signed", T_KW_SIGNED},
-    {"float", T_KW_FLOAT},
-    {"short", T_KW_SHORT},
-    {"break", T_KW_BREAK},
-    {"while", T_KW_WHILE},
-    {"union", T_KW_UNION},
-    {"const", T_KW_CONST},
-    {"true", T_KW_TRUE},
-    {"false", T_KW_FALSE},
-    {"bool", T_KW_BOOL},
-    {"goto", T_KW_GOTO},
-    {"else", T_KW_ELSE},
-    {"case", T_KW_CASE},
-    {"enum", T_KW_ENUM},
-    {"auto", T_KW_AUTO},
-    {"long", T_KW_LONG},
-    {"void", T_KW_VOID},
-    {"char", T_KW_CHAR},
-    {"int", T_KW_INT},
-    {"for", T_KW_FOR},
-    {"if", T_KW_IF},
-    {"do", T_KW_DO},
-    {"#include",T_KW_INCLUDE},
-    {"#define",T_KW_DEFINE},
+constexpr Spelling<TokenType> tokenNameSpellings[] = {
+    {"KW_ALIGNAS", T_KW_ALIGNAS},
+    {"KW_ALIGNOF", T_KW_ALIGNOF},
+    {"KW_AUTO", T_KW_AUTO},
+    {"KW_BOOL", T_KW_BOOL},
+    {"KW_BREAK", T_KW_BREAK},
+    {"KW_CASE", T_KW_CASE},
+    {"KW_CHAR", T_KW_CHAR},
+    {"KW_CONST", T_KW_CONST},
+    {"KW_CONSTEXPR", T_KW_CONSTEXPR},
+    {"KW_CONTINUE", T_KW_CONTINUE},
+    {"KW_DEFAULT", T_KW_DEFAULT},
+    {"KW_DO", T_KW_DO},
+    {"KW_DOUBLE", T_KW_DOUBLE},
+    {"KW_ELSE", T_KW_ELSE},
+    {"KW_ENUM", T_KW_ENUM},
+    {"KW_EXTERN", T_KW_EXTERN},
+    {"KW_FALSE", T_KW_FALSE},
+    {"KW_FLOAT", T_KW_FLOAT},
+    {"KW_FOR", T_KW_FOR},
+    {"KW_GOTO", T_KW_GOTO},
+    {"KW_IF", T_KW_IF},
+    {"KW_INLINE", T_KW_INLINE},
+    {"KW_INT", T_KW_INT},
+    {"KW_LONG", T_KW_LONG},
+    {"KW_NULLPTR", T_KW_NULLPTR},
+    {"KW_REGISTER", T_KW_REGISTER},
+    {"KW_RESTRICT", T_KW_RESTRICT},
+    {"KW_RETURN", T_KW_RETURN},
+    {"KW_SHORT", T_KW_SHORT},
+    {"KW_SIGNED", T_KW_SIGNED},
+    {"KW_SIZEOF", T_KW_SIZEOF},
+    {"KW_STATIC", T_KW_STATIC},
+    {"KW_STATIC_ASSERT", T_KW_STATIC_ASSERT},
+    {"KW_STRUCT", T_KW_STRUCT},
+    {"KW_SWITCH", T_KW_SWITCH},
+    {"KW_THREAD_LOCAL", T_KW_THREAD_LOCAL},
+    {"KW_TRUE", T_KW_TRUE},
+    {"KW_TYPEDEF", T_KW_TYPEDEF},
+    {"KW_TYPEOF", T_KW_TYPEOF},
+    {"KW_TYPEOF_UNQUAL", T_KW_TYPEOF_UNQUAL},
+    {"KW_UNION", T_KW_UNION},
+    {"KW_UNSIGNED", T_KW_UNSIGNED},
+    {"KW_VOID", T_KW_VOID},
+    {"KW_VOLATILE", T_KW_VOLATILE},
+    {"KW_WHILE", T_KW_WHILE},
+    {"IDENTIFIER", T_IDENTIFIER},
+    {"INTLIT", T_INTLIT},
+    {"FLOATLIT", T_FLOATLIT},
+    {"CHARLIT", T_CHARLIT},
+    {"STRINGLIT", T_STRINGLIT},
+    {"PARENL", T_PARENL},
+    {"PARENR", T_PARENR},
+    {"BRACEL", T_BRACEL},
+    {"BRACER", T_BRACER},
+    {"BRACKETL", T_BRACKETL},
+    {"BRACKETR", T_BRACKETR},
+    {"SEMICOLON", T_SEMICOLON},
+    {"COMMA", T_COMMA},
+    {"COLON", T_COLON},
+    {"QUESTION", T_QUESTION},
+    {"OP_ARROW", T_OP_ARROW},
+    {"OP_DOT", T_OP_DOT},
+    {"OP_INC", T_OP_INC},
+    {"OP_DEC", T_OP_DEC},
+    {"OP_PLUS", T_OP_PLUS},
+    {"OP_MINUS", T_OP_MINUS},
+    {"OP_MUL", T_OP_MUL},
+    {"OP_DIV", T_OP_DIV},
+    {"OP_MOD", T_OP_MOD},
+    {"OP_ASSIGN", T_OP_ASSIGN},
+    {"OP_PLUS_ASSIGN", T_OP_PLUS_ASSIGN},
+    {"OP_MINUS_ASSIGN", T_OP_MINUS_ASSIGN},
+    {"OP_MUL_ASSIGN", T_OP_MUL_ASSIGN},
+    {"OP_DIV_ASSIGN", T_OP_DIV_ASSIGN},
+    {"OP_MOD_ASSIGN", T_OP_MOD_ASSIGN},
+    {"OP_EQ", T_OP_EQ},
+    {"OP_NEQ", T_OP_NEQ},
+    {"OP_LT", T_OP_LT},
+    {"OP_GT", T_OP_GT},
+    {"OP_LE", T_OP_LE},
+    {"OP_GE", T_OP_GE},
+    {"OP_LSHIFT", T_OP_LSHIFT},
+    {"OP_RSHIFT", T_OP_RSHIFT},
+    {"OP_LSHIFT_ASSIGN", T_OP_LSHIFT_ASSIGN},
+    {"OP_RSHIFT_ASSIGN", T_OP_RSHIFT_ASSIGN},
+    {"OP_AND", T_OP_AND},
+    {"OP_OR", T_OP_OR},
+    {"OP_LOGICAL_AND", T_OP_LOGICAL_AND},
+    {"OP_LOGICAL_OR", T_OP_LOGICAL_OR},
+    {"OP_NOT", T_OP_NOT},
+    {"OP_XOR", T_OP_XOR},
+    {"OP_AND_ASSIGN", T_OP_AND_ASSIGN},
+    {"OP_OR_ASSIGN", T_OP_OR_ASSIGN},
+    {"OP_XOR_ASSIGN", T_OP_XOR_ASSIGN},
+    {"OP_BITWISENOT", T_OP_BITWISENOT},
+    {"PP_HASH", T_PP_HASH},
+    {"PP_HASHHASH", T_PP_HASHHASH},
+    {"PP_IDENTIFIER", T_PP_IDENTIFIER},
+    {"PP_NUMBER", T_PP_NUMBER},
+    {"PP_STRING", T_PP_STRING},
+    {"EOF", T_EOF},
+    {"INVALID", T_INVALID},
+    {"INCLUDE", T_KW_INCLUDE},
+    {"DEFINE", T_KW_DEFINE},
 };
+constexpr TokenNames<TokenType, T_INVALID + 1> tokenNames(tokenNameSpellings, "");
+static_assert(tokenNames.complete(), "every TokenType needs a name");
 
 string tokenTypeToString(TokenType type) {
-    static map<TokenType, string> typeToString = {
-        {T_KW_ALIGNAS, "KW_ALIGNAS"},
-        {T_KW_ALIGNOF, "KW_ALIGNOF"},
-        {T_KW_AUTO, "KW_AUTO"},
-        {T_KW_BOOL, "KW_BOOL"},
-        {T_KW_BREAK, "KW_BREAK"},
-        {T_KW_CASE, "KW_CASE"},
-        {T_KW_CHAR, "KW_CHAR"},
-        {T_KW_CONST, "KW_CONST"},
-        {T_KW_CONSTEXPR, "KW_CONSTEXPR"},
-        {T_KW_CONTINUE, "KW_CONTINUE"},
-        {T_KW_DEFAULT, "KW_DEFAULT"},
-        {T_KW_DO, "KW_DO"},
-        {T_KW_DOUBLE, "KW_DOUBLE"},
-        {T_KW_ELSE, "KW_ELSE"},
-        {T_KW_ENUM, "KW_ENUM"},
-        {T_KW_EXTERN, "KW_EXTERN"},
-        {T_KW_FALSE, "KW_FALSE"},
-        {T_KW_FLOAT, "KW_FLOAT"},
-        {T_KW_FOR, "KW_FOR"},
-        {T_KW_GOTO, "KW_GOTO"},
-        {T_KW_IF, "KW_IF"},
-        {T_KW_INLINE, "KW_INLINE"},
-        {T_KW_INT, "KW_INT"},
-        {T_KW_LONG, "KW_LONG"},
-        {T_KW_NULLPTR, "KW_NULLPTR"},
-        {T_KW_REGISTER, "KW_REGISTER"},
-        {T_KW_RESTRICT, "KW_RESTRICT"},
-        {T_KW_RETURN, "KW_RETURN"},
-        {T_KW_SHORT, "KW_SHORT"},
-        {T_KW_SIGNED, "KW_SIGNED"},
-        {T_KW_SIZEOF, "KW_SIZEOF"},
-        {T_KW_STATIC, "KW_STATIC"},
-        {T_KW_STATIC_ASSERT, "KW_STATIC_ASSERT"},
-        {T_KW_SWITCH, "KW_SWITCH"},
-        {T_KW_THREAD_LOCAL, "KW_THREAD_LOCAL"},
-        {T_KW_TRUE, "KW_TRUE"},
-        {T_KW_TYPEDEF, "KW_TYPEDEF"},
-        {T_KW_TYPEOF, "KW_TYPEOF"},
-        {T_KW_TYPEOF_UNQUAL, "KW_TYPEOF_UNQUAL"},
-        {T_KW_UNION, "KW_UNION"},
-        {T_KW_UNSIGNED, "KW_UNSIGNED"},
-        {T_KW_VOID, "KW_VOID"},
-        {T_KW_VOLATILE, "KW_VOLATILE"},
-        {T_KW_WHILE, "KW_WHILE"},
-        {T_IDENTIFIER, "IDENTIFIER"},
-        {T_INTLIT, "INTLIT"},
-        {T_FLOATLIT, "FLOATLIT"},
-        {T_CHARLIT, "CHARLIT"},
-        {T_STRINGLIT, "STRINGLIT"},
-        {T_PARENL, "PARENL"},
-        {T_PARENR, "PARENR"},
-        {T_BRACEL, "BRACEL"},
-        {T_BRACER, "BRACER"},
-        {T_BRACKETL, "BRACKETL"},
-        {T_BRACKETR, "BRACKETR"},
-        {T_SEMICOLON, "SEMICOLON"},
-        {T_COMMA, "COMMA"},
-        {T_COLON, "COLON"},
-        {T_QUESTION, "QUESTION"},
-        {T_OP_ARROW, "OP_ARROW"},
-        {T_OP_DOT, "OP_DOT"},
-        {T_OP_INC, "OP_INC"},
-        {T_OP_DEC, "OP_DEC"},
-        {T_OP_PLUS, "OP_PLUS"},
-        {T_OP_MINUS, "OP_MINUS"},
-        {T_OP_MUL, "OP_MUL"},
-        {T_OP_DIV, "OP_DIV"},
-        {T_OP_MOD, "OP_MOD"},
-        {T_OP_ASSIGN, "OP_ASSIGN"},
-        {T_OP_PLUS_ASSIGN, "OP_PLUS_ASSIGN"},
-        {T_OP_MINUS_ASSIGN, "OP_MINUS_ASSIGN"},
-        {T_OP_MUL_ASSIGN, "OP_MUL_ASSIGN"},
-        {T_OP_DIV_ASSIGN, "OP_DIV_ASSIGN"},
-        {T_OP_MOD_ASSIGN, "OP_MOD_ASSIGN"},
-        {T_OP_EQ, "OP_EQ"},
-        {T_OP_NEQ, "OP_NEQ"},
-        {T_OP_LT, "OP_LT"},
-        {T_OP_GT, "OP_GT"},
-        {T_OP_LE, "OP_LE"},
-        {T_OP_GE, "OP_GE"},
-        {T_OP_LSHIFT, "OP_LSHIFT"},
-        {T_OP_RSHIFT, "OP_RSHIFT"},
-        {T_OP_LSHIFT_ASSIGN, "OP_LSHIFT_ASSIGN"},
-        {T_OP_RSHIFT_ASSIGN, "OP_RSHIFT_ASSIGN"},
-        {T_OP_AND, "OP_AND"},
-        {T_OP_OR, "OP_OR"},
-        {T_OP_NOT, "OP_NOT"},
-        {T_OP_XOR, "OP_XOR"},
-        {T_OP_AND_ASSIGN, "OP_AND_ASSIGN"},
-        {T_OP_OR_ASSIGN, "OP_OR_ASSIGN"},
-        {T_OP_XOR_ASSIGN, "OP_XOR_ASSIGN"},
-        {T_OP_BITWISENOT, "OP_BITWISENOT"},
-        {T_PP_HASH, "PP_HASH"},
-        {T_PP_HASHHASH, "PP_HASHHASH"},
-        {T_PP_IDENTIFIER, "PP_IDENTIFIER"},
-        {T_PP_NUMBER, "PP_NUMBER"},
-        {T_PP_STRING, "PP_STRING"},
-        {T_EOF, "EOF"},
-        {T_INVALID, "INVALID"},
-        {T_KW_INCLUDE, "INCLUDE"},
-        {T_KW_DEFINE, "DEFINE"}
-
-
-    };
-    return typeToString[type];
+    return string(tokenNames[type]);
 }
 
 string tokenToString(const Token& token) {
     switch (token.type) {
         case T_KW_INCLUDE:
         case T_KW_DEFINE:
-            return "T_" + tokenTypeToString(token.type) + "(\"" + token.lexeme + "\")";
+            return "T_" + tokenTypeToString(token.type) + "(\"" + string(token.lexeme) + "\")";
         case T_IDENTIFIER:
         case T_INTLIT:
         case T_FLOATLIT:
@@ -178,238 +136,397 @@ string tokenToString(const Token& token) {
         case T_PP_IDENTIFIER:
         case T_PP_NUMBER:
         case T_PP_STRING:
-            return "T_" + tokenTypeToString(token.type) + "(\"" + token.lexeme + "\")";
+            return "T_" + tokenTypeToString(token.type) + "(\"" + string(token.lexeme) + "\")";
         default:
             return "T_" + tokenTypeToString(token.type);
     }
 }
 
-vector<Token> tokenize(const string& input) {
-    vector<Token> tokens;
-    size_t pos = 0;
-    int line = 1;
-    int column = 1;
-    
-    vector<pair<regex, TokenType>> patterns = {
-        // Whitespace and comments
-        { regex(R"(\s+)"), T_INVALID }, // Will be skipped
-        { regex(R"(//.*)"), T_INVALID }, // Will be skipped
-        { regex(R"(/\*[\s\S]*?\*/)"), T_INVALID }, // Will be skipped
+// Token spec for the DFA. Rules typed T_INVALID are skipped. Order matters
+// only for ties: the longest match wins, then the rule listed first.
+const vector<LexRule> lexRules = {
+    // Whitespace and comments
+    { R"(\s+)", T_INVALID },
+    { R"(//.*)", T_INVALID },
+    { R"(/\*([^*]|\*+[^*/])*\*+/)", T_INVALID },
+    { R"(\\\r?\n)", T_INVALID }, // Line splice
 
-        { regex(R"(#.*)"), T_INVALID }, // Find '#' and consume the rest of the line. Mark as INVALID to skip.
+    // Directive and macro punctuation; preprocessor.h gives the lines meaning
+    { R"(##)", T_PP_HASHHASH },
+    { R"(#)", T_PP_HASH },
 
-        // { regex(R"(#include\b)"), T_KW_INCLUDE },
-        // { regex(R"(#define\b)"), T_KW_DEFINE },
-        // Preprocessor directives
-        { regex(R"(##)"), T_PP_HASHHASH },
-        { regex(R"(#)"), T_PP_HASH },
-        
-        // Multi-character operators
-        { regex(R"(<<=)"), T_OP_LSHIFT_ASSIGN },
-        { regex(R"(>>=)"), T_OP_RSHIFT_ASSIGN },
-        { regex(R"(\.\.\.)"), T_OP_DOT }, // Ellipsis
-        { regex(R"(<<)"), T_OP_LSHIFT },
-        { regex(R"(>>)"), T_OP_RSHIFT },
-        { regex(R"(==)"), T_OP_EQ },
-        { regex(R"(!=)"), T_OP_NEQ },
-        { regex(R"(<=)"), T_OP_LE },
-        { regex(R"(>=)"), T_OP_GE },
-        { regex(R"(&&)"), T_OP_AND },
-        { regex(R"(\|\|)"), T_OP_OR },
-        { regex(R"(\+\+)"), T_OP_INC },
-        { regex(R"(\-\-)"), T_OP_DEC },
-        { regex(R"(\+=)"), T_OP_PLUS_ASSIGN },
-        { regex(R"(\-=)"), T_OP_MINUS_ASSIGN },
-        { regex(R"(\*=)"), T_OP_MUL_ASSIGN },
-        { regex(R"(/=)"), T_OP_DIV_ASSIGN },
-        { regex(R"(%=)"), T_OP_MOD_ASSIGN },
-        { regex(R"(&=)"), T_OP_AND_ASSIGN },
-        { regex(R"(\|=)"), T_OP_OR_ASSIGN },
-        { regex(R"(\^=)"), T_OP_XOR_ASSIGN },
-        { regex(R"(->)"), T_OP_ARROW },
-        
-        // Single-character operators and punctuation
-        { regex(R"(\()"), T_PARENL },
-        { regex(R"(\))"), T_PARENR },
-        { regex(R"(\{)"), T_BRACEL },
-        { regex(R"(\})"), T_BRACER },
-        { regex(R"(\[)"), T_BRACKETL },
-        { regex(R"(\])"), T_BRACKETR },
-        { regex(R"(;)"), T_SEMICOLON },
-        { regex(R"(,)"), T_COMMA },
-        { regex(R"(:)"), T_COLON },
-        { regex(R"(\?)"), T_QUESTION },
-        { regex(R"(\.)"), T_OP_DOT },
-        { regex(R"(\+)"), T_OP_PLUS },
-        { regex(R"(\-)"), T_OP_MINUS },
-        { regex(R"(\*)"), T_OP_MUL },
-        { regex(R"(/)"), T_OP_DIV },
-        { regex(R"(%)"), T_OP_MOD },
-        { regex(R"(=)"), T_OP_ASSIGN },
-        { regex(R"(<)"), T_OP_LT },
-        { regex(R"(>)"), T_OP_GT },
-        { regex(R"(&)"), T_OP_AND },
-        { regex(R"(\|)"), T_OP_OR },
-        { regex(R"(!)"), T_OP_NOT },
-        { regex(R"(\^)"), T_OP_XOR },
-        { regex(R"(~)"), T_OP_BITWISENOT },
-        
-        // Literals and Identifiers (Identifier must be last)
-        { regex(R"(\b\d+\.\d*([eE][-+]?\d+)?\b)"), T_FLOATLIT },
-        { regex(R"(\b\d+\b)"), T_INTLIT },
-        { regex(R"([a-zA-Z_][a-zA-Z0-9_]*)"), T_IDENTIFIER }
-    };
+    // Multi-character operators
+    { R"(<<=)", T_OP_LSHIFT_ASSIGN },
+    { R"(>>=)", T_OP_RSHIFT_ASSIGN },
+    { R"(\.\.\.)", T_OP_DOT }, // Ellipsis
+    { R"(<<)", T_OP_LSHIFT },
+    { R"(>>)", T_OP_RSHIFT },
+    { R"(==)", T_OP_EQ },
+    { R"(!=)", T_OP_NEQ },
+    { R"(<=)", T_OP_LE },
+    { R"(>=)", T_OP_GE },
+    { R"(&&)", T_OP_LOGICAL_AND },
+    { R"(\|\|)", T_OP_LOGICAL_OR },
+    { R"(\+\+)", T_OP_INC },
+    { R"(\-\-)", T_OP_DEC },
+    { R"(\+=)", T_OP_PLUS_ASSIGN },
+    { R"(\-=)", T_OP_MINUS_ASSIGN },
+    { R"(\*=)", T_OP_MUL_ASSIGN },
+    { R"(/=)", T_OP_DIV_ASSIGN },
+    { R"(%=)", T_OP_MOD_ASSIGN },
+    { R"(&=)", T_OP_AND_ASSIGN },
+    { R"(\|=)", T_OP_OR_ASSIGN },
+    { R"(\^=)", T_OP_XOR_ASSIGN },
+    { R"(->)", T_OP_ARROW },
+
+    // Single-character operators and punctuation
+    { R"(\()", T_PARENL },
+    { R"(\))", T_PARENR },
+    { R"(\{)", T_BRACEL },
+    { R"(\})", T_BRACER },
+    { R"(\[)", T_BRACKETL },
+    { R"(\])", T_BRACKETR },
+    { R"(;)", T_SEMICOLON },
+    { R"(,)", T_COMMA },
+    { R"(:)", T_COLON },
+    { R"(\?)", T_QUESTION },
+    { R"(\.)", T_OP_DOT },
+    { R"(\+)", T_OP_PLUS },
+    { R"(\-)", T_OP_MINUS },
+    { R"(\*)", T_OP_MUL },
+    { R"(/)", T_OP_DIV },
+    { R"(%)", T_OP_MOD },
+    { R"(=)", T_OP_ASSIGN },
+    { R"(<)", T_OP_LT },
+    { R"(>)", T_OP_GT },
+    { R"(&)", T_OP_AND },
+    { R"(\|)", T_OP_OR },
+    { R"(!)", T_OP_NOT },
+    { R"(\^)", T_OP_XOR },
+    { R"(~)", T_OP_BITWISENOT },
+
+    // Literals and Identifiers
+    { R"(\d+\.\d*([eE][-+]?\d+)?\b)", T_FLOATLIT },
+    { R"(\d+\b)", T_INTLIT },
+    { R"([a-zA-Z_][a-zA-Z0-9_]*)", T_IDENTIFIER }
+};
+
+static const LexerDFA& token_dfa() {
+    static const LexerDFA dfa(lexRules);
+    return dfa;
+}
+
+Token Lexer::next() {
+    const LexerDFA& dfa = token_dfa();
+    const SourceFile& file = *this->file;
+    string_view input = file.text();
 
     while (pos < input.size()) {
  // Handle character literals
         if (input[pos] == '\'') {
-            int start_line = line;
-            int start_column = column;
-            
-            string char_lit;
+            size_t start = pos;
             pos++;
-            column++;
             
             while (pos < input.size() && input[pos] != '\'') {
                 if (input[pos] == '\\') {
-                    char_lit += input[pos];
                     pos++;
-                    column++;
                     if (pos < input.size()) {
-                        char_lit += input[pos];
                         pos++;
-                        column++;
                     }
                 } else {
-                    char_lit += input[pos];
                     pos++;
-                    column++;
-                }
-                
-                if (pos >= input.size()) {
-                    throw runtime_error("Unterminated character literal at line " + to_string(start_line) + 
-                                       ", column " + to_string(start_column));
                 }
             }
             
-            if (pos < input.size() && input[pos] == '\'') {
+            if (pos < input.size()) {
                 pos++;
-                column++;
-                tokens.push_back(Token(T_CHARLIT, char_lit, start_line, start_column));
+                return Token(T_CHARLIT, input.substr(start + 1, pos - start - 2), start);
             }
-            continue;
+            pos = invalid_token_end(input, start);
+            return invalid(input.substr(start, pos - start), start);
         }
         
   // Handle string literals
         if (input[pos] == '"') {
-            int start_line = line;
-            int start_column = column;
-            
-            string str_lit;
+            size_t start = pos;
             pos++;
-            column++;
             
             while (pos < input.size() && input[pos] != '"') {
                 if (input[pos] == '\\') {
-                    str_lit += input[pos];
                     pos++;
-                    column++;
                     if (pos < input.size()) {
-                        str_lit += input[pos];
                         pos++;
-                        column++;
                     }
-                } else if (input[pos] == '\n') {
-                    line++;
-                    column = 1;
-                    str_lit += input[pos];
-                    pos++;
                 } else {
-                    str_lit += input[pos];
                     pos++;
-                    column++;
-                }
-                
-                if (pos >= input.size()) {
-                    throw runtime_error("Unterminated string literal at line " + to_string(start_line) + 
-                                       ", column " + to_string(start_column));
                 }
             }
             
-            if (pos < input.size() && input[pos] == '"') {
+            if (pos < input.size()) {
                 pos++;
-                column++;
-                tokens.push_back(Token(T_STRINGLIT, str_lit, start_line, start_column));
+                return Token(T_STRINGLIT, input.substr(start + 1, pos - start - 2), start);
             }
-            continue;
+            pos = invalid_token_end(input, start);
+            return invalid(input.substr(start, pos - start), start);
         }
         
-  // Handle other tokens with regex
-        bool matched = false;
-        for (auto& pattern : patterns) {
-            regex re = pattern.first;
-            smatch match;
-            string remaining = input.substr(pos);
-            
-            if (regex_search(remaining, match, re, regex_constants::match_continuous)) {
-                string lexeme = match.str();
-                TokenType type = pattern.second;
-                
-   // Update line and column counters
-                for (char c : lexeme) {
-                    if (c == '\n') {
-                        line++;
-                        column = 1;
-                    } else {
-                        column++;
-                    }
-                }
-                
+  // Handle other tokens with the DFA
+        size_t length;
+        int rule = dfa.longest_match(input, pos, length);
+        if (rule < 0) {
+            size_t start = pos;
+            pos = invalid_token_end(input, start);
+            return invalid(input.substr(start, pos - start), start);
+        }
+        string_view lexeme = input.substr(pos, length);
+        TokenType type = dfa.rule_type(rule);
+
           // Skip whitespace and comments
-                if (type == T_INVALID) {
-                    pos += lexeme.size();
-                    matched = true;
-                    break;
-                }
-                
+        if (type == T_INVALID) {
+            pos += length;
+            continue;
+        }
+
           // Check if identifier is a keyword
-                if (type == T_IDENTIFIER) {
-                    if (lexeme[0] == '_' && lexeme.size() > 1 && isdigit(lexeme[1])) {
-                        throw runtime_error("Invalid identifier: " + lexeme + " at line " + 
-                                           to_string(line) + ", column " + to_string(column - lexeme.size()));
-                    }
-                    
-                    auto it = keywordMap.find(lexeme);
-                    if (it != keywordMap.end()) {
-                        type = it->second;
-                    }
+        if (type == T_IDENTIFIER) {
+            if (lexeme[0] == '_' && lexeme.size() > 1 && isdigit(lexeme[1])) {
+                size_t start = pos;
+                pos += length;
+                return invalid(lexeme, start);
+            }
+            
+            if (!keywords.find(lexeme, type)) {
+                size_t start = pos;
+                pos += length;
+                return Token(type, lexeme, start, intern(lexeme));
+            }
+        }
+        
+        size_t start = pos;
+        pos += length;
+        return Token(type, lexeme, start);
+    }
+    
+    return Token(T_EOF, input.substr(pos, 0), pos);
+}
+
+static unique_ptr<TokenSource> open_dfa(const SourceFile& file, SourceOffset start) {
+    return unique_ptr<TokenSource>(new Lexer(file, start));
+}
+
+const LexerBackend dfa_backend = {"dfa", "table-driven DFA compiled from the token spec", open_dfa};
+
+TokenStream tokenize(const SourceFile& file, const LexerBackend& backend) {
+    unique_ptr<TokenSource> lexer = backend.open(file, 0);
+    TokenStream tokens(file);
+    while (true) {
+        Token token = lexer->next();
+        tokens.push(token);
+        if (token.type == T_EOF) return tokens;
+    }
+}
+
+// Split points for parallel lexing: the starts of lines roughly `pieces` equal
+// steps apart. A cheap pre-scan follows literals and comments so a split does
+// not land inside one. It is only a hint; tokenize_parallel checks every seam
+// against the lexer itself.
+static vector<size_t> split_points(string_view input, size_t pieces) {
+    enum { Code, LineComment, BlockComment, String, Char } state = Code;
+    vector<size_t> points;
+    size_t step = input.size() / pieces;
+    size_t target = step;
+    for (size_t i = 0; i < input.size() && points.size() + 1 < pieces; i++) {
+        char c = input[i];
+        char next = i + 1 < input.size() ? input[i + 1] : '\0';
+        if (c == '\n' && state == LineComment) state = Code;
+        switch (state) {
+            case Code:
+                if (c == '\n' && i + 1 >= target) {
+                    points.push_back(i + 1);
+                    target = i + 1 + step;
                 }
-                
-                tokens.push_back(Token(type, lexeme, line, column - lexeme.size()));
-                pos += lexeme.size();
-                matched = true;
+                else if (c == '"') state = String;
+                else if (c == '\'') state = Char;
+                else if (c == '/' && next == '/') { state = LineComment; i++; }
+                else if (c == '/' && next == '*') { state = BlockComment; i++; }
+                break;
+            case BlockComment:
+                if (c == '*' && next == '/') { state = Code; i++; }
+                break;
+            case String:
+            case Char:
+                if (c == '\\') i++;
+                else if (c == (state == String ? '"' : '\'')) state = Code;
                 break;
+            case LineComment:
+                break;
+        }
+    }
+    return points;
+}
+
+// The tokens that start in [begin, end) when lexing from `from`, plus the
+// first token starting at or after `end`. Two neighbouring pieces agree when
+// the first piece's seam token is where the second piece's tokens start.
+struct LexPiece {
+    size_t begin;
+    size_t end;
+    TokenStream tokens;
+    Token seam;
+    SourceOffset first = 0;
+    bool started = false;
+    exception_ptr error;
+
+    LexPiece(const SourceFile& file, size_t begin, size_t end) : begin(begin), end(end), tokens(file) {}
+
+    void lex(const LexerBackend& backend, size_t from) {
+        tokens = TokenStream(tokens.source());
+        started = false;
+        error = nullptr;
+        try {
+            unique_ptr<TokenSource> lexer = backend.open(tokens.source(), from);
+            while (true) {
+                Token token = lexer->next();
+                if (!started) {
+                    first = token.offset;
+                    started = true;
+                }
+                if (token.offset >= end) {
+                    seam = token;
+                    return;
+                }
+                tokens.push(token);
             }
+        } catch (...) {
+            error = current_exception();
         }
-        
-        if (!matched) {
-            throw runtime_error("Unexpected character: '" + string(1, input[pos]) + "' at line " + 
-                               to_string(line) + ", column " + to_string(column));
+    }
+};
+
+TokenStream tokenize_parallel(const SourceFile& file, ThreadPool& pool, const LexerBackend& backend) {
+    const size_t min_piece = 256 << 10;
+    size_t count = min(pool.size() * 4, (size_t)(file.size() / min_piece));
+    if (count < 2) return tokenize(file, backend);
+
+    vector<size_t> points = split_points(file.text(), count);
+    points.insert(points.begin(), 0);
+    points.push_back(file.size());
+    vector<LexPiece> pieces;
+    pieces.reserve(points.size() - 1);
+    for (size_t i = 0; i + 1 < points.size(); i++) pieces.emplace_back(file, points[i], points[i + 1]);
+
+    for (LexPiece& piece : pieces) pool.submit([&piece, &backend] { piece.lex(backend, piece.begin); });
+    pool.wait();
+
+    // Stitch in order. A piece that started inside a token the previous piece
+    // ran across is lexed again from that token's start.
+    TokenStream tokens(file);
+    size_t total = 0;
+    for (const LexPiece& piece : pieces) total += piece.tokens.size();
+    tokens.reserve(total + 1);
+    for (size_t i = 0; i < pieces.size(); i++) {
+        LexPiece& piece = pieces[i];
+        if (i > 0) {
+            SourceOffset resume = pieces[i - 1].seam.offset;
+            if (!piece.started || piece.first != resume) piece.lex(backend, resume);
         }
+        tokens.append(piece.tokens);
+        if (piece.error) rethrow_exception(piece.error);
     }
-    
-    tokens.push_back(Token(T_EOF, "", line, column));
+    tokens.push(pieces.back().seam);
     return tokens;
 }
 
-string readFile(const string& filename) {
-    ifstream file(filename);
-    if (!file.is_open()) {
-        throw runtime_error("Could not open file: " + filename);
+string apply_edit(string_view text, const TextEdit& edit) {
+    if (edit.offset > text.size() || edit.removed > text.size() - edit.offset) {
+        throw out_of_range("edit runs past the end of the file");
     }
-    
-    string content((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
-    return content;
+    string result;
+    result.reserve(text.size() - edit.removed + edit.inserted.size());
+    result.append(text.substr(0, edit.offset));
+    result.append(edit.inserted);
+    result.append(text.substr(edit.offset + edit.removed));
+    return result;
+}
+
+Relexed relex(const TokenStream& old_tokens, const SourceFile& edited, const TextEdit& edit,
+              const LexerBackend& backend) {
+    // Lexers read at most this many bytes past the end of a token, except
+    // when they follow "/*" looking for a comment end (handled below).
+    const SourceOffset lookahead = 4;
+    string_view old_text = old_tokens.source().text();
+    string_view text = edited.text();
+    SourceOffset old_edit_end = edit.offset + edit.removed;
+    SourceOffset edit_end = edit.offset + edit.inserted.size();
+    int64_t shift = (int64_t)edit.inserted.size() - (int64_t)edit.removed;
+
+    // Keep the tokens the lexer finished with before it could see the edit.
+    size_t keep = 0, high = old_tokens.size();
+    while (keep < high) {
+        size_t mid = (keep + high) / 2;
+        if (old_tokens.end(mid) + lookahead <= edit.offset) keep = mid + 1;
+        else high = mid;
+    }
+    // Numbers read further: after "1." the lexers follow digits and an
+    // exponent looking for a longer match. Such a run reaching the edit may
+    // have decided how any token ending inside it was lexed.
+    SourceOffset run = edit.offset;
+    while (run > 0 && strchr("0123456789.eE+-", old_text[run - 1])) run--;
+    while (keep > 0 && old_tokens.end(keep - 1) >= run) keep--;
+    // An unterminated "/*" lexes as '/' and '*' and sends the DFA to the end
+    // of the file. If the edit makes a "*/", such a comment may now close, so
+    // lexing has to restart before it.
+    SourceOffset zone = edit.offset > 0 ? edit.offset - 1 : 0;
+    if (text.substr(zone, edit_end + 1 - zone).find("*/") != string_view::npos) {
+        for (size_t i = 0; i < keep; i++) {
+            if (old_tokens.type(i) == T_OP_DIV && old_text.substr(old_tokens.offset(i) + 1, 1) == "*") {
+                keep = i;
+                break;
+            }
+        }
+    }
+    // Likewise an unterminated literal is an invalid token up to the end of its
+    // line, but it is unterminated because of the text up to the end of the
+    // file. An edit that adds or removes a quote or backslash may close it.
+    const string_view closers = "\"'\\";
+    SourceOffset old_zone = edit.offset > 0 ? edit.offset - 1 : 0;
+    if (text.substr(zone, edit_end + 1 - zone).find_first_of(closers) != string_view::npos ||
+        old_text.substr(old_zone, old_edit_end + 1 - old_zone).find_first_of(closers) != string_view::npos) {
+        for (size_t i = 0; i < keep; i++) {
+            char first = old_text[old_tokens.offset(i)];
+            if (old_tokens.type(i) == T_INVALID && (first == '"' || first == '\'')) {
+                keep = i;
+                break;
+            }
+        }
+    }
+
+    Relexed result = {TokenStream(edited), keep, keep, keep};
+    result.tokens.reserve(old_tokens.size() + 64);
+    result.tokens.append(old_tokens, 0, keep, 0);
+    unique_ptr<TokenSource> lexer = backend.open(edited, keep ? old_tokens.end(keep - 1) : 0);
+    // Once a new token starts where an old token past the edit starts (after
+    // the shift), the text from there on is the same and so are the tokens.
+    size_t old_index = keep;
+    while (true) {
+        Token token = lexer->next();
+        if (token.offset >= edit_end) {
+            while (old_index < old_tokens.size() &&
+                   (old_tokens.offset(old_index) < old_edit_end || (int64_t)old_tokens.offset(old_index) + shift < (int64_t)token.offset)) {
+                old_index++;
+            }
+            if (old_index < old_tokens.size() && (int64_t)old_tokens.offset(old_index) + shift == (int64_t)token.offset) break;
+        }
+        result.tokens.push(token);
+        if (token.type == T_EOF) {
+            old_index = old_tokens.size();
+            break;
+        }
+    }
+    result.new_end = result.tokens.size();
+    result.old_end = old_index;
+    result.tokens.append(old_tokens, old_index, old_tokens.size(), shift);
+    return result;
 }
 
 // int main(int argc, char* argv[]) {
@@ -419,11 +536,11 @@ string readFile(const string& filename) {
 //     }
     
 //     try {
-//         string input = readFile(argv[1]);
-//         vector<Token> tokens = tokenize(input);
+//         SourceManager sources;
+//         TokenStream tokens = tokenize(sources.file(sources.load(argv[1])));
         
-//         for (const auto& token : tokens) {
-//             cout << tokenToString(token) << ", ";
+//         for (size_t i = 0; i < tokens.size(); i++) {
+//             cout << tokenToString(tokens[i]) << ", ";
 //         }
 //         cout << endl;
 //     } catch (const exception& e) {
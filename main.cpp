@@ -2,87 +2,288 @@
 #include <string>
 #include <vector>
 #include <stdexcept>
+#include <memory>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
 #include "tokens.h" 
 #include "ast.h"
+#include "ast_dump.h"
 #include "parser.h"
-#include "lexer_regex.cpp" 
+#include "parallel_parser.h"
+#include "ast_cache.h"
+#include "lexer_backends.cpp" 
+#include "preprocessor.h"
 #include "scope_analyzer.h"
 #include "typechecker.h" 
 
-int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        cerr << "Usage: " << argv[0] << " <source_file.c>" << endl;
-        return 1;
+// Where --dump-ast writes each file's tree: to `path`, opened as `fd`, or
+// to stdout if `path` is empty. No tree is written while `fd` is -1.
+struct DumpOptions {
+    int fd = -1;
+    string path;
+    DumpFormat format = DumpFormat::Text;
+};
+
+// Preprocesses whatever the parser did not reach, then prints every lexical
+// and preprocessing error found. Returns true if there were any.
+static bool report_early_errors(Preprocessor* input) {
+    if (!input) return false;
+    while (input->next().type != T_EOF) {}
+    if (!input->diagnostics().empty()) {
+        cerr << "\nLEXICAL ERRORS" << endl;
+        for (const LexDiagnostic& diagnostic : input->diagnostics()) cerr << "Error: " << diagnostic.message << endl;
+    }
+    if (!input->errors().empty()) {
+        cerr << "\nPREPROCESSOR ERRORS" << endl;
+        for (const LexDiagnostic& diagnostic : input->errors()) cerr << "Error: " << diagnostic.message << endl;
     }
+    return !input->diagnostics().empty() || !input->errors().empty();
+}
 
-    string filename = argv[1];
+// What a cached tree of `source` depends on besides the files it was read
+// from: the file's name, which quoted includes are resolved against, and
+// the options that change what the parser builds.
+static uint64_t cache_key(const SourceFile& source, const PreprocessorOptions& options, const ParserOptions& parser_options) {
+    string settings = source.name();
+    for (const string& dir : options.include_paths) settings += '\0' + dir;
+    settings += '\0' + to_string(parser_options.max_nesting);
+    uint64_t key = content_checksum(settings);
+    return content_checksum(source.text()) ^ (key << 1 | key >> 63);
+}
+
+// Runs every phase on one file. Files of a batch share `sources` and
+// `headers`, so a header they all include is lexed once, and they share
+// `pool`, which is NULL without --jobs.
+static int compile(const string& filename, SourceManager& sources, HeaderCache& headers,
+                   const PreprocessorOptions& options, const ParserOptions& parser_options, ThreadPool* pool,
+                   const string& cache_dir, const DumpOptions& dump) {
     cout << "Parsing file: " << filename << endl;
 
+    // The tree is freed with `ast_arena` when this returns.
+    Arena ast_arena;
     Program* ast_root = NULL; 
     Scope* global_scope = NULL; 
+    unique_ptr<TokenStream> lexed;
+    unique_ptr<Preprocessor> input;
+    // Holds the strings of a tree loaded from the cache.
+    unique_ptr<AstCache> cached;
 
     try {
         cout << "\n1. lexical analysis" << endl;
-        string source_code = readFile(filename);
-        vector<Token> tokens = tokenize(source_code);
-        cout << "   Lexing complete. " << tokens.size() << " tokens found." << endl;
+        const SourceFile& source = sources.file(sources.load(filename));
+        // With --cache, a tree cached by an earlier run on the same file,
+        // headers and options is loaded instead of lexing and parsing.
+        string cache_path;
+        uint64_t key = 0;
+        if (!cache_dir.empty() && !parser_options.lazy_bodies) {
+            key = cache_key(source, options, parser_options);
+            char name[32];
+            snprintf(name, sizeof(name), "%016llx.ast", (unsigned long long)key);
+            cache_path = cache_dir + "/" + name;
+            cached = AstCache::open(cache_path, key);
+            if (cached) ast_root = cached->load(ast_arena, sources, source);
+        }
+        vector<ParseDiagnostic> syntax_errors;
+        if (ast_root) {
+            cout << "   Loaded the AST from " << cache_path << "; lexing and parsing were skipped." << endl;
+        } else {
+            const LexerBackend& backend = *options.backend;
+            // With --jobs the whole file is lexed up front on a thread pool;
+            // otherwise the parser pulls tokens from the lexer as it goes.
+            // Included headers are always lexed on demand.
+            if (pool) {
+                lexed.reset(new TokenStream(tokenize_parallel(source, *pool, backend)));
+                input.reset(new Preprocessor(headers, source, unique_ptr<TokenSource>(new TokenStreamSource(*lexed)), options));
+                cout << "   Lexing complete. " << lexed->size() << " tokens found." << endl;
+            } else {
+                input.reset(new Preprocessor(headers, source, backend.open(source, 0), options));
+                cout << "   Tokens are lexed on demand as the parser reads them." << endl;
+            }
         
-        cout << "\n2 Syntactic Analysis (Parsing)" << endl;
-        Parser parser(tokens);
-        ast_root = parser.parse_program();
-        cout << "   Parsing complete. AST generated." << endl;
+            cout << "\n2 Syntactic Analysis (Parsing)" << endl;
+            // With --jobs function bodies are parsed on the pool as well.
+            size_t tokens_read;
+            if (pool) {
+                ParallelParser parser(*input, ast_arena, *pool, parser_options);
+                ast_root = parser.parse_program();
+                syntax_errors = parser.diagnostics();
+                tokens_read = parser.tokens_read();
+            } else {
+                Parser parser(*input, ast_arena, parser_options);
+                ast_root = parser.parse_program();
+                syntax_errors = parser.diagnostics();
+                tokens_read = parser.tokens_read();
+            }
+            cout << "   Parsing complete. AST generated. " << tokens_read + 1 << " tokens lexed." << endl;
+            // The later passes skip bodies that were not parsed.
+            if (parser_options.lazy_bodies) cout << "   Function bodies were kept as tokens, not parsed." << endl;
+            bool early_errors = report_early_errors(input.get());
+            // Syntax errors do not stop analysis: the statements that failed to
+            // parse are ErrorStatements, which the later passes skip.
+            if (!syntax_errors.empty()) {
+                cerr << "\nPARSE ERRORS" << endl;
+                for (const ParseDiagnostic& diagnostic : syntax_errors) cerr << "Error: " << diagnostic.message << endl;
+                cout << "   " << syntax_errors.size() << " syntax error(s); the rest of the file is analyzed." << endl;
+            }
+            if (early_errors) return 1;
+            // Only a tree parsed without errors is cached.
+            if (!cache_path.empty() && syntax_errors.empty() &&
+                !write_ast_cache(cache_path, key, *ast_root, sources, input->files_read())) {
+                cerr << "Warning: could not write the AST cache " << cache_path << endl;
+            }
+        }
         
         cout << "\n3.Scope analysis" << endl;
-        ScopeAnalyzer scope_analyzer;
+        ScopeAnalyzer scope_analyzer(sources);
         scope_analyzer.analyze(ast_root);
         global_scope = scope_analyzer.global_scope;
         cout << "   Scope analysis complete. No redefinition or undeclared symbol errors found." << endl;
 
     
         cout << "\n4. Type Checking" << endl;
-        TypeChecker type_checker(global_scope);
+        TypeChecker type_checker(global_scope, sources);
         type_checker.check(ast_root);
         cout << "   Type checking complete. No type errors found." << endl;
+        if (!syntax_errors.empty()) {
+            delete global_scope;
+            return 1;
+        }
 
-        cout << "\nAbstract Syntax Tree" << endl;
-        if (ast_root) {
-            ast_root->print(0);
+        if (dump.fd >= 0 && ast_root) {
+            // endl flushes what cout holds before the dump goes to the same
+            // descriptor.
+            if (dump.path.empty()) cout << "\nAbstract Syntax Tree" << endl;
+            else cout << "\nAbstract Syntax Tree written to " << dump.path << endl;
+            OutputBuffer out(dump.fd);
+            AstDumper(sources, out, dump.format).dump(ast_root);
+            out.flush();
+            if (!out.ok()) cerr << "Warning: could not write the AST dump" << endl;
         }
 
     }
-    catch (const ParseError& e) {
-        cerr << "\nPARSE ERROR " << endl;
-        cerr << "Error: " << e.what() << endl;
-        if(global_scope) delete global_scope;
-        if(ast_root) delete ast_root;
-        return 1;
-    } 
     catch (const ScopeError& e) {
         cerr << "\nSCOPE ERROR " << endl;
         cerr << "Error: " << e.what() << endl;
         if(global_scope) delete global_scope;
-        if(ast_root) delete ast_root;
         return 1;
     } 
     catch (const TypeError& e) { 
         cerr << "\nTYPE ERROR " << endl;
         cerr << "Error: " << e.what() << endl;
         if(global_scope) delete global_scope;
-        if(ast_root) delete ast_root;
         return 1;
     }
     catch (const std::exception& e) {
         cerr << "\nGENERAL ERROR" << endl;
         cerr << "An unexpected error occurred: " << e.what() << endl;
         if(global_scope) delete global_scope;
-        if(ast_root) delete ast_root;
         return 1;
     }
 
     delete global_scope;
-    delete ast_root;
 
     cout << "\nCompilation successful" << endl;
 
     return 0;
+}
+
+static void print_usage(const char* program) {
+    cerr << "Usage: " << program << " [--jobs N] [--lexer NAME] [--max-nesting N] [--signatures-only] [--cache DIR]"
+         << " [--dump-ast[=text|json|sexpr]] [--dump-to FILE] [-I DIR]... <source_file.c | ->..." << endl;
+    cerr << "Lexers:" << endl;
+    for (const LexerBackend* backend : lexer_backends()) cerr << "  " << backend->name << "  " << backend->description << endl;
+}
+
+// Reads the value of a numeric option such as --jobs. Anything but a whole
+// non-negative decimal number is rejected.
+static bool parse_count(const char* text, size_t& value) {
+    char* end;
+    errno = 0;
+    unsigned long long n = strtoull(text, &end, 10);
+    if (!isdigit((unsigned char)text[0]) || *end || errno == ERANGE || n > SIZE_MAX) return false;
+    value = (size_t)n;
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    vector<string> filenames;
+    string lexer_name = lexer_backends().front()->name;
+    PreprocessorOptions options;
+    ParserOptions parser_options;
+    size_t jobs = 1;
+    string cache_dir;
+    DumpOptions dump;
+    string dump_format;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--jobs" && i + 1 < argc) {
+            if (!parse_count(argv[++i], jobs)) {
+                cerr << "Invalid value '" << argv[i] << "' for --jobs" << endl;
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (arg == "--lexer" && i + 1 < argc) lexer_name = argv[++i];
+        else if (arg == "--max-nesting" && i + 1 < argc) {
+            if (!parse_count(argv[++i], parser_options.max_nesting)) {
+                cerr << "Invalid value '" << argv[i] << "' for --max-nesting" << endl;
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (arg == "--signatures-only") parser_options.lazy_bodies = true;
+        else if (arg == "--cache" && i + 1 < argc) cache_dir = argv[++i];
+        else if (arg == "--dump-ast") dump_format = "text";
+        else if (arg.compare(0, 11, "--dump-ast=") == 0) dump_format = arg.substr(11);
+        else if (arg == "--dump-to" && i + 1 < argc) dump.path = argv[++i];
+        else if (arg == "-I" && i + 1 < argc) options.include_paths.push_back(argv[++i]);
+        else if (arg.size() > 2 && arg.compare(0, 2, "-I") == 0) options.include_paths.push_back(arg.substr(2));
+        else filenames.push_back(arg);
+    }
+    if (filenames.empty()) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    try {
+        options.backend = &lexer_backend(lexer_name);
+    } catch (const std::exception& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+    if (dump_format.empty() && !dump.path.empty()) dump_format = "text";
+    if (!dump_format.empty()) {
+        if (dump_format == "text") dump.format = DumpFormat::Text;
+        else if (dump_format == "json") dump.format = DumpFormat::Json;
+        else if (dump_format == "sexpr") dump.format = DumpFormat::SExpression;
+        else {
+            cerr << "Unknown AST dump format '" << dump_format << "' (text, json or sexpr)" << endl;
+            return 1;
+        }
+        dump.fd = 1;
+        if (!dump.path.empty()) {
+            dump.fd = open(dump.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (dump.fd < 0) {
+                cerr << "Cannot open " << dump.path << " for the AST dump" << endl;
+                return 1;
+            }
+        }
+    }
+
+    SourceManager sources;
+    HeaderCache headers(sources);
+    unique_ptr<ThreadPool> pool;
+    if (jobs != 1) pool.reset(new ThreadPool(jobs));
+    int status = 0;
+    for (size_t i = 0; i < filenames.size(); i++) {
+        if (i > 0) cout << endl;
+        status = max(status, compile(filenames[i], sources, headers, options, parser_options, pool.get(), cache_dir, dump));
+    }
+    if (filenames.size() > 1) {
+        cout << "\n" << filenames.size() << " files, " << headers.lexed << " header(s) lexed, " << headers.replayed
+             << " replayed from the header cache, " << headers.skipped << " skipped by include guards or #pragma once" << endl;
+    }
+    if (dump.fd > 1) close(dump.fd);
+    return status;
 }
\ No newline at end of file
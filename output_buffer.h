@@ -0,0 +1,96 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <string_view>
+#include <unistd.h>
+
+// Collects output in large blocks and hands each full block to a file
+// descriptor with one write(2), or to an ostream with one write(). Nothing
+// is flushed per line; what is left goes out on flush() or destruction.
+class OutputBuffer {
+public:
+    explicit OutputBuffer(int fd) : fd(fd), data(new char[BlockSize]) {}
+    explicit OutputBuffer(std::ostream& stream) : stream(&stream), data(new char[BlockSize]) {}
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(const OutputBuffer&) = delete;
+    ~OutputBuffer() { flush(); }
+
+    void write(std::string_view text) {
+        if (text.size() > BlockSize - used) {
+            flush();
+            // Too big to be worth copying: it goes out as it is.
+            if (text.size() >= BlockSize) {
+                send(text.data(), text.size());
+                return;
+            }
+        }
+        memcpy(data.get() + used, text.data(), text.size());
+        used += text.size();
+    }
+
+    void put(char c) {
+        if (used == BlockSize) flush();
+        data[used++] = c;
+    }
+
+    void spaces(size_t count) {
+        while (count > 0) {
+            if (used == BlockSize) flush();
+            size_t n = std::min(count, BlockSize - used);
+            memset(data.get() + used, ' ', n);
+            used += n;
+            count -= n;
+        }
+    }
+
+    void number(uint64_t value) {
+        char digits[20];
+        size_t n = 0;
+        do {
+            digits[sizeof(digits) - ++n] = char('0' + value % 10);
+            value /= 10;
+        } while (value);
+        write(std::string_view(digits + sizeof(digits) - n, n));
+    }
+
+    void flush() {
+        send(data.get(), used);
+        used = 0;
+    }
+
+    // Whether everything written so far went through. After a failed write
+    // the rest of the output is dropped.
+    bool ok() const { return !failed; }
+
+private:
+    static constexpr size_t BlockSize = 256 << 10;
+
+    int fd = -1;
+    std::ostream* stream = nullptr;
+    std::unique_ptr<char[]> data;
+    size_t used = 0;
+    bool failed = false;
+
+    void send(const char* bytes, size_t size) {
+        if (failed || size == 0) return;
+        if (stream) {
+            failed = !stream->write(bytes, size);
+            return;
+        }
+        while (size > 0) {
+            ssize_t written = ::write(fd, bytes, size);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                failed = true;
+                return;
+            }
+            bytes += written;
+            size -= written;
+        }
+    }
+};
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "tokens.h"
+#include "arena.h"
+#include "ast.h"
+#include "parser.h"
+#include "thread_pool.h"
+
+// Parses a file like Parser does, with function bodies parsed on a thread
+// pool. As the tokens are read they are split after each top-level
+// declaration by matching braces, and every run of a few thousand tokens is
+// queued on the pool as a program of its own while reading goes on. Idle
+// workers take the next run in the queue, and each run is parsed into one
+// of a set of arenas no two workers use at once. Those arenas are handed to
+// `arena` at the end and the runs' declarations joined in source order.
+//
+// If any run has a syntax error, or the braces do not balance, the whole
+// file is parsed again on this thread, so errors and recovery are exactly
+// those of Parser.
+class ParallelParser {
+public:
+    ParallelParser(TokenSource& input, Arena& arena, ThreadPool& pool, const ParserOptions& options = ParserOptions())
+        : input(input), arena(arena), pool(pool), options(options) {}
+
+    Program* parse_program() {
+        try {
+            read_runs();
+        } catch (...) {
+            pool.wait();
+            throw;
+        }
+        pool.wait();
+
+        bool failed = !balanced;
+        for (const Run& run : runs) failed |= !run.program;
+        if (!failed) return join();
+
+        vector<Token> tokens;
+        for (const Run& run : runs) tokens.insert(tokens.end(), run.tokens.begin(), run.tokens.end());
+        TokenSlice all(input, tokens.data(), tokens.data() + tokens.size(), eof);
+        Parser parser(all, arena, options);
+        Program* program = parser.parse_program();
+        problems = parser.diagnostics();
+        return program;
+    }
+
+    const vector<ParseDiagnostic>& diagnostics() const { return problems; }
+    // Tokens consumed, not counting the final T_EOF, as Parser counts them.
+    size_t tokens_read() const { return read; }
+
+private:
+    // Enough tokens for the parse to outweigh queueing it.
+    static constexpr size_t RunTokens = 4096;
+
+    // Consecutive top-level declarations. `program` stays NULL if they do
+    // not parse.
+    struct Run {
+        vector<Token> tokens;
+        Program* program = NULL;
+    };
+
+    TokenSource& input;
+    Arena& arena;
+    ThreadPool& pool;
+    ParserOptions options;
+    deque<Run> runs;
+    Token eof;
+    size_t read = 0;
+    bool balanced = true;
+    vector<ParseDiagnostic> problems;
+
+    mutex arenas_mutex;
+    vector<unique_ptr<Arena>> arenas;
+    vector<Arena*> idle_arenas;
+
+    // Reads every token, queueing runs as they fill. A declaration ends with
+    // the ';' of a global or the '}' that closes a function body; once the
+    // parentheses and braces have failed to balance nothing more is queued.
+    void read_runs() {
+        size_t depth = 0;
+        runs.emplace_back();
+        for (Token token = input.next(); ; token = input.next()) {
+            if (token.type == T_INVALID) continue;
+            if (token.type == T_EOF) {
+                eof = token;
+                break;
+            }
+            read++;
+            runs.back().tokens.push_back(token);
+            bool ends = false;
+            if (token.type == T_PARENL || token.type == T_BRACEL) {
+                depth++;
+            } else if (token.type == T_PARENR || token.type == T_BRACER) {
+                if (depth == 0) balanced = false;
+                else ends = --depth == 0 && token.type == T_BRACER;
+            } else if (token.type == T_SEMICOLON) {
+                ends = depth == 0;
+            }
+            if (ends && balanced && runs.back().tokens.size() >= RunTokens) {
+                queue(runs.back());
+                runs.emplace_back();
+            }
+        }
+        if (depth != 0) balanced = false;
+        if (balanced) queue(runs.back());
+    }
+
+    // A run ends where its last declaration does. The T_EOF it sees there is
+    // never reported: if the run has errors the file is parsed again anyway.
+    // Jobs must not throw, so a run that fails any other way, such as running
+    // out of memory, is left without a program as well; the sequential parse
+    // then throws on this thread if the failure happens again.
+    void queue(Run& run) {
+        pool.submit([this, &run] {
+            Arena* local = NULL;
+            try {
+                const Token* begin = run.tokens.data();
+                const Token* end = begin + run.tokens.size();
+                local = take_arena();
+                TokenSlice slice = run.tokens.empty() ? TokenSlice(input, begin, end, eof) : TokenSlice(input, begin, end);
+                Parser parser(slice, *local, options);
+                Program* program = parser.parse_program();
+                if (parser.diagnostics().empty()) run.program = program;
+            } catch (...) {
+                run.program = NULL;
+            }
+            if (local) put_arena(local);
+        });
+    }
+
+    Arena* take_arena() {
+        lock_guard<mutex> lock(arenas_mutex);
+        if (idle_arenas.empty()) {
+            // Room for every arena to be idle, so put_arena() cannot throw.
+            idle_arenas.reserve(arenas.size() + 1);
+            arenas.emplace_back(new Arena);
+            return arenas.back().get();
+        }
+        Arena* local = idle_arenas.back();
+        idle_arenas.pop_back();
+        return local;
+    }
+
+    void put_arena(Arena* local) {
+        lock_guard<mutex> lock(arenas_mutex);
+        idle_arenas.push_back(local);
+    }
+
+    Program* join() {
+        for (unique_ptr<Arena>& local : arenas) arena.adopt(*local);
+        vector<FunctionDeclaration*> functions;
+        vector<VariableDeclarationStatement*> globals;
+        for (const Run& run : runs) {
+            functions.insert(functions.end(), run.program->functions.begin(), run.program->functions.end());
+            globals.insert(globals.end(), run.program->globals.begin(), run.program->globals.end());
+        }
+        return arena.make<Program>(arena.copy(functions), arena.copy(globals));
+    }
+};
@@ -1,58 +1,209 @@
 #pragma once
 
+#include <string>
 #include <vector>
-#include <stdexcept>
 #include "tokens.h" 
+#include "arena.h"
 #include "ast.h"
 
 enum class ParseErrorType { 
     UnexpectedEOF, FailedToFindToken, ExpectedTypeSpecifier, ExpectedIdentifier, 
     UnexpectedToken, ExpectedExpression, ExpectedSemicolonAfterStatement, 
     ExpectedLeftParenAfterKeyword, ExpectedRightParenAfterCondition, InvalidAssignmentTarget, 
-    ExpectedLeftBraceForBody, ExpectedToken
+    ExpectedLeftBraceForBody, ExpectedToken, NestingTooDeep
 };
 
-class ParseError : public std::runtime_error {
-public:
+// A syntax error. The parser records it, skips ahead to a point it can
+// resume from and goes on, so one run reports every error in the file.
+struct ParseDiagnostic {
     ParseErrorType type;
-    ParseError(ParseErrorType t, const string& message) : runtime_error(message), type(t) {}
+    SourceLocation loc;
+    string message;
+};
+
+// Binary operator precedence, lowest to highest as in C. Assignments are
+// right associative and take an identifier on the left; the rest are left
+// associative. Unary operators and calls bind tighter than all of them.
+enum Precedence : uint8_t {
+    NotBinary, Assign, LogicalOr, LogicalAnd, BitwiseOr, BitwiseXor, BitwiseAnd,
+    Equality, Comparison, Shift, Term, Factor
+};
+
+struct BinaryPrecedence {
+    uint8_t of[T_INVALID + 1] = {};
+
+    constexpr BinaryPrecedence() {
+        for (TokenType t : { T_OP_ASSIGN, T_OP_PLUS_ASSIGN, T_OP_MINUS_ASSIGN, T_OP_MUL_ASSIGN, T_OP_DIV_ASSIGN,
+                             T_OP_MOD_ASSIGN, T_OP_LSHIFT_ASSIGN, T_OP_RSHIFT_ASSIGN, T_OP_AND_ASSIGN,
+                             T_OP_OR_ASSIGN, T_OP_XOR_ASSIGN }) of[t] = Assign;
+        of[T_OP_LOGICAL_OR] = LogicalOr;
+        of[T_OP_LOGICAL_AND] = LogicalAnd;
+        of[T_OP_OR] = BitwiseOr;
+        of[T_OP_XOR] = BitwiseXor;
+        of[T_OP_AND] = BitwiseAnd;
+        of[T_OP_EQ] = of[T_OP_NEQ] = Equality;
+        of[T_OP_LT] = of[T_OP_GT] = of[T_OP_LE] = of[T_OP_GE] = Comparison;
+        of[T_OP_LSHIFT] = of[T_OP_RSHIFT] = Shift;
+        of[T_OP_PLUS] = of[T_OP_MINUS] = Term;
+        of[T_OP_MUL] = of[T_OP_DIV] = of[T_OP_MOD] = Factor;
+    }
+
+    constexpr uint8_t operator[](TokenType type) const { return of[type]; }
+};
+
+constexpr BinaryPrecedence binary_precedence;
+
+// The Operator a token stands for after an operand (a binary operator, or
+// the one a compound assignment applies) and before one (a prefix operator).
+struct TokenOperators {
+    Operator binary[T_INVALID + 1] = {};
+    Operator unary[T_INVALID + 1] = {};
+
+    constexpr TokenOperators() {
+        binary[T_OP_ASSIGN] = Operator::Assign;
+        binary[T_OP_PLUS] = binary[T_OP_PLUS_ASSIGN] = Operator::Add;
+        binary[T_OP_MINUS] = binary[T_OP_MINUS_ASSIGN] = Operator::Subtract;
+        binary[T_OP_MUL] = binary[T_OP_MUL_ASSIGN] = Operator::Multiply;
+        binary[T_OP_DIV] = binary[T_OP_DIV_ASSIGN] = Operator::Divide;
+        binary[T_OP_MOD] = binary[T_OP_MOD_ASSIGN] = Operator::Modulo;
+        binary[T_OP_LSHIFT] = binary[T_OP_LSHIFT_ASSIGN] = Operator::ShiftLeft;
+        binary[T_OP_RSHIFT] = binary[T_OP_RSHIFT_ASSIGN] = Operator::ShiftRight;
+        binary[T_OP_AND] = binary[T_OP_AND_ASSIGN] = Operator::BitAnd;
+        binary[T_OP_OR] = binary[T_OP_OR_ASSIGN] = Operator::BitOr;
+        binary[T_OP_XOR] = binary[T_OP_XOR_ASSIGN] = Operator::BitXor;
+        binary[T_OP_LOGICAL_AND] = Operator::LogicalAnd;
+        binary[T_OP_LOGICAL_OR] = Operator::LogicalOr;
+        binary[T_OP_EQ] = Operator::Equal;
+        binary[T_OP_NEQ] = Operator::NotEqual;
+        binary[T_OP_LT] = Operator::Less;
+        binary[T_OP_GT] = Operator::Greater;
+        binary[T_OP_LE] = Operator::LessEqual;
+        binary[T_OP_GE] = Operator::GreaterEqual;
+        unary[T_OP_NOT] = Operator::Not;
+        unary[T_OP_MINUS] = Operator::Negate;
+        unary[T_OP_BITWISENOT] = Operator::BitNot;
+        unary[T_OP_INC] = Operator::Increment;
+        unary[T_OP_DEC] = Operator::Decrement;
+    }
+};
+
+constexpr TokenOperators token_operators;
+
+struct ParserOptions {
+    // How deep blocks, statement bodies, parentheses, call arguments and
+    // operators waiting for their right operand may nest before the parser
+    // reports NestingTooDeep and skips what lies deeper.
+    size_t max_nesting = 256;
+    // Keep each function body as its tokens, found by matching braces,
+    // instead of parsing it; a BodyParser parses them when asked.
+    bool lazy_bodies = false;
 };
 
 class Parser {
 public:
-    Parser(const vector<Token>& tokens) : tokens(tokens), current(0) {}
+    // Tokens are pulled from `input` as parsing needs them. The tree is built
+    // in `arena` and lives as long as it does.
+    Parser(TokenSource& input, Arena& arena, const ParserOptions& options = ParserOptions())
+        : tokens(input), arena(arena), options(options) {}
 
+    // Declarations that fail to parse are left out of the Program; every
+    // error is in diagnostics().
     Program* parse_program() {
-        Program* program = new Program();
+        vector<FunctionDeclaration*> functions;
+        vector<VariableDeclarationStatement*> globals;
         while (!is_at_end()) {
-            int line = peek().line;
+            size_t start = tokens.position();
+            SourceLocation loc = location_of(peek());
             if (!is_type_specifier()) {
-                 throw ParseError(ParseErrorType::ExpectedTypeSpecifier, 
-                    "Expected a type specifier for top-level declaration at line " + to_string(line));
+                error(ParseErrorType::ExpectedTypeSpecifier, "Expected a type specifier for top-level declaration");
+                skip_declaration(start);
+                continue;
             }
-            string type = advance().lexeme;
-            Token name_token = consume(T_IDENTIFIER, ParseErrorType::ExpectedIdentifier, "Expected identifier for declaration");
-            string name = name_token.lexeme;
+            Type type = type_of(advance());
+            if (!expect(T_IDENTIFIER, ParseErrorType::ExpectedIdentifier, "Expected identifier for declaration")) {
+                skip_declaration(start);
+                continue;
+            }
+            SymbolID name = previous().symbol;
             if (check(T_PARENL)) {
-                program->functions.push_back(finish_parse_function(type, name, line));
+                FunctionDeclaration* function = finish_parse_function(type, name, loc);
+                if (function) functions.push_back(function);
+                else skip_declaration(start);
             } else if (check(T_OP_ASSIGN) || check(T_SEMICOLON)) {
-                program->globals.push_back(finish_parse_variable(type, name, line));
+                VariableDeclarationStatement* global = finish_parse_variable(type, name, loc, start);
+                if (global) globals.push_back(global);
+                else skip_declaration(start);
             } else {
-                consume(T_PARENL, ParseErrorType::FailedToFindToken, "Expected '(' for function declaration or '=' or ';' for variable declaration");
+                error(ParseErrorType::FailedToFindToken, "Expected '(' for function declaration or '=' or ';' for variable declaration");
+                skip_declaration(start);
             }
         }
-        return program;
+        return arena.make<Program>(arena.copy(functions), arena.copy(globals));
     }
 
+    // One block, '{' to '}', such as a body kept by lazy_bodies.
+    BlockStatement* parse_body() { return parse_block_statement(); }
+
+    const vector<ParseDiagnostic>& diagnostics() const { return problems; }
+
+    // Tokens consumed so far, not counting the lookahead.
+    size_t tokens_read() const { return tokens.position(); }
+
 private:
-    const vector<Token>& tokens;
-    size_t current;
-
-    bool is_at_end() { return peek().type == T_EOF; }
-    Token peek() { return tokens[current]; }
-    Token previous() { return tokens[current - 1]; }
-    Token advance() { if (!is_at_end()) current++; return previous(); }
-    bool check(TokenType type) { if (is_at_end()) return false; return peek().type == type; }
+    // A block or statement body still being parsed, innermost last.
+    enum class Awaiting : uint8_t { BlockItem, ThenBranch, ElseBranch, WhileBody, ForBody };
+    struct StatementFrame {
+        Awaiting awaiting;
+        SourceLocation loc;
+        // How deep this frame nests, counted against options.max_nesting.
+        size_t level;
+        // Blocks: where their statements start on statement_stack, and the
+        // first token and location of the statement being parsed in them.
+        size_t mark = 0;
+        size_t start = 0;
+        SourceLocation statement_loc = 0;
+        Statement* initializer = NULL;
+        Expression* condition = NULL;
+        Expression* increment = NULL;
+        Statement* then_branch = NULL;
+        StatementFrame(Awaiting awaiting, SourceLocation loc, size_t level) : awaiting(awaiting), loc(loc), level(level) {}
+    };
+
+    // An operator, '(' or call waiting for an operand. Binary operators and
+    // assignments keep the least precedence an operator after their right
+    // operand must have to belong to it.
+    enum class Pending : uint8_t { Unary, Binary, Assign, Paren, Call };
+    struct PendingOperator {
+        Pending kind;
+        int min_precedence;
+        Operator op;
+        SourceLocation loc;
+        // Calls: the callee, and where the arguments start on `operands`.
+        SymbolID callee;
+        size_t mark;
+    };
+
+    TokenWindow tokens;
+    Arena& arena;
+    ParserOptions options;
+    // Nesting is kept on these stacks rather than the call stack, so it is
+    // bounded by options.max_nesting. Each block's statements and each
+    // call's arguments are gathered above a mark and then copied into the
+    // arena.
+    vector<StatementFrame> frames;
+    vector<Statement*> statement_stack;
+    vector<PendingOperator> operators;
+    vector<Expression*> operands;
+    vector<ParseDiagnostic> problems;
+    vector<Token> body_tokens;
+
+    bool is_at_end() { return tokens.peek().type == T_EOF; }
+    Token peek() { return tokens.peek(); }
+    Token previous() { return tokens.previous(); }
+    Token advance() { if (!is_at_end()) tokens.advance(); return previous(); }
+    bool check(TokenType type) { if (is_at_end()) return false; return tokens.peek().type == type; }
+    SourceLocation location_of(const Token& token) { return tokens.location(token); }
+    string describe(const Token& token) { return tokens.describe(token); }
     
     bool match(TokenType type) {
         if (check(type)) {
@@ -62,277 +213,487 @@ private:
         return false;
     }
     
-    Token consume(TokenType type, ParseErrorType err_type, const string& message) {
-        if (check(type)) return advance();
+    // Records an error at the current token. The parse functions then return
+    // NULL up to the nearest statement or declaration, which skips ahead.
+    void error(ParseErrorType type, const string& message) {
         if (is_at_end()) {
-            throw ParseError(ParseErrorType::UnexpectedEOF, message + " (unexpected end of file)");
+            problems.push_back(ParseDiagnostic{ParseErrorType::UnexpectedEOF, location_of(peek()), message + " (unexpected end of file)"});
+        } else {
+            problems.push_back(ParseDiagnostic{type, location_of(peek()), message + " at " + describe(peek())});
+        }
+    }
+
+    // Consumes a `type` token, or records an error and returns false.
+    bool expect(TokenType type, ParseErrorType err_type, const string& message) {
+        if (match(type)) return true;
+        error(err_type, message);
+        return false;
+    }
+
+    bool starts_statement() {
+        TokenType t = tokens.peek().type;
+        return t == T_KW_IF || t == T_KW_WHILE || t == T_KW_FOR || t == T_KW_RETURN || t == T_KW_BREAK ||
+               t == T_KW_CONTINUE || t == T_BRACEL || is_type_specifier();
+    }
+
+    // Panic mode for a broken statement that began at token `start`: skips
+    // through the next ';', or up to a '}' or the start of another statement.
+    void skip_statement(size_t start) {
+        while (!is_at_end()) {
+            if (tokens.position() > start && (check(T_BRACER) || starts_statement())) return;
+            if (match(T_SEMICOLON)) return;
+            advance();
+        }
+    }
+
+    // Panic mode for a broken top-level declaration: skips to the next type
+    // specifier outside parentheses and braces, passing over the rest of a
+    // parameter list and any function body on the way.
+    void skip_declaration(size_t start) {
+        int depth = 0;
+        while (!is_at_end()) {
+            if (depth == 0 && tokens.position() > start && is_type_specifier()) return;
+            if (check(T_BRACEL) || check(T_PARENL)) depth++;
+            if ((check(T_BRACER) || check(T_PARENR)) && depth > 0) depth--;
+            advance();
         }
-        throw ParseError(err_type, message + " at line " + to_string(peek().line));
     }
 
     bool is_type_specifier() {
-        TokenType t = peek().type;
-        if (t == T_IDENTIFIER && peek().lexeme == "string") return true; 
+        const Token& token = tokens.peek();
+        TokenType t = token.type;
+        if (t == T_IDENTIFIER && token.lexeme == "string") return true; 
         return t==T_KW_VOID || t==T_KW_CHAR || t==T_KW_INT || t==T_KW_FLOAT || t==T_KW_DOUBLE || t==T_KW_BOOL || t==T_KW_AUTO;
     }
 
-    FunctionDeclaration* finish_parse_function(string returnType, string name, int line) {
-        consume(T_PARENL, ParseErrorType::FailedToFindToken, "Expected '(' after function name");
+    // The type a token accepted by is_type_specifier() names.
+    static Type type_of(const Token& token) {
+        switch (token.type) {
+            case T_KW_VOID: return Type::Void;
+            case T_KW_CHAR: return Type::Char;
+            case T_KW_INT: return Type::Int;
+            case T_KW_FLOAT: return Type::Float;
+            case T_KW_DOUBLE: return Type::Double;
+            case T_KW_BOOL: return Type::Bool;
+            case T_KW_AUTO: return Type::Auto;
+            default: return Type::String;
+        }
+    }
+
+    FunctionDeclaration* finish_parse_function(Type returnType, SymbolID name, SourceLocation loc) {
+        if (!expect(T_PARENL, ParseErrorType::FailedToFindToken, "Expected '(' after function name")) return NULL;
         vector<Parameter> params;
         if (!check(T_PARENR)) {
             do {
                 if (!is_type_specifier()) {
-                    throw ParseError(ParseErrorType::ExpectedTypeSpecifier, "Expected parameter type.");
+                    error(ParseErrorType::ExpectedTypeSpecifier, "Expected parameter type");
+                    return NULL;
                 }
-                string param_type = advance().lexeme;
-                Token param_name = consume(T_IDENTIFIER, ParseErrorType::ExpectedIdentifier, "Expected parameter name");
-                params.push_back(Parameter(param_type, param_name.lexeme, param_name.line));
+                Type param_type = type_of(advance());
+                if (!expect(T_IDENTIFIER, ParseErrorType::ExpectedIdentifier, "Expected parameter name")) return NULL;
+                params.push_back(Parameter(param_type, previous().symbol, location_of(previous())));
             } while (match(T_COMMA));
         }
-        consume(T_PARENR, ParseErrorType::FailedToFindToken, "Expected ')' after parameters");
+        if (!expect(T_PARENR, ParseErrorType::FailedToFindToken, "Expected ')' after parameters")) return NULL;
+        if (options.lazy_bodies && check(T_BRACEL)) {
+            return arena.make<FunctionDeclaration>(returnType, name, arena.copy(params), (BlockStatement*)NULL, loc, skip_body());
+        }
         BlockStatement* body = parse_block_statement();
-        return new FunctionDeclaration(returnType, name, params, body, line);
+        if (!body) return NULL;
+        return arena.make<FunctionDeclaration>(returnType, name, arena.copy(params), body, loc);
     }
     
-    VariableDeclarationStatement* finish_parse_variable(string type, string name, int line) {
+    // The tokens from '{' to the matching '}', or to the end of the input
+    // if there is none, for the body to be parsed later.
+    ArenaArray<Token> skip_body() {
+        body_tokens.clear();
+        size_t depth = 0;
+        do {
+            if (check(T_BRACEL)) depth++;
+            else if (check(T_BRACER)) depth--;
+            body_tokens.push_back(advance());
+        } while (depth > 0 && !is_at_end());
+        return arena.copy(body_tokens);
+    }
+    
+    // A broken initializer still declares the variable, so later uses of it
+    // are not reported as undeclared; the initializer is an ErrorExpression.
+    VariableDeclarationStatement* finish_parse_variable(Type type, SymbolID name, SourceLocation loc, size_t start) {
         Expression* initializer = NULL;
         if (match(T_OP_ASSIGN)) {
             initializer = parse_expression();
+            if (!initializer) {
+                skip_statement(start);
+                return arena.make<VariableDeclarationStatement>(type, name, arena.make<ErrorExpression>(loc), loc);
+            }
         }
-        consume(T_SEMICOLON, ParseErrorType::ExpectedSemicolonAfterStatement, "Expected ';' after variable declaration");
-        return new VariableDeclarationStatement(type, name, initializer, line);
-    }
-
-    Statement* parse_statement() {
-        int line = peek().line;
-        if (match(T_KW_IF)) return parse_if_statement(line);
-        if (match(T_KW_WHILE)) return parse_while_statement(line);
-        if (match(T_KW_FOR)) return parse_for_statement(line);
-        if (match(T_KW_RETURN)) return parse_return_statement(line);
-        if (match(T_KW_BREAK)) return parse_break_statement(line);
-        if (match(T_KW_CONTINUE)) return parse_continue_statement(line);
-        if (check(T_BRACEL)) return parse_block_statement();
-        if (is_type_specifier()) {
-            return parse_variable_declaration_statement();
-        }
-        return parse_expression_statement();
+        if (!expect(T_SEMICOLON, ParseErrorType::ExpectedSemicolonAfterStatement, "Expected ';' after variable declaration")) return NULL;
+        return arena.make<VariableDeclarationStatement>(type, name, initializer, loc);
     }
-    
+
     Statement* parse_variable_declaration_statement() {
-        int line = peek().line;
-        string type = advance().lexeme;
-        Token name_token = consume(T_IDENTIFIER, ParseErrorType::ExpectedIdentifier, "Expected variable name");
-        return finish_parse_variable(type, name_token.lexeme, line);
+        size_t start = tokens.position();
+        SourceLocation loc = location_of(peek());
+        Type type = type_of(advance());
+        if (!expect(T_IDENTIFIER, ParseErrorType::ExpectedIdentifier, "Expected variable name")) return NULL;
+        return finish_parse_variable(type, previous().symbol, loc, start);
     }
 
     ExpressionStatement* parse_expression_statement() {
-        int line = peek().line;
+        SourceLocation loc = location_of(peek());
         Expression* expr = parse_expression();
-        consume(T_SEMICOLON, ParseErrorType::ExpectedSemicolonAfterStatement, "Expected ';' after expression");
-        return new ExpressionStatement(expr, line);
+        if (!expr) return NULL;
+        if (!expect(T_SEMICOLON, ParseErrorType::ExpectedSemicolonAfterStatement, "Expected ';' after expression")) return NULL;
+        return arena.make<ExpressionStatement>(expr, loc);
     }
 
+    // Statements are parsed with an explicit stack of the blocks and bodies
+    // still open. A statement that fails to parse becomes an ErrorStatement
+    // in the innermost open block, which goes on after it; an if, while or
+    // for it was the body of is dropped with it. The result is only NULL when
+    // the '{' is missing.
     BlockStatement* parse_block_statement() {
-        int line = peek().line;
-        consume(T_BRACEL, ParseErrorType::ExpectedLeftBraceForBody, "Expected '{' to start a block");
-        vector<Statement*> statements;
-        while (!check(T_BRACER) && !is_at_end()) {
-            statements.push_back(parse_statement());
+        if (!check(T_BRACEL)) {
+            error(ParseErrorType::ExpectedLeftBraceForBody, "Expected '{' to start a block");
+            return NULL;
+        }
+        if (!open_block()) return NULL;
+        Statement* finished = NULL;
+        while (true) {
+            if (!finished) {
+                StatementFrame& frame = frames.back();
+                if (frame.awaiting == Awaiting::BlockItem) {
+                    if (check(T_BRACER) || is_at_end()) {
+                        expect(T_BRACER, ParseErrorType::FailedToFindToken, "Expected '}' to end a block");
+                        finished = arena.make<BlockStatement>(arena.copy(statement_stack, frame.mark), frame.loc);
+                        statement_stack.resize(frame.mark);
+                        frames.pop_back();
+                        if (frames.empty()) return static_cast<BlockStatement*>(finished);
+                        continue;
+                    }
+                    frame.start = tokens.position();
+                    frame.statement_loc = location_of(peek());
+                }
+                if (!begin_statement(finished)) finished = recover();
+                continue;
+            }
+            StatementFrame& frame = frames.back();
+            switch (frame.awaiting) {
+            case Awaiting::BlockItem:
+                statement_stack.push_back(finished);
+                finished = NULL;
+                break;
+            case Awaiting::ThenBranch:
+                if (match(T_KW_ELSE)) {
+                    frame.then_branch = finished;
+                    frame.awaiting = Awaiting::ElseBranch;
+                    finished = NULL;
+                    break;
+                }
+                finished = arena.make<IfStatement>(frame.condition, finished, (Statement*)NULL, frame.loc);
+                frames.pop_back();
+                break;
+            case Awaiting::ElseBranch:
+                finished = arena.make<IfStatement>(frame.condition, frame.then_branch, finished, frame.loc);
+                frames.pop_back();
+                break;
+            case Awaiting::WhileBody:
+                finished = arena.make<WhileStatement>(frame.condition, finished, frame.loc);
+                frames.pop_back();
+                break;
+            case Awaiting::ForBody:
+                finished = arena.make<ForStatement>(frame.initializer, frame.condition, frame.increment, finished, frame.loc);
+                frames.pop_back();
+                break;
+            }
         }
-        consume(T_BRACER, ParseErrorType::FailedToFindToken, "Expected '}' to end a block");
-        return new BlockStatement(statements, line);
     }
 
-    IfStatement* parse_if_statement(int line) {
-        consume(T_PARENL, ParseErrorType::ExpectedLeftParenAfterKeyword, "Expected '(' after 'if'");
-        Expression* condition = parse_expression();
-        consume(T_PARENR, ParseErrorType::ExpectedRightParenAfterCondition, "Expected ')' after if condition");
-        Statement* thenBranch = parse_statement();
-        Statement* elseBranch = NULL;
-        if (match(T_KW_ELSE)) {
-            elseBranch = parse_statement();
+    // Parses a statement that holds no other statement into `statement`, or
+    // opens a frame for a block, if, while or for and leaves it NULL. Returns
+    // false on a syntax error.
+    bool begin_statement(Statement*& statement) {
+        statement = NULL;
+        SourceLocation loc = location_of(peek());
+        if (check(T_BRACEL)) return open_block();
+        if (match(T_KW_IF)) return begin_if_statement(loc);
+        if (match(T_KW_WHILE)) return begin_while_statement(loc);
+        if (match(T_KW_FOR)) return begin_for_statement(loc);
+        if (match(T_KW_RETURN)) statement = parse_return_statement(loc);
+        else if (match(T_KW_BREAK)) statement = parse_break_statement(loc);
+        else if (match(T_KW_CONTINUE)) statement = parse_continue_statement(loc);
+        else if (is_type_specifier()) statement = parse_variable_declaration_statement();
+        else statement = parse_expression_statement();
+        return statement != NULL;
+    }
+
+    // Drops the frames inside the innermost block, skips the rest of the
+    // broken statement and returns the ErrorStatement that stands for it.
+    Statement* recover() {
+        while (frames.back().awaiting != Awaiting::BlockItem) frames.pop_back();
+        const StatementFrame& block = frames.back();
+        skip_statement(block.start);
+        return arena.make<ErrorStatement>(block.statement_loc);
+    }
+
+    size_t level() const { return frames.empty() ? 0 : frames.back().level; }
+
+    // An `else if` goes on at the level of the first if, so a long else-if
+    // chain does not count as nesting.
+    bool open(Awaiting awaiting, SourceLocation loc) {
+        bool else_if = awaiting == Awaiting::ThenBranch && !frames.empty() && frames.back().awaiting == Awaiting::ElseBranch;
+        size_t next = else_if ? level() : level() + 1;
+        if (next > options.max_nesting) return too_deep();
+        frames.push_back(StatementFrame(awaiting, loc, next));
+        return true;
+    }
+
+    bool open_block() {
+        if (!open(Awaiting::BlockItem, location_of(peek()))) return false;
+        advance();
+        frames.back().mark = statement_stack.size();
+        return true;
+    }
+
+    // Records NestingTooDeep at the current token and skips what is nested
+    // deeper: the bracketed group the token opens, or else the rest of the
+    // statement. Returns false, for the caller to fail with.
+    bool too_deep() {
+        error(ParseErrorType::NestingTooDeep, "Nesting deeper than " + to_string(options.max_nesting) + " levels");
+        bool group = check(T_PARENL) || check(T_BRACEL);
+        int depth = 0;
+        while (!is_at_end()) {
+            if (check(T_PARENL) || check(T_BRACEL)) {
+                depth++;
+            } else if (check(T_PARENR) || check(T_BRACER)) {
+                if (depth == 0) return false;
+                if (--depth == 0 && group) {
+                    advance();
+                    return false;
+                }
+            } else if (depth == 0 && check(T_SEMICOLON)) {
+                advance();
+                return false;
+            }
+            advance();
         }
-        return new IfStatement(condition, thenBranch, elseBranch, line);
+        return false;
+    }
+
+    bool begin_if_statement(SourceLocation loc) {
+        if (!expect(T_PARENL, ParseErrorType::ExpectedLeftParenAfterKeyword, "Expected '(' after 'if'")) return false;
+        Expression* condition = parse_expression();
+        if (!condition) return false;
+        if (!expect(T_PARENR, ParseErrorType::ExpectedRightParenAfterCondition, "Expected ')' after if condition")) return false;
+        if (!open(Awaiting::ThenBranch, loc)) return false;
+        frames.back().condition = condition;
+        return true;
     }
     
-    WhileStatement* parse_while_statement(int line) {
-        consume(T_PARENL, ParseErrorType::ExpectedLeftParenAfterKeyword, "Expected '(' after 'while'");
+    bool begin_while_statement(SourceLocation loc) {
+        if (!expect(T_PARENL, ParseErrorType::ExpectedLeftParenAfterKeyword, "Expected '(' after 'while'")) return false;
         Expression* condition = parse_expression();
-        consume(T_PARENR, ParseErrorType::ExpectedRightParenAfterCondition, "Expected ')' after while condition");
-        Statement* body = parse_statement();
-        return new WhileStatement(condition, body, line);
+        if (!condition) return false;
+        if (!expect(T_PARENR, ParseErrorType::ExpectedRightParenAfterCondition, "Expected ')' after while condition")) return false;
+        if (!open(Awaiting::WhileBody, loc)) return false;
+        frames.back().condition = condition;
+        return true;
     }
 
-    ForStatement* parse_for_statement(int line) {
-        consume(T_PARENL, ParseErrorType::ExpectedLeftParenAfterKeyword, "Expected '(' after 'for'");
+    bool begin_for_statement(SourceLocation loc) {
+        if (!expect(T_PARENL, ParseErrorType::ExpectedLeftParenAfterKeyword, "Expected '(' after 'for'")) return false;
         Statement* initializer = NULL;
         if (match(T_SEMICOLON)) { /* no initializer */ } 
-        else if (is_type_specifier()) { initializer = parse_variable_declaration_statement(); }
-        else { initializer = parse_expression_statement(); }
+        else if (is_type_specifier()) { initializer = parse_variable_declaration_statement(); if (!initializer) return false; }
+        else { initializer = parse_expression_statement(); if (!initializer) return false; }
         
         Expression* condition = NULL;
-        if (!check(T_SEMICOLON)) { condition = parse_expression(); }
-        consume(T_SEMICOLON, ParseErrorType::ExpectedSemicolonAfterStatement, "Expected ';' after loop condition");
+        if (!check(T_SEMICOLON)) { condition = parse_expression(); if (!condition) return false; }
+        if (!expect(T_SEMICOLON, ParseErrorType::ExpectedSemicolonAfterStatement, "Expected ';' after loop condition")) return false;
         
         Expression* increment = NULL;
-        if (!check(T_PARENR)) { increment = parse_expression(); }
-        consume(T_PARENR, ParseErrorType::ExpectedRightParenAfterCondition, "Expected ')' after for clauses");
+        if (!check(T_PARENR)) { increment = parse_expression(); if (!increment) return false; }
+        if (!expect(T_PARENR, ParseErrorType::ExpectedRightParenAfterCondition, "Expected ')' after for clauses")) return false;
         
-        Statement* body = parse_statement();
-        return new ForStatement(initializer, condition, increment, body, line);
+        if (!open(Awaiting::ForBody, loc)) return false;
+        frames.back().initializer = initializer;
+        frames.back().condition = condition;
+        frames.back().increment = increment;
+        return true;
     }
     
-    ReturnStatement* parse_return_statement(int line) {
+    ReturnStatement* parse_return_statement(SourceLocation loc) {
         Expression* value = NULL;
-        if (!check(T_SEMICOLON)) { value = parse_expression(); }
-        consume(T_SEMICOLON, ParseErrorType::ExpectedSemicolonAfterStatement, "Expected ';' after return value");
-        return new ReturnStatement(value, line);
+        if (!check(T_SEMICOLON)) { value = parse_expression(); if (!value) return NULL; }
+        if (!expect(T_SEMICOLON, ParseErrorType::ExpectedSemicolonAfterStatement, "Expected ';' after return value")) return NULL;
+        return arena.make<ReturnStatement>(value, loc);
     }
 
-    BreakStatement* parse_break_statement(int line) {
-        consume(T_SEMICOLON, ParseErrorType::ExpectedSemicolonAfterStatement, "Expected ';' after 'break'");
-        return new BreakStatement(line);
+    BreakStatement* parse_break_statement(SourceLocation loc) {
+        if (!expect(T_SEMICOLON, ParseErrorType::ExpectedSemicolonAfterStatement, "Expected ';' after 'break'")) return NULL;
+        return arena.make<BreakStatement>(loc);
     }
 
-    ContinueStatement* parse_continue_statement(int line) {
-        consume(T_SEMICOLON, ParseErrorType::ExpectedSemicolonAfterStatement, "Expected ';' after 'continue'");
-        return new ContinueStatement(line);
+    ContinueStatement* parse_continue_statement(SourceLocation loc) {
+        if (!expect(T_SEMICOLON, ParseErrorType::ExpectedSemicolonAfterStatement, "Expected ';' after 'continue'")) return NULL;
+        return arena.make<ContinueStatement>(loc);
     }
 
-    Expression* parse_expression() { return parse_assignment(); }
-
-    Expression* parse_assignment() {
-        Expression* expr = parse_logical_or();
-        if (match(T_OP_ASSIGN)) {
-            int line = previous().line; 
-            Expression* value = parse_assignment();
-            
-            Identifier* id = dynamic_cast<Identifier*>(expr);
-            if (id) {
-                return new Assignment(id, value, line);
+    // Precedence climbing without recursion: finished subexpressions wait on
+    // `operands`, and prefix operators, '(', calls and binary operators
+    // still missing their right operand wait on `operators`. A binary
+    // operator takes the operand after it once the next operator binds less
+    // tightly than its min_precedence: one more than its own precedence, or
+    // its own for right associative assignments.
+    Expression* parse_expression() {
+        operators.clear();
+        operands.clear();
+        bool want_operand = true;
+        while (true) {
+            if (want_operand) {
+                SourceLocation loc = location_of(peek());
+                if (check(T_OP_NOT) || check(T_OP_MINUS) || check(T_OP_BITWISENOT) || check(T_OP_INC) || check(T_OP_DEC)) {
+                    if (!push_operator(Pending::Unary, 0, token_operators.unary[peek().type], loc)) return NULL;
+                    advance();
+                    continue;
+                }
+                if (check(T_PARENL)) {
+                    if (!push_operator(Pending::Paren, 0, Operator(), loc)) return NULL;
+                    advance();
+                    continue;
+                }
+                Expression* operand = parse_primary();
+                if (!operand) return NULL;
+                operands.push_back(operand);
+                want_operand = false;
+                if (check(T_PARENL) && !open_call(want_operand)) return NULL;
+                continue;
             }
-            delete value;
-            delete expr;
-            throw ParseError(ParseErrorType::InvalidAssignmentTarget, "Invalid assignment target at line " + to_string(line));
-        }
-        return expr;
-    }
 
-    Expression* parse_logical_or() {
-        Expression* expr = parse_logical_and();
-        while (match(T_OP_OR)) {
-            int line = previous().line; 
-            string op = previous().lexeme;
-            Expression* right = parse_logical_and();
-            expr = new BinaryOperation(expr, op, right, line);
-        }
-        return expr;
-    }
+            // Prefix operators bind tighter than anything after the operand.
+            while (!operators.empty() && operators.back().kind == Pending::Unary) reduce();
+            const Token& op = tokens.peek();
+            int precedence = binary_precedence[op.type];
+            while (!operators.empty() && (operators.back().kind == Pending::Binary || operators.back().kind == Pending::Assign) &&
+                   precedence < operators.back().min_precedence) reduce();
+            if (precedence != NotBinary) {
+                SourceLocation loc = location_of(op);
+                Operator applied = token_operators.binary[op.type];
+                if (precedence == Assign) {
+                    if (operands.back()->kind != NodeKind::Identifier) {
+                        error(ParseErrorType::InvalidAssignmentTarget, "Invalid assignment target");
+                        return NULL;
+                    }
+                    if (!push_operator(Pending::Assign, Assign, applied, loc)) return NULL;
+                } else {
+                    if (!push_operator(Pending::Binary, precedence + 1, applied, loc)) return NULL;
+                }
+                advance();
+                want_operand = true;
+                continue;
+            }
+            if (operators.empty()) return operands.back();
 
-    Expression* parse_logical_and() {
-        Expression* expr = parse_equality();
-        while (match(T_OP_AND)) {
-            int line = previous().line;
-            string op = previous().lexeme;
-            Expression* right = parse_equality();
-            expr = new BinaryOperation(expr, op, right, line);
+            PendingOperator& inner = operators.back();
+            if (inner.kind == Pending::Paren) {
+                if (!expect(T_PARENR, ParseErrorType::FailedToFindToken, "Expected ')' after expression.")) return NULL;
+                operators.pop_back();
+                if (check(T_PARENL) && !open_call(want_operand)) return NULL;
+                continue;
+            }
+            // The innermost open call: another argument, or the end of the list.
+            if (match(T_COMMA)) {
+                want_operand = true;
+                continue;
+            }
+            if (!expect(T_PARENR, ParseErrorType::FailedToFindToken, "Expected ')' after arguments.")) return NULL;
+            Expression* call = arena.make<FunctionCall>(inner.callee, arena.copy(operands, inner.mark), inner.loc);
+            operands.resize(inner.mark);
+            operands.push_back(call);
+            operators.pop_back();
         }
-        return expr;
     }
 
-    Expression* parse_equality() {
-        Expression* expr = parse_comparison();
-        while (check(T_OP_EQ) || check(T_OP_NEQ)) {
-            int line = peek().line; 
+    // At a '(' right after an operand. If the operand is a name it is the
+    // callee and its arguments follow; an empty list is closed by the caller
+    // at once.
+    bool open_call(bool& want_operand) {
+        if (operands.back()->kind != NodeKind::Identifier) {
             advance();
-            string op = previous().lexeme;
-            Expression* right = parse_comparison();
-            expr = new BinaryOperation(expr, op, right, line);
+            return true;
         }
-        return expr;
+        Identifier* id = static_cast<Identifier*>(operands.back());
+        if (!push_operator(Pending::Call, 0, Operator(), id->loc)) return false;
+        advance();
+        operands.pop_back();
+        operators.back().callee = id->name;
+        operators.back().mark = operands.size();
+        want_operand = !check(T_PARENR);
+        return true;
     }
-    
-    Expression* parse_comparison() {
-        Expression* expr = parse_term();
-        while (check(T_OP_LT) || check(T_OP_GT) || check(T_OP_LE) || check(T_OP_GE)) {
-            int line = peek().line; 
-            advance();
-            string op = previous().lexeme;
-            Expression* right = parse_term();
-            expr = new BinaryOperation(expr, op, right, line);
-        }
-        return expr;
+
+    bool push_operator(Pending kind, int min_precedence, Operator op, SourceLocation loc) {
+        if (level() + operators.size() >= options.max_nesting) return too_deep();
+        operators.push_back(PendingOperator{kind, min_precedence, op, loc, 0, 0});
+        return true;
     }
 
-    Expression* parse_term() {
-        Expression* expr = parse_factor();
-        while (check(T_OP_PLUS) || check(T_OP_MINUS)) {
-            int line = peek().line;
-            advance();
-            string op = previous().lexeme;
-            Expression* right = parse_factor();
-            expr = new BinaryOperation(expr, op, right, line);
+    // Applies the operator on top of the stack to the operands it waits for.
+    void reduce() {
+        PendingOperator op = operators.back();
+        operators.pop_back();
+        Expression* right = operands.back();
+        operands.pop_back();
+        if (op.kind == Pending::Unary) {
+            operands.push_back(arena.make<UnaryOp>(op.op, right, op.loc));
+        } else if (op.kind == Pending::Assign) {
+            operands.back() = arena.make<Assignment>(static_cast<Identifier*>(operands.back()), op.op, right, op.loc);
+        } else {
+            operands.back() = arena.make<BinaryOperation>(operands.back(), op.op, right, op.loc);
         }
-        return expr;
     }
-    
-    Expression* parse_factor() {
-        Expression* expr = parse_unary();
-        while (check(T_OP_MUL) || check(T_OP_DIV) || check(T_OP_MOD)) {
-            int line = peek().line;
-            advance();
-            string op = previous().lexeme;
-            Expression* right = parse_unary();
-            expr = new BinaryOperation(expr, op, right, line);
-        }
-        return expr;
+
+    Expression* parse_primary() {
+        SourceLocation loc = location_of(peek());
+        if (match(T_INTLIT)) return arena.make<NumberLiteral>(previous().lexeme, loc);
+        if (match(T_FLOATLIT)) return arena.make<NumberLiteral>(previous().lexeme, loc);
+        if (match(T_STRINGLIT)) return arena.make<StringLiteral>(previous().lexeme, loc);
+        if (match(T_KW_TRUE)) return arena.make<BoolLiteral>(true, loc);
+        if (match(T_KW_FALSE)) return arena.make<BoolLiteral>(false, loc);
+        if (match(T_IDENTIFIER)) return arena.make<Identifier>(previous().symbol, loc);
+        error(ParseErrorType::ExpectedExpression, "Expected an expression");
+        return NULL;
     }
+};
 
-    Expression* parse_unary() {
-        if (check(T_OP_NOT) || check(T_OP_MINUS) || check(T_OP_INC) || check(T_OP_DEC)) {
-            int line = peek().line;
-            advance();
-            string op = previous().lexeme;
-            Expression* right = parse_unary();
-            return new UnaryOp(op, right, line);
-        }
-        return parse_call();
+// Parses the bodies a Parser kept as tokens under ParserOptions::lazy_bodies,
+// each the first time a later phase asks for it, into `arena`. `origin` is
+// the source that Parser read, for locations.
+class BodyParser {
+public:
+    BodyParser(const TokenSource& origin, Arena& arena, const ParserOptions& options = ParserOptions())
+        : origin(origin), arena(arena), options(options) {}
+
+    BlockStatement* body(FunctionDeclaration* function) {
+        if (function->body || function->deferred.empty()) return function->body;
+        TokenSlice slice(origin, function->deferred.begin(), function->deferred.end());
+        Parser parser(slice, arena, options);
+        function->body = parser.parse_body();
+        function->deferred = ArenaArray<Token>();
+        problems.insert(problems.end(), parser.diagnostics().begin(), parser.diagnostics().end());
+        return function->body;
     }
-    
-    Expression* parse_call() {
-        Expression* expr = parse_primary();
-        if (match(T_PARENL)) {
-            Identifier* id = dynamic_cast<Identifier*>(expr);
-            if(id) {
-                string callee_name = id->name;
-                int line = id->line;
-                delete id; 
-                vector<Expression*> args;
-                if (!check(T_PARENR)) {
-                    do { args.push_back(parse_expression()); } while (match(T_COMMA));
-                }
-                consume(T_PARENR, ParseErrorType::FailedToFindToken, "Expected ')' after arguments.");
-                return new FunctionCall(callee_name, args, line);
-            }
-        }
-        return expr;
+
+    void parse_all(Program* program) {
+        for (FunctionDeclaration* function : program->functions) body(function);
     }
 
-    Expression* parse_primary() {
-        int line = peek().line;
-        if (match(T_INTLIT)) return new NumberLiteral(previous().lexeme, line);
-        if (match(T_FLOATLIT)) return new NumberLiteral(previous().lexeme, line);
-        if (match(T_STRINGLIT)) return new StringLiteral(previous().lexeme, line);
-        if (match(T_KW_TRUE)) return new BoolLiteral(true, line);
-        if (match(T_KW_FALSE)) return new BoolLiteral(false, line);
-        if (match(T_IDENTIFIER)) return new Identifier(previous().lexeme, line);
-
-        if (match(T_PARENL)) {
-            Expression* expr = parse_expression();
-            consume(T_PARENR, ParseErrorType::FailedToFindToken, "Expected ')' after expression.");
-            return expr;
-        }
+    // The syntax errors in the bodies parsed so far.
+    const vector<ParseDiagnostic>& diagnostics() const { return problems; }
 
-        throw ParseError(ParseErrorType::ExpectedExpression, "Expected an expression at line " + to_string(peek().line));
-    }
-};
\ No newline at end of file
+private:
+    const TokenSource& origin;
+    Arena& arena;
+    ParserOptions options;
+    vector<ParseDiagnostic> problems;
+};
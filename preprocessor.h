@@ -0,0 +1,1066 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "tokens.h"
+
+// A #define. Body tokens keep the file and offset of the definition;
+// `param_of[i]` is the parameter body[i] names, or -1.
+struct Macro {
+    SymbolID name = Interner::None;
+    // T_IDENTIFIER, or the keyword the name is spelled as.
+    TokenType word = T_IDENTIFIER;
+    bool function_like = false;
+    bool variadic = false;
+    std::vector<SymbolID> params;
+    std::vector<Token> body;
+    std::vector<int> param_of;
+};
+
+// Settings shared by every file of a run.
+struct PreprocessorOptions {
+    // -I directories, searched in order after the including file's own
+    // directory for "file" and on their own for <file>.
+    std::vector<std::string> include_paths;
+    const LexerBackend* backend = &dfa_backend;
+};
+
+// A header as the preprocessor went through it, kept so the next file of the
+// run that includes it can replay it instead of lexing it again. Directives
+// are already carried out: `steps` are its text tokens (macros unexpanded,
+// nested includes inlined) and its macro table changes, in order. The result
+// holds only while every macro its directives looked at has the definition it
+// had then (null for undefined) and #pragma once files are included or not
+// as they were.
+struct CachedHeader {
+    struct Step {
+        enum Kind { Text, Define, Undefine, Once } kind;
+        Token token;
+        const Macro* macro;
+        SymbolID name;
+        std::string path;
+    };
+    std::vector<Step> steps;
+    std::vector<std::pair<SymbolID, const Macro*>> macros_read;
+    std::vector<std::pair<std::string, bool>> once_read;
+};
+
+// Preprocessed headers and what is known about them, kept for a whole run so
+// a batch of files that share headers lexes each header once. Everything
+// here points into `sources`, which must outlive the cache.
+class HeaderCache {
+public:
+    explicit HeaderCache(SourceManager& sources) : sources(sources) {}
+
+    HeaderCache(const HeaderCache&) = delete;
+    HeaderCache& operator=(const HeaderCache&) = delete;
+
+    // Headers lexed, replayed from the cache, and passed over because of an
+    // include guard or #pragma once.
+    size_t lexed = 0;
+    size_t replayed = 0;
+    size_t skipped = 0;
+
+private:
+    friend class Preprocessor;
+
+    SourceManager& sources;
+    // Definitions are never freed, so cached steps may point at them.
+    std::deque<Macro> definitions;
+    // Each way a header came out under different macros is kept.
+    std::unordered_map<std::string, std::deque<CachedHeader>> headers;
+    // The macro guarding a header's whole text, found the first time through it.
+    std::unordered_map<std::string, SymbolID> guards;
+    std::unordered_map<std::string, FileID> files;
+};
+
+// The stage between the lexer and the parser: carries out #include, #define,
+// #undef, #if/#ifdef/#ifndef/#elif/#else/#endif and #pragma once, and expands
+// macros, pulling tokens from the lexers as the parser asks for them.
+// Included files are lexed with options.backend. Problems are collected in
+// errors() and preprocessing goes on; lexical errors in the tokens it returns
+// are collected in diagnostics() as with a plain lexer.
+class Preprocessor : public TokenSource {
+public:
+    // `input` lexes `file`, the file being compiled.
+    Preprocessor(HeaderCache& cache, const SourceFile& file, std::unique_ptr<TokenSource> input,
+                 const PreprocessorOptions& options)
+        : cache(cache), sources(cache.sources), options(options), main_file(&file) {
+        Frame frame;
+        frame.file = &file;
+        frame.lexer = std::move(input);
+        frame.path = file.name();
+        frames.push_back(std::move(frame));
+    }
+
+    const SourceFile& source() const override { return *main_file; }
+
+    Token next() override {
+        Token token;
+        expand_next(token);
+        if (token.type == T_INVALID) {
+            LexDiagnostic diagnostic = invalid_token_diagnostic(sources.file(token.file), token.offset, token.lexeme);
+            diagnostic.message += in_file(token);
+            found.push_back(diagnostic);
+        }
+        return token;
+    }
+
+    SourceLocation location(const Token& token) const override {
+        return sources.file(token.file).location(token.offset);
+    }
+
+    std::string describe(const Token& token) const override {
+        return sources.file(token.file).describe(token.offset) + in_file(token);
+    }
+
+    const std::vector<LexDiagnostic>& errors() const { return problems; }
+
+    // Every file tokens have been read from so far, the compiled file first.
+    const std::vector<FileID>& files_read() const { return read_files; }
+
+private:
+    static constexpr size_t MaxIncludeDepth = 200;
+
+    // A #if whose group is being read; groups not taken are skipped before
+    // they get here.
+    struct Conditional {
+        Token directive;
+        bool seen_else;
+    };
+
+    // A file being read: lexed, or replayed from the cache.
+    struct Frame {
+        const SourceFile* file = nullptr;
+        std::unique_ptr<TokenSource> lexer;
+        const CachedHeader* replay = nullptr;
+        size_t step = 0;
+        std::string path;
+        // A token read too far by directive_line() or skip_group()
+        Token ahead;
+        bool ahead_starts_line = false;
+        bool has_ahead = false;
+        SourceOffset last_end = 0;
+        bool first = true;
+        std::vector<Conditional> conditionals;
+        // Include guard detection: a file is guarded when all of it is one
+        // #ifndef X group, whatever comes first after that.
+        enum { GuardStart, GuardOpen, GuardClosed, GuardNone } guard_state = GuardStart;
+        SymbolID guard = Interner::None;
+    };
+
+    // A header being lexed for the first time, and the cache entry it makes.
+    struct Recording {
+        size_t frame;
+        CachedHeader header;
+        std::unordered_set<SymbolID> changed;
+        std::unordered_set<SymbolID> read;
+        std::unordered_set<std::string> once_read;
+    };
+
+    // An entry of `pending`: a token still to be rescanned, the end of a
+    // macro's expansion (it may expand again after it), or the end of a macro
+    // argument being expanded on its own.
+    struct Pending {
+        Token token;
+        const Macro* ends = nullptr;
+        bool stop = false;
+    };
+
+    HeaderCache& cache;
+    SourceManager& sources;
+    const PreprocessorOptions& options;
+    const SourceFile* main_file;
+    std::vector<LexDiagnostic> problems;
+    std::vector<FileID> read_files{main_file->id()};
+
+    std::vector<Frame> frames;
+    std::vector<Recording> recordings;
+    std::unordered_map<SymbolID, const Macro*> macros;
+    // Keywords may be macro names too; only those that are get looked up.
+    bool keyword_macros[T_IDENTIFIER] = {};
+    std::unordered_set<std::string> once;
+
+    // Next entry at the back.
+    std::vector<Pending> pending;
+    // Macros whose expansion is being rescanned, and so do not expand.
+    std::vector<const Macro*> expanding;
+    // Set while a directive expands macros; lookups then decide what the
+    // directive does, so headers being recorded depend on them.
+    bool directive_lookups = false;
+    std::unordered_map<std::string, Token> spellings;
+
+    static bool is_word(TokenType type) { return type <= T_IDENTIFIER; }
+
+    static SymbolID word_symbol(const Token& token) {
+        return token.type == T_IDENTIFIER ? token.symbol : intern(token.lexeme);
+    }
+
+    static bool is_literal(TokenType type) { return type == T_CHARLIT || type == T_STRINGLIT; }
+
+    // The token's text as written, quotes included.
+    static std::string_view spelling(const Token& token) {
+        if (!is_literal(token.type)) return token.lexeme;
+        return std::string_view(token.lexeme.data() - 1, token.lexeme.size() + 2);
+    }
+
+    static SourceOffset token_end(const Token& token) {
+        return token.offset + token.lexeme.size() + (is_literal(token.type) ? 2 : 0);
+    }
+
+    static bool is_directive(const Token& token, std::string_view name) {
+        return is_word(token.type) && token.lexeme == name;
+    }
+
+    // True if a line ends in text[from, to), the comments and whitespace
+    // between two tokens. Spliced lines and newlines inside a block comment
+    // do not end one.
+    static bool line_ends_between(std::string_view text, SourceOffset from, SourceOffset to) {
+        for (SourceOffset i = from; i < to; i++) {
+            char c = text[i];
+            if (c == '/' && i + 1 < to && text[i + 1] == '*') {
+                size_t close = text.find("*/", i + 2);
+                if (close == std::string_view::npos || close + 2 > to) return false;
+                i = close + 1;
+            } else if (c == '/' && i + 1 < to && text[i + 1] == '/') {
+                return true;
+            } else if (c == '\n') {
+                bool spliced = (i > 0 && text[i - 1] == '\\') || (i > 1 && text[i - 1] == '\r' && text[i - 2] == '\\');
+                if (!spliced) return true;
+            }
+        }
+        return false;
+    }
+
+    std::string in_file(const Token& token) const {
+        return token.file == main_file->id() ? "" : " in " + sources.file(token.file).name();
+    }
+
+    void error(const Token& at, const std::string& message) {
+        problems.push_back({at.offset, message + " at " + describe(at)});
+    }
+
+
+    // Reads the next token of `frame`, unexpanded and with directives left
+    // in; T_EOF at its end. Returns whether it is the first on its line.
+    bool raw(Frame& frame, Token& token) {
+        if (frame.has_ahead) {
+            frame.has_ahead = false;
+            token = frame.ahead;
+            return frame.ahead_starts_line;
+        }
+        if (frame.replay) {
+            while (frame.step < frame.replay->steps.size()) {
+                const CachedHeader::Step& step = frame.replay->steps[frame.step++];
+                if (step.kind == CachedHeader::Step::Text) {
+                    token = step.token;
+                    return false;
+                }
+                if (step.kind == CachedHeader::Step::Define) define(step.macro);
+                else if (step.kind == CachedHeader::Step::Undefine) undefine(step.name);
+                else mark_once(step.path);
+            }
+            token = Token(T_EOF, frame.file->text().substr(frame.file->size()), frame.file->size());
+            token.file = frame.file->id();
+            return true;
+        }
+        token = frame.lexer->next();
+        token.file = frame.file->id();
+        bool starts_line = frame.first || line_ends_between(frame.file->text(), frame.last_end, token.offset);
+        frame.first = false;
+        frame.last_end = token_end(token);
+        return starts_line;
+    }
+
+    void put_back(Frame& frame, const Token& token, bool starts_line) {
+        frame.ahead = token;
+        frame.ahead_starts_line = starts_line;
+        frame.has_ahead = true;
+    }
+
+    // The rest of the directive line the last token read from `frame` is on.
+    std::vector<Token> directive_line(Frame& frame) {
+        std::vector<Token> line;
+        Token token;
+        while (true) {
+            bool starts_line = raw(frame, token);
+            if (starts_line || token.type == T_EOF) {
+                put_back(frame, token, starts_line);
+                return line;
+            }
+            line.push_back(token);
+        }
+    }
+
+    // Reads the next text token, with directives carried out and included
+    // files read in their place; T_EOF at the end of the file being compiled.
+    void file_token(Token& token) {
+        while (true) {
+            Frame& frame = frames.back();
+            bool starts_line = raw(frame, token);
+            if (token.type == T_EOF) {
+                if (frames.size() == 1) {
+                    close_conditionals(frame);
+                    return;
+                }
+                end_file();
+                continue;
+            }
+            if (token.type == T_PP_HASH && starts_line && frame.lexer) {
+                directive(frames.size() - 1, token);
+                continue;
+            }
+            if (frame.conditionals.empty()) frame.guard_state = Frame::GuardNone;
+            if (!recordings.empty()) record({CachedHeader::Step::Text, token, nullptr, Interner::None, ""});
+            return;
+        }
+    }
+
+    void close_conditionals(Frame& frame) {
+        for (const Conditional& open : frame.conditionals) {
+            error(open.directive, "Unterminated #" + std::string(open.directive.lexeme));
+        }
+        frame.conditionals.clear();
+    }
+
+    void end_file() {
+        Frame& frame = frames.back();
+        close_conditionals(frame);
+        if (frame.lexer && frame.guard_state == Frame::GuardClosed) cache.guards[frame.path] = frame.guard;
+        if (!recordings.empty() && recordings.back().frame == frames.size() - 1) {
+            cache.headers[frame.path].push_back(std::move(recordings.back().header));
+            recordings.pop_back();
+        }
+        frames.pop_back();
+    }
+
+
+    void directive(size_t index, const Token& hash) {
+        bool outside = frames[index].conditionals.empty();
+        std::vector<Token> line = directive_line(frames[index]);
+        if (line.empty()) return;
+        const Token& name = line[0];
+        Frame& frame = frames[index];
+        if (outside) {
+            bool guard = frame.guard_state == Frame::GuardStart && is_directive(name, "ifndef") && line.size() == 2 &&
+                         is_word(line[1].type);
+            frame.guard_state = guard ? Frame::GuardOpen : Frame::GuardNone;
+            if (guard) frame.guard = word_symbol(line[1]);
+        }
+
+        if (is_directive(name, "if") || is_directive(name, "ifdef") || is_directive(name, "ifndef") ||
+            is_directive(name, "elif") || is_directive(name, "else") || is_directive(name, "endif")) {
+            conditional(index, line);
+        } else if (is_directive(name, "define")) {
+            define_directive(line);
+        } else if (is_directive(name, "undef")) {
+            if (line.size() < 2 || !is_word(line[1].type)) error(name, "Expected a macro name after #undef");
+            else undefine(word_symbol(line[1]));
+        } else if (is_directive(name, "include")) {
+            include(index, line);
+        } else if (is_directive(name, "pragma")) {
+            if (line.size() >= 2 && line[1].lexeme == "once") mark_once(frame.path);
+        } else if (is_directive(name, "error")) {
+            std::string_view text = frame.file->text();
+            SourceOffset start = line.size() > 1 ? line[1].offset : token_end(name);
+            SourceOffset end = std::max(start, token_end(line.back()));
+            error(hash, "#error " + std::string(text.substr(start, end - start)));
+        } else if (!is_directive(name, "line") && !is_directive(name, "warning")) {
+            // #line and #warning are accepted and have no effect here
+            error(name, "Unknown directive #" + std::string(name.lexeme));
+        }
+    }
+
+    // Handles one conditional directive, then skips groups that are not taken
+    // until a directive takes one or ends the #if.
+    void conditional(size_t index, std::vector<Token> line) {
+        while (true) {
+            Frame& frame = frames[index];
+            const Token& name = line[0];
+            bool skip = false, rest = false;
+            if (is_directive(name, "if") || is_directive(name, "ifdef") || is_directive(name, "ifndef")) {
+                frame.conditionals.push_back({name, false});
+                skip = !condition(line);
+            } else if (frame.conditionals.empty()) {
+                error(name, "#" + std::string(name.lexeme) + " without #if");
+                return;
+            } else if (is_directive(name, "endif")) {
+                frame.conditionals.pop_back();
+                if (frame.conditionals.empty() && frame.guard_state == Frame::GuardOpen) frame.guard_state = Frame::GuardClosed;
+                return;
+            } else {
+                // #elif or #else reached by reading a taken group: the rest is skipped
+                Conditional& open = frame.conditionals.back();
+                if (open.seen_else) error(name, "#" + std::string(name.lexeme) + " after #else");
+                open.seen_else = open.seen_else || is_directive(name, "else");
+                if (frame.conditionals.size() == 1 && frame.guard_state == Frame::GuardOpen) frame.guard_state = Frame::GuardNone;
+                skip = rest = true;
+            }
+            if (!skip) return;
+            line = skip_group(index, rest);
+            if (line.empty()) return;
+        }
+    }
+
+    // Reads past a group not taken. Returns the directive that ends it: an
+    // #endif, or an #elif or #else that has been found to take its group
+    // (handled here, so the caller goes on reading). With `rest`, every
+    // later group of the #if is skipped too.
+    std::vector<Token> skip_group(size_t index, bool rest) {
+        size_t depth = 0;
+        while (true) {
+            Frame& frame = frames[index];
+            Token token;
+            bool starts_line = raw(frame, token);
+            if (token.type == T_EOF) {
+                put_back(frame, token, starts_line);
+                return {};
+            }
+            if (token.type != T_PP_HASH || !starts_line) continue;
+            std::vector<Token> line = directive_line(frame);
+            if (line.empty()) continue;
+            const Token& name = line[0];
+            if (is_directive(name, "if") || is_directive(name, "ifdef") || is_directive(name, "ifndef")) {
+                depth++;
+            } else if (is_directive(name, "endif")) {
+                if (depth == 0) return line;
+                depth--;
+            } else if (depth == 0 && (is_directive(name, "elif") || is_directive(name, "else"))) {
+                Conditional& open = frame.conditionals.back();
+                if (open.seen_else) {
+                    error(name, "#" + std::string(name.lexeme) + " after #else");
+                    continue;
+                }
+                if (frame.conditionals.size() == 1 && frame.guard_state == Frame::GuardOpen) frame.guard_state = Frame::GuardNone;
+                bool is_else = is_directive(name, "else");
+                open.seen_else = is_else;
+                if (rest) continue;
+                if (is_else || condition(line)) {
+                    // Later groups of this #if are skipped by conditional()
+                    return {};
+                }
+            }
+        }
+    }
+
+    // Whether the group after #if, #ifdef, #ifndef or #elif `line` is taken.
+    bool condition(const std::vector<Token>& line) {
+        const Token& name = line[0];
+        if (is_directive(name, "ifdef") || is_directive(name, "ifndef")) {
+            if (line.size() < 2 || !is_word(line[1].type)) {
+                error(name, "Expected a macro name after #" + std::string(name.lexeme));
+                return false;
+            }
+            bool defined = lookup(word_symbol(line[1])) != nullptr;
+            return is_directive(name, "ifdef") ? defined : !defined;
+        }
+        return evaluate(line);
+    }
+
+    void define_directive(const std::vector<Token>& line) {
+        const Token& directive = line[0];
+        if (line.size() < 2 || !is_word(line[1].type)) {
+            error(directive, "Expected a macro name after #define");
+            return;
+        }
+        Macro macro;
+        macro.name = word_symbol(line[1]);
+        macro.word = line[1].type;
+        if (line[1].lexeme == "defined") {
+            error(line[1], "\"defined\" cannot be used as a macro name");
+            return;
+        }
+        size_t i = 2;
+        // Only a '(' right after the name, with no space, takes parameters
+        if (i < line.size() && line[i].type == T_PARENL && line[i].offset == token_end(line[1])) {
+            macro.function_like = true;
+            i++;
+            bool closed = false;
+            while (i < line.size()) {
+                const Token& token = line[i++];
+                if (token.type == T_PARENR && macro.params.empty() && !macro.variadic) {
+                    closed = true;
+                    break;
+                }
+                if (token.type == T_OP_DOT && token.lexeme == "...") {
+                    macro.variadic = true;
+                    macro.params.push_back(intern("__VA_ARGS__"));
+                } else if (is_word(token.type)) {
+                    macro.params.push_back(word_symbol(token));
+                } else {
+                    break;
+                }
+                if (i < line.size() && line[i].type == T_PARENR) {
+                    closed = true;
+                    i++;
+                    break;
+                }
+                if (macro.variadic || i >= line.size() || line[i].type != T_COMMA) break;
+                i++;
+            }
+            if (!closed) {
+                error(line[1], "Malformed parameter list for macro " + std::string(line[1].lexeme));
+                return;
+            }
+        }
+        macro.body.assign(line.begin() + i, line.end());
+        for (const Token& token : macro.body) {
+            int param = -1;
+            if (is_word(token.type)) {
+                auto found = std::find(macro.params.begin(), macro.params.end(), word_symbol(token));
+                if (found != macro.params.end()) param = found - macro.params.begin();
+            }
+            macro.param_of.push_back(param);
+        }
+        if (!macro.body.empty() && (macro.body.front().type == T_PP_HASHHASH || macro.body.back().type == T_PP_HASHHASH)) {
+            error(line[1], "'##' cannot be at either end of a macro body");
+            return;
+        }
+        if (macro.function_like) {
+            for (size_t k = 0; k < macro.body.size(); k++) {
+                if (macro.body[k].type == T_PP_HASH && (k + 1 == macro.body.size() || macro.param_of[k + 1] < 0)) {
+                    error(macro.body[k], "'#' is not followed by a macro parameter");
+                    return;
+                }
+            }
+        }
+        cache.definitions.push_back(std::move(macro));
+        define(&cache.definitions.back());
+    }
+
+    void include(size_t index, const std::vector<Token>& line) {
+        const Token& directive = line[0];
+        std::string name;
+        bool angled = false;
+        bool found = false;
+        if (line.size() >= 2 && line[1].type == T_STRINGLIT) {
+            name = std::string(line[1].lexeme);
+            found = true;
+        } else if (line.size() >= 2 && line[1].type == T_OP_LT) {
+            // The name is raw text: <sys/types.h> is not lexed as tokens
+            std::string_view text = frames[index].file->text();
+            size_t close = text.find('>', line[1].offset + 1);
+            if (close != std::string_view::npos && close < token_end(line.back())) {
+                name = std::string(text.substr(line[1].offset + 1, close - line[1].offset - 1));
+                angled = found = true;
+            }
+        } else if (line.size() >= 2) {
+            // #include MACRO
+            std::vector<Token> expanded = expand_directive(std::vector<Token>(line.begin() + 1, line.end()));
+            if (expanded.size() == 1 && expanded[0].type == T_STRINGLIT) {
+                name = std::string(expanded[0].lexeme);
+                found = true;
+            } else if (expanded.size() >= 2 && expanded.front().type == T_OP_LT && expanded.back().type == T_OP_GT) {
+                for (size_t i = 1; i + 1 < expanded.size(); i++) name += spelling(expanded[i]);
+                angled = found = true;
+            }
+        }
+        if (!found || name.empty()) {
+            error(directive, "Expected \"file\" or <file> after #include");
+            return;
+        }
+        if (frames.size() >= MaxIncludeDepth) {
+            error(directive, "#include nested too deeply");
+            return;
+        }
+        std::string path = resolve(name, angled, *frames[index].file);
+        if (path.empty()) {
+            // There are no system headers to find; <stdio.h> and the like
+            // declare nothing here.
+            if (!angled) error(directive, "Cannot find include file \"" + name + "\"");
+            return;
+        }
+        enter(path, directive);
+    }
+
+    std::string resolve(const std::string& name, bool angled, const SourceFile& from) const {
+        namespace fs = std::filesystem;
+        std::error_code ignored;
+        std::vector<fs::path> candidates;
+        if (!angled) candidates.push_back(fs::path(from.name()).parent_path() / name);
+        for (const std::string& dir : options.include_paths) candidates.push_back(fs::path(dir) / name);
+        for (const fs::path& candidate : candidates) {
+            if (fs::is_regular_file(candidate, ignored)) return candidate.lexically_normal().string();
+        }
+        return "";
+    }
+
+    void enter(const std::string& path, const Token& directive) {
+        bool included = once.count(path) != 0;
+        for (Recording& recording : recordings) {
+            if (recording.once_read.insert(path).second) recording.header.once_read.push_back({path, included});
+        }
+        auto guard = cache.guards.find(path);
+        if (included || (guard != cache.guards.end() && lookup(guard->second))) {
+            cache.skipped++;
+            return;
+        }
+
+        Frame frame;
+        frame.path = path;
+        auto cached = cache.headers.find(path);
+        if (cached != cache.headers.end()) {
+            for (const CachedHeader& header : cached->second) {
+                if (!still_valid(header)) continue;
+                frame.file = &sources.file(cache.files.at(path));
+                frame.replay = &header;
+                read_files.push_back(frame.file->id());
+                frames.push_back(std::move(frame));
+                cache.replayed++;
+                return;
+            }
+        }
+        auto loaded = cache.files.find(path);
+        if (loaded == cache.files.end()) {
+            try {
+                loaded = cache.files.emplace(path, sources.load(path)).first;
+            } catch (const std::exception& e) {
+                error(directive, e.what());
+                return;
+            }
+        }
+        frame.file = &sources.file(loaded->second);
+        read_files.push_back(frame.file->id());
+        frame.lexer = options.backend->open(*frame.file, 0);
+        frames.push_back(std::move(frame));
+        recordings.push_back(Recording());
+        recordings.back().frame = frames.size() - 1;
+        cache.lexed++;
+    }
+
+    bool still_valid(const CachedHeader& header) {
+        for (const auto& read : header.macros_read) {
+            if (!same_definition(lookup(read.first), read.second)) return false;
+        }
+        for (const auto& read : header.once_read) {
+            if ((once.count(read.first) != 0) != read.second) return false;
+        }
+        return true;
+    }
+
+    static bool same_definition(const Macro* a, const Macro* b) {
+        if (a == b) return true;
+        if (!a || !b) return false;
+        if (a->function_like != b->function_like || a->variadic != b->variadic || a->params != b->params ||
+            a->body.size() != b->body.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < a->body.size(); i++) {
+            if (a->body[i].type != b->body[i].type || spelling(a->body[i]) != spelling(b->body[i])) return false;
+        }
+        return true;
+    }
+
+
+    void record(const CachedHeader::Step& step) {
+        for (Recording& recording : recordings) recording.header.steps.push_back(step);
+    }
+
+    void define(const Macro* macro) {
+        macros[macro->name] = macro;
+        if (macro->word != T_IDENTIFIER) keyword_macros[macro->word] = true;
+        if (recordings.empty()) return;
+        for (Recording& recording : recordings) recording.changed.insert(macro->name);
+        record({CachedHeader::Step::Define, Token(), macro, macro->name, ""});
+    }
+
+    void undefine(SymbolID name) {
+        auto found = macros.find(name);
+        if (found != macros.end()) {
+            if (found->second->word != T_IDENTIFIER) keyword_macros[found->second->word] = false;
+            macros.erase(found);
+        }
+        if (recordings.empty()) return;
+        for (Recording& recording : recordings) recording.changed.insert(name);
+        record({CachedHeader::Step::Undefine, Token(), nullptr, name, ""});
+    }
+
+    void mark_once(const std::string& path) {
+        once.insert(path);
+        if (!recordings.empty()) record({CachedHeader::Step::Once, Token(), nullptr, Interner::None, path});
+    }
+
+    // A macro looked up for a directive; headers being recorded note what
+    // they saw, unless they set the name themselves.
+    const Macro* lookup(SymbolID name) {
+        auto found = macros.find(name);
+        const Macro* macro = found == macros.end() ? nullptr : found->second;
+        for (Recording& recording : recordings) {
+            if (!recording.changed.count(name) && recording.read.insert(name).second) {
+                recording.header.macros_read.push_back({name, macro});
+            }
+        }
+        return macro;
+    }
+
+    // The macro `token` names if it should expand here. A name of a macro
+    // whose expansion is being rescanned is marked so it stays unexpanded
+    // after that rescan is over, e.g. once it is substituted for an argument.
+    const Macro* expandable(Token& token) {
+        if (!is_word(token.type) || token.no_expand) return nullptr;
+        if (!directive_lookups && (macros.empty() || (token.type != T_IDENTIFIER && !keyword_macros[token.type]))) return nullptr;
+        SymbolID name = word_symbol(token);
+        const Macro* macro;
+        if (directive_lookups) {
+            macro = lookup(name);
+        } else {
+            auto found = macros.find(name);
+            macro = found == macros.end() ? nullptr : found->second;
+        }
+        if (!macro) return nullptr;
+        if (std::find(expanding.begin(), expanding.end(), macro) != expanding.end()) {
+            token.no_expand = true;
+            return nullptr;
+        }
+        return macro;
+    }
+
+
+    // The next token to rescan. Returns false, leaving the marker, at the end
+    // of an argument being expanded on its own.
+    bool fetch(Token& token) {
+        while (!pending.empty()) {
+            Pending& next = pending.back();
+            if (next.stop) return false;
+            if (next.ends) {
+                expanding.erase(std::find(expanding.begin(), expanding.end(), next.ends));
+                pending.pop_back();
+                continue;
+            }
+            token = next.token;
+            pending.pop_back();
+            return true;
+        }
+        file_token(token);
+        return true;
+    }
+
+    void push_back(const Token& token) { pending.push_back({token, nullptr, false}); }
+
+    // The next fully expanded token. Returns false at the end of an argument
+    // being expanded on its own, and removes the marker.
+    bool expand_next(Token& out) {
+        while (true) {
+            if (!fetch(out)) {
+                pending.pop_back();
+                return false;
+            }
+            const Macro* macro = expandable(out);
+            if (!macro) return true;
+            Token name = out;
+            std::vector<std::vector<Token>> args;
+            if (macro->function_like) {
+                Token paren;
+                bool more = fetch(paren);
+                if (!more || paren.type != T_PARENL) {
+                    if (more) push_back(paren);
+                    return true;
+                }
+                if (!collect_args(*macro, name, args)) continue;
+            }
+            std::vector<Token> result = substitute(*macro, args, name);
+            pending.push_back({Token(), macro, false});
+            expanding.push_back(macro);
+            for (size_t i = result.size(); i-- > 0;) push_back(result[i]);
+        }
+    }
+
+    // Reads the arguments of a call to `macro` after its '('. Returns false,
+    // having reported it, if the call is malformed.
+    bool collect_args(const Macro& macro, const Token& name, std::vector<std::vector<Token>>& args) {
+        args.assign(1, {});
+        size_t depth = 0;
+        while (true) {
+            Token token;
+            if (!fetch(token) || token.type == T_EOF) {
+                if (token.type == T_EOF) push_back(token);
+                error(name, "Unterminated call to macro " + std::string(name.lexeme));
+                return false;
+            }
+            if (token.type == T_PARENR && depth == 0) break;
+            if (token.type == T_PARENL) depth++;
+            if (token.type == T_PARENR) depth--;
+            bool in_variadic = macro.variadic && args.size() == macro.params.size();
+            if (token.type == T_COMMA && depth == 0 && !in_variadic) {
+                args.emplace_back();
+                continue;
+            }
+            args.back().push_back(token);
+        }
+        if (macro.params.empty() && args.size() == 1 && args[0].empty()) args.clear();
+        if (macro.variadic && args.size() + 1 == macro.params.size()) args.emplace_back();
+        if (args.size() != macro.params.size()) {
+            error(name, "Macro " + std::string(name.lexeme) + " takes " + std::to_string(macro.params.size()) +
+                            " argument(s) but was given " + std::to_string(args.size()));
+            return false;
+        }
+        return true;
+    }
+
+    // `tokens` fully expanded on their own, as an argument is before it is
+    // substituted.
+    std::vector<Token> expand_all(const std::vector<Token>& tokens) {
+        pending.push_back({Token(), nullptr, true});
+        for (size_t i = tokens.size(); i-- > 0;) push_back(tokens[i]);
+        std::vector<Token> out;
+        Token token;
+        while (expand_next(token)) out.push_back(token);
+        return out;
+    }
+
+    std::vector<Token> expand_directive(const std::vector<Token>& tokens) {
+        directive_lookups = true;
+        std::vector<Token> out = expand_all(tokens);
+        directive_lookups = false;
+        return out;
+    }
+
+    // The body of `macro` with its arguments in place and '#' and '##' done.
+    // Every token comes out at `site`, the name that was expanded.
+    std::vector<Token> substitute(const Macro& macro, const std::vector<std::vector<Token>>& args, const Token& site) {
+        const std::vector<Token>& body = macro.body;
+        std::vector<Token> out;
+        // Where the last operand of a possible '##' starts in `out`
+        size_t operand = 0;
+        for (size_t i = 0; i < body.size(); i++) {
+            int param = macro.param_of[i];
+            if (body[i].type == T_PP_HASHHASH) {
+                std::vector<Token> right;
+                int right_param = macro.param_of[i + 1];
+                if (right_param >= 0) right = args[right_param];
+                else right.push_back(body[i + 1]);
+                i++;
+                if (right.empty()) continue;
+                size_t start = out.size();
+                if (out.size() > operand) {
+                    start = out.size() - 1;
+                    if (!paste(out.back(), right[0], site)) out.push_back(right[0]);
+                } else {
+                    out.push_back(right[0]);
+                }
+                out.insert(out.end(), right.begin() + 1, right.end());
+                operand = start;
+                continue;
+            }
+            operand = out.size();
+            if (macro.function_like && body[i].type == T_PP_HASH) {
+                out.push_back(stringify(args[macro.param_of[i + 1]], site));
+                i++;
+            } else if (param >= 0) {
+                bool pasted = i + 1 < body.size() && body[i + 1].type == T_PP_HASHHASH;
+                std::vector<Token> arg = pasted ? args[param] : expand_all(args[param]);
+                out.insert(out.end(), arg.begin(), arg.end());
+            } else {
+                out.push_back(body[i]);
+            }
+        }
+        for (Token& token : out) {
+            token.file = site.file;
+            token.offset = site.offset;
+        }
+        return out;
+    }
+
+    // Replaces `left` with the token spelled by `left` and `right` together.
+    bool paste(Token& left, const Token& right, const Token& site) {
+        std::string text = std::string(spelling(left)) + std::string(spelling(right));
+        Token pasted;
+        if (!lex_spelling(text, pasted)) {
+            error(site, "Pasting \"" + std::string(spelling(left)) + "\" and \"" + std::string(spelling(right)) +
+                            "\" does not give a valid token");
+            return false;
+        }
+        left = pasted;
+        return true;
+    }
+
+    Token stringify(const std::vector<Token>& arg, const Token& site) {
+        std::string text = "\"";
+        for (size_t i = 0; i < arg.size(); i++) {
+            std::string_view spelled = spelling(arg[i]);
+            if (i > 0) {
+                std::string_view before = spelling(arg[i - 1]);
+                if (before.data() + before.size() != spelled.data()) text += ' ';
+            }
+            for (char c : spelled) {
+                if (is_literal(arg[i].type) && (c == '"' || c == '\\')) text += '\\';
+                text += c;
+            }
+        }
+        text += '"';
+        Token token;
+        if (!lex_spelling(text, token)) error(site, "Cannot stringify macro argument");
+        return token;
+    }
+
+    // Lexes `text` as a single token, for the results of '#' and '##'.
+    bool lex_spelling(const std::string& text, Token& token) {
+        auto known = spellings.find(text);
+        if (known == spellings.end()) {
+            const SourceFile& file = sources.file(sources.add_buffer("<macro expansion>", text));
+            std::unique_ptr<TokenSource> lexer = options.backend->open(file, 0);
+            Token first = lexer->next();
+            bool single = first.type != T_INVALID && first.type != T_EOF && lexer->next().type == T_EOF;
+            known = spellings.emplace(text, single ? first : Token()).first;
+        }
+        token = known->second;
+        return token.type != T_INVALID;
+    }
+
+
+    bool evaluate(const std::vector<Token>& line) {
+        const Token& directive = line[0];
+        // "defined X" and "defined(X)" are answered before macros expand
+        std::vector<Token> tokens;
+        for (size_t i = 1; i < line.size(); i++) {
+            if (!is_directive(line[i], "defined")) {
+                tokens.push_back(line[i]);
+                continue;
+            }
+            bool paren = i + 1 < line.size() && line[i + 1].type == T_PARENL;
+            size_t at = i + (paren ? 2 : 1);
+            if (at >= line.size() || !is_word(line[at].type) || (paren && (at + 1 >= line.size() || line[at + 1].type != T_PARENR))) {
+                error(line[i], "Expected a macro name after \"defined\"");
+                return false;
+            }
+            bool defined = lookup(word_symbol(line[at])) != nullptr;
+            tokens.push_back(Token(T_INTLIT, defined ? "1" : "0", line[i].offset));
+            i = at + (paren ? 1 : 0);
+        }
+        std::vector<Token> expression = expand_directive(tokens);
+        size_t pos = 0;
+        bool ok = true;
+        long long value = conditional_expression(expression, pos, true, ok);
+        if (ok && pos != expression.size()) ok = false;
+        if (!ok) {
+            error(directive, "Invalid expression in #" + std::string(directive.lexeme));
+            return false;
+        }
+        return value != 0;
+    }
+
+    static int precedence(const Token& token) {
+        switch (token.type) {
+            case T_OP_LOGICAL_OR: return 1;
+            case T_OP_LOGICAL_AND: return 2;
+            case T_OP_OR: return 3;
+            case T_OP_AND: return 5;
+            case T_OP_XOR: return 4;
+            case T_OP_EQ: case T_OP_NEQ: return 6;
+            case T_OP_LT: case T_OP_GT: case T_OP_LE: case T_OP_GE: return 7;
+            case T_OP_LSHIFT: case T_OP_RSHIFT: return 8;
+            case T_OP_PLUS: case T_OP_MINUS: return 9;
+            case T_OP_MUL: case T_OP_DIV: case T_OP_MOD: return 10;
+            default: return 0;
+        }
+    }
+
+    // `live` is false in an operand that is not evaluated, where dividing by
+    // zero is not an error.
+    long long conditional_expression(const std::vector<Token>& e, size_t& pos, bool live, bool& ok) {
+        long long condition = binary_expression(e, pos, 1, live, ok);
+        if (pos >= e.size() || e[pos].type != T_QUESTION) return condition;
+        pos++;
+        long long then = conditional_expression(e, pos, live && condition, ok);
+        if (pos >= e.size() || e[pos].type != T_COLON) {
+            ok = false;
+            return 0;
+        }
+        pos++;
+        long long otherwise = conditional_expression(e, pos, live && !condition, ok);
+        return condition ? then : otherwise;
+    }
+
+    long long binary_expression(const std::vector<Token>& e, size_t& pos, int min_precedence, bool live, bool& ok) {
+        long long left = unary_expression(e, pos, live, ok);
+        while (ok && pos < e.size()) {
+            const Token& op = e[pos];
+            int p = precedence(op);
+            if (p == 0 || p < min_precedence) break;
+            pos++;
+            bool right_live = live;
+            if (op.type == T_OP_LOGICAL_AND) right_live = live && left;
+            if (op.type == T_OP_LOGICAL_OR) right_live = live && !left;
+            long long right = binary_expression(e, pos, p + 1, right_live, ok);
+            switch (op.type) {
+                case T_OP_LOGICAL_OR: left = left || right; break;
+                case T_OP_LOGICAL_AND: left = left && right; break;
+                case T_OP_OR: left |= right; break;
+                case T_OP_AND: left &= right; break;
+                case T_OP_XOR: left ^= right; break;
+                case T_OP_EQ: left = left == right; break;
+                case T_OP_NEQ: left = left != right; break;
+                case T_OP_LT: left = left < right; break;
+                case T_OP_GT: left = left > right; break;
+                case T_OP_LE: left = left <= right; break;
+                case T_OP_GE: left = left >= right; break;
+                case T_OP_LSHIFT: left = right >= 0 && right < 64 ? (long long)((unsigned long long)left << right) : 0; break;
+                case T_OP_RSHIFT: left = right >= 0 && right < 64 ? left >> right : 0; break;
+                case T_OP_PLUS: left = (long long)((unsigned long long)left + (unsigned long long)right); break;
+                case T_OP_MINUS: left = (long long)((unsigned long long)left - (unsigned long long)right); break;
+                case T_OP_MUL: left = (long long)((unsigned long long)left * (unsigned long long)right); break;
+                case T_OP_DIV:
+                case T_OP_MOD:
+                    if (right == 0) {
+                        if (live) ok = false;
+                        left = 0;
+                    } else if (right == -1) {
+                        left = op.type == T_OP_DIV ? (long long)(0 - (unsigned long long)left) : 0;
+                    } else {
+                        left = op.type == T_OP_DIV ? left / right : left % right;
+                    }
+                    break;
+                default: break;
+            }
+        }
+        return left;
+    }
+
+    long long unary_expression(const std::vector<Token>& e, size_t& pos, bool live, bool& ok) {
+        if (pos >= e.size()) {
+            ok = false;
+            return 0;
+        }
+        const Token& token = e[pos++];
+        switch (token.type) {
+            case T_OP_PLUS: return unary_expression(e, pos, live, ok);
+            case T_OP_MINUS: return (long long)(0 - (unsigned long long)unary_expression(e, pos, live, ok));
+            case T_OP_NOT: return !unary_expression(e, pos, live, ok);
+            case T_OP_BITWISENOT: return ~unary_expression(e, pos, live, ok);
+            case T_PARENL: {
+                long long value = conditional_expression(e, pos, live, ok);
+                if (pos >= e.size() || e[pos].type != T_PARENR) ok = false;
+                pos++;
+                return value;
+            }
+            case T_INTLIT: return (long long)strtoull(std::string(token.lexeme).c_str(), nullptr, 10);
+            case T_CHARLIT: return char_value(token.lexeme);
+            case T_KW_TRUE: return 1;
+            default:
+                // Identifiers left after expansion, and false, are 0
+                if (is_word(token.type)) return 0;
+                ok = false;
+                return 0;
+        }
+    }
+
+    static long long char_value(std::string_view text) {
+        if (text.empty()) return 0;
+        if (text[0] != '\\' || text.size() < 2) return (unsigned char)text[0];
+        switch (text[1]) {
+            case 'n': return '\n';
+            case 't': return '\t';
+            case 'r': return '\r';
+            case '0': return 0;
+            default: return (unsigned char)text[1];
+        }
+    }
+};
@@ -4,6 +4,8 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <unordered_map>
+#include <string_view>
 #include <stdexcept>
 #include "ast.h"
 
@@ -28,35 +30,46 @@ enum SymbolKind {
 };
 
 struct Symbol {
-    string name;
-    string type_name;
+    SymbolID name;
+    Type type;
     SymbolKind kind;
-    int definition_line;
+    SourceLocation definition;
      
     vector<Parameter> params; 
 
-    Symbol(string n, string t, SymbolKind k, int line) 
-        : name(n), type_name(t), kind(k), definition_line(line) {}
+    Symbol(SymbolID n, Type t, SymbolKind k, SourceLocation loc) 
+        : name(n), type(t), kind(k), definition(loc) {}
 };
 
 struct Scope {
-    map<string, Symbol*> symbols;
+    unordered_map<SymbolID, Symbol*> symbols;
     Scope* parent;
     map<const void*, Scope*> children_scopes; 
 
     Scope(Scope* p) : parent(p) {}
 
+    // Nested scopes are torn down from a worklist rather than recursively.
     ~Scope() {
         for (auto& it : symbols) delete it.second;
-        for (auto& it : children_scopes) delete it.second;
+        vector<Scope*> doomed;
+        for (auto& it : children_scopes) doomed.push_back(it.second);
+        children_scopes.clear();
+        while (!doomed.empty()) {
+            Scope* scope = doomed.back();
+            doomed.pop_back();
+            for (auto& it : scope->children_scopes) doomed.push_back(it.second);
+            scope->children_scopes.clear();
+            delete scope;
+        }
     }
 };
 
-class ScopeAnalyzer {
+class ScopeAnalyzer : AstVisitor<ScopeAnalyzer> {
 public:
     Scope* global_scope;
 
-    ScopeAnalyzer() {
+    // Positions in error messages are resolved through `sources`.
+    ScopeAnalyzer(const SourceManager& sources) : sources(sources) {
         global_scope = new Scope(NULL);
         current_scope = global_scope;
     }
@@ -66,8 +79,35 @@ public:
     }
 
 private:
+    friend class AstVisitor<ScopeAnalyzer>;
+    const SourceManager& sources;
     Scope* current_scope;
 
+    // The visit functions push a node's children here, last first, instead
+    // of recursing, so a deep tree cannot overflow the call stack.
+    enum class Step : uint8_t { Statement, Expression, Declare, ExitScope };
+    struct Task {
+        Step step;
+        void* node;
+    };
+    vector<Task> pending;
+
+    void push(Statement* node) { pending.push_back(Task{Step::Statement, node}); }
+    void push(Expression* node) { pending.push_back(Task{Step::Expression, node}); }
+
+    void run() {
+        while (!pending.empty()) {
+            Task task = pending.back();
+            pending.pop_back();
+            switch (task.step) {
+            case Step::Statement: if (task.node) dispatch(static_cast<Statement*>(task.node)); break;
+            case Step::Expression: if (task.node) dispatch(static_cast<Expression*>(task.node)); break;
+            case Step::Declare: declare(static_cast<VariableDeclarationStatement*>(task.node)); break;
+            case Step::ExitScope: exit_scope(); break;
+            }
+        }
+    }
+
     void enter_scope(const void* node_key) {
         Scope* new_scope = new Scope(current_scope);
         current_scope->children_scopes[node_key] = new_scope; 
@@ -85,19 +125,20 @@ private:
                 ScopeErrorType::VariableRedefinition;
 
             string message = (symbol->kind == FUNCTION ? "Function '" : "Variable '") + 
-                             symbol->name + "' redefined on line " + to_string(symbol->definition_line) +
-                             ". Previously defined on line " + to_string(current_scope->symbols[symbol->name]->definition_line) + ".";
+                             string(symbol_name(symbol->name)) + "' redefined on " + sources.describe(symbol->definition) +
+                             ". Previously defined on " + sources.describe(current_scope->symbols[symbol->name]->definition) + ".";
 
             throw ScopeError(err_type, message);
         }
         current_scope->symbols[symbol->name] = symbol;
     }
 
-    Symbol* find_symbol(const string& name, bool is_function_call) {
+    Symbol* find_symbol(SymbolID name, bool is_function_call) {
         Scope* scope = current_scope;
         while (scope) {
-            if (scope->symbols.count(name)) {
-                Symbol* sym = scope->symbols[name];
+            auto it = scope->symbols.find(name);
+            if (it != scope->symbols.end()) {
+                Symbol* sym = it->second;
                 if (is_function_call && sym->kind != FUNCTION) {
                     scope = scope->parent;
                     continue;
@@ -111,95 +152,97 @@ private:
     
     void visit(Program* node) {
         for (auto f : node->functions){
-            Symbol* func_sym = new Symbol(f->name, f->returnType, FUNCTION, f->line);
-            func_sym->params = f->params;
+            Symbol* func_sym = new Symbol(f->name, f->returnType, FUNCTION, f->loc);
+            func_sym->params.assign(f->params.begin(), f->params.end());
             add_symbol(func_sym);
         }
-        for (auto g : node->globals) visit(g);
-        for (auto f : node->functions) visit(f);
+        pending.clear();
+        for (auto g : node->globals) {
+            visit(g);
+            run();
+        }
+        for (auto f : node->functions) {
+            visit(f);
+            run();
+        }
     }
 
     void visit(FunctionDeclaration* node) {
         enter_scope(node);
         for (const auto& param : node->params) {
-            add_symbol(new Symbol(param.name, param.type, VARIABLE, param.line));
+            add_symbol(new Symbol(param.name, param.type, VARIABLE, param.loc));
         }
-        visit(node->body);
-        exit_scope();
+        pending.push_back(Task{Step::ExitScope, node});
+        push(node->body);
     }
 
     void visit(BlockStatement* node) {
         enter_scope(node);
-        for (auto s : node->statements) visit(s);
-        exit_scope();
+        pending.push_back(Task{Step::ExitScope, node});
+        for (size_t i = node->statements.size(); i-- > 0;) push(node->statements[i]);
     }
 
-    void visit(Statement* node) {
-        if (!node) return;
-        if (auto p = dynamic_cast<BlockStatement*>(node)) visit(p);
-        else if (auto p = dynamic_cast<VariableDeclarationStatement*>(node)) visit(p);
-        else if (auto p = dynamic_cast<ExpressionStatement*>(node)) visit(p);
-        else if (auto p = dynamic_cast<IfStatement*>(node)) visit(p);
-        else if (auto p = dynamic_cast<WhileStatement*>(node)) visit(p);
-        else if (auto p = dynamic_cast<ForStatement*>(node)) visit(p);
-        else if (auto p = dynamic_cast<ReturnStatement*>(node)) visit(p);
+    // The variable is declared once its initializer has been visited.
+    void visit(VariableDeclarationStatement* node) {
+        pending.push_back(Task{Step::Declare, node});
+        if (node->initializer) push(node->initializer);
     }
 
-    void visit(VariableDeclarationStatement* node) {
-        if (node->initializer) visit(node->initializer);
-        add_symbol(new Symbol(node->name, node->type, VARIABLE, node->line));
+    void declare(VariableDeclarationStatement* node) {
+        add_symbol(new Symbol(node->name, node->type, VARIABLE, node->loc));
     }
 
     void visit(ExpressionStatement* node) {
-        visit(node->expression);
+        push(node->expression);
     }
     
     void visit(IfStatement* node) {
-        visit(node->condition);
-        visit(node->thenBranch);
-        if (node->elseBranch) visit(node->elseBranch);
+        if (node->elseBranch) push(node->elseBranch);
+        push(node->thenBranch);
+        push(node->condition);
     }
     
     void visit(WhileStatement* node) {
-        visit(node->condition);
-        visit(node->body);
+        push(node->body);
+        push(node->condition);
     }
     
     void visit(ForStatement* node) {
         enter_scope(node);
-        if(node->initializer) visit(node->initializer);
-        if(node->condition) visit(node->condition);
-        if(node->increment) visit(node->increment);
-        visit(node->body);
-        exit_scope();
+        pending.push_back(Task{Step::ExitScope, node});
+        push(node->body);
+        if(node->increment) push(node->increment);
+        if(node->condition) push(node->condition);
+        if(node->initializer) push(node->initializer);
     }
     
     void visit(ReturnStatement* node) {
-        if (node->returnValue) visit(node->returnValue);
-    }
-    
-    void visit(Expression* node) {
-        if (!node) return;
-        if (auto p = dynamic_cast<BinaryOperation*>(node)) visit(p);
-        else if (auto p = dynamic_cast<Assignment*>(node)) visit(p);
-        else if (auto p = dynamic_cast<Identifier*>(node)) visit(p);
-        else if (auto p = dynamic_cast<FunctionCall*>(node)) visit(p);
+        if (node->returnValue) push(node->returnValue);
     }
 
+    void visit(BreakStatement*) {}
+    void visit(ContinueStatement*) {}
+    // Reported by the parser already, and declares nothing.
+    void visit(ErrorStatement*) {}
+
     void visit(BinaryOperation* node) {
-        visit(node->left);
-        visit(node->right);
+        push(node->right);
+        push(node->left);
+    }
+
+    void visit(UnaryOp* node) {
+        push(node->right);
     }
     
     void visit(Assignment* node) {
-        visit(node->identifier);
-        visit(node->value);
+        push(node->value);
+        push(node->identifier);
     }
 
     void visit(Identifier* node) {
         Symbol* sym = find_symbol(node->name, false);
         if (!sym) {
-            string message = "Undeclared variable '" + node->name + "' used on line " + to_string(node->line) + ".";
+            string message = "Undeclared variable '" + string(symbol_name(node->name)) + "' used on " + sources.describe(node->loc) + ".";
             throw ScopeError(ScopeErrorType::UndeclaredVariableAccessed, message);
         }
     }
@@ -207,9 +250,14 @@ private:
     void visit(FunctionCall* node) {
         Symbol* sym = find_symbol(node->callee, true);
         if (!sym) {
-            string message = "Call to undefined function '" + node->callee + "' on line " + to_string(node->line) + ".";
+            string message = "Call to undefined function '" + string(symbol_name(node->callee)) + "' on " + sources.describe(node->loc) + ".";
             throw ScopeError(ScopeErrorType::UndefinedFunctionCalled, message);
         }
-        for(auto& arg : node->arguments) visit(arg);
+        for (size_t i = node->arguments.size(); i-- > 0;) push(node->arguments[i]);
     }
+
+    void visit(NumberLiteral*) {}
+    void visit(StringLiteral*) {}
+    void visit(BoolLiteral*) {}
+    void visit(ErrorExpression*) {}
 };
\ No newline at end of file
@@ -0,0 +1,336 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#include <immintrin.h>
+#define SIMD_SCAN_X86 1
+#endif
+
+// Byte-run scanners used by the lexers. Every kernel takes a [p, end) range
+// and returns a pointer into it (or `end`). The scalar versions define the
+// semantics; the SSE2 and AVX2 versions test 16/32 bytes per step and finish
+// the tail with the scalar loop.
+//
+// Whitespace, identifier and digit runs in C average about 2 bytes and
+// almost never reach 16, so their vector skips do not beat the scalar loop
+// (`bench scan` times both). The SSE2 and AVX2 kernel sets keep the scalar
+// skips for those classes and use vectors for comments, newlines and byte
+// counts, whose runs are long.
+//
+// Character classes match lexerRaw: whitespace is " \t\n\v\f\r", identifier
+// bytes are [A-Za-z0-9_], digits are [0-9]. Bytes >= 0x80 are in no class.
+
+enum class ScanLevel { Scalar, SSE2, AVX2 };
+
+struct ScanKernels {
+    ScanLevel level;
+    const char* name;
+    const char* (*skip_whitespace)(const char* p, const char* end);
+    const char* (*skip_identifier)(const char* p, const char* end);
+    const char* (*skip_digits)(const char* p, const char* end);
+    const char* (*find_byte)(const char* p, const char* end, char c);
+    // First "*/" starting in [p, end - 1).
+    const char* (*find_comment_end)(const char* p, const char* end);
+    size_t (*count_byte)(const char* p, const char* end, char c);
+    // Writes the offset (from p) just past each '\n' in [p, end) to `out`,
+    // which must have room for count_byte(p, end, '\n') entries.
+    void (*find_line_starts)(const char* p, const char* end, uint64_t* out);
+};
+
+namespace simd_scan {
+
+inline bool is_space(char c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+inline bool is_digit(char c) { return c >= '0' && c <= '9'; }
+inline bool is_ident(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || is_digit(c) || c == '_';
+}
+
+// ---- scalar ----
+
+inline const char* skip_whitespace_scalar(const char* p, const char* end) {
+    while (p < end && is_space(*p)) p++;
+    return p;
+}
+
+inline const char* skip_identifier_scalar(const char* p, const char* end) {
+    while (p < end && is_ident(*p)) p++;
+    return p;
+}
+
+inline const char* skip_digits_scalar(const char* p, const char* end) {
+    while (p < end && is_digit(*p)) p++;
+    return p;
+}
+
+inline const char* find_byte_scalar(const char* p, const char* end, char c) {
+    while (p < end && *p != c) p++;
+    return p;
+}
+
+inline const char* find_comment_end_scalar(const char* p, const char* end) {
+    for (; p + 1 < end; p++) {
+        if (p[0] == '*' && p[1] == '/') return p;
+    }
+    return end;
+}
+
+inline size_t count_byte_scalar(const char* p, const char* end, char c) {
+    size_t n = 0;
+    for (; p < end; p++) n += (*p == c);
+    return n;
+}
+
+inline void find_line_starts_scalar(const char* p, const char* end, uint64_t* out) {
+    for (const char* q = p; q < end; q++) {
+        if (*q == '\n') *out++ = q - p + 1;
+    }
+}
+
+#ifdef SIMD_SCAN_X86
+
+// Bytes tested one at a time before a class skip switches to vectors.
+#define SIMD_SCAN_SHORT_RUN 4
+
+// ---- SSE2 (baseline on x86-64) ----
+// Class tests use signed byte compares; bytes >= 0x80 are negative and so
+// fall outside every range.
+
+inline __m128i space_mask_sse2(__m128i v) {
+    __m128i ctrl = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('\t' - 1)),
+                                 _mm_cmplt_epi8(v, _mm_set1_epi8('\r' + 1)));
+    return _mm_or_si128(ctrl, _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+}
+
+inline __m128i digit_mask_sse2(__m128i v) {
+    return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+                         _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+}
+
+inline __m128i ident_mask_sse2(__m128i v) {
+    __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                                  _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+    __m128i under = _mm_cmpeq_epi8(v, _mm_set1_epi8('_'));
+    return _mm_or_si128(_mm_or_si128(alpha, under), digit_mask_sse2(v));
+}
+
+// Advances while every byte is in the class computed by Mask.
+template <__m128i (*Mask)(__m128i), bool (*InClass)(char)>
+inline const char* skip_class_sse2(const char* p, const char* end) {
+    // Most runs in real code are a few bytes; settle those before loading a vector.
+    for (const char* stop = p + SIMD_SCAN_SHORT_RUN; p < stop; p++) {
+        if (p == end || !InClass(*p)) return p;
+    }
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        unsigned outside = ~(unsigned)_mm_movemask_epi8(Mask(v)) & 0xFFFF;
+        if (outside) return p + __builtin_ctz(outside);
+        p += 16;
+    }
+    while (p < end && InClass(*p)) p++;
+    return p;
+}
+
+inline const char* skip_whitespace_sse2(const char* p, const char* end) {
+    return skip_class_sse2<space_mask_sse2, is_space>(p, end);
+}
+
+inline const char* skip_identifier_sse2(const char* p, const char* end) {
+    return skip_class_sse2<ident_mask_sse2, is_ident>(p, end);
+}
+
+inline const char* skip_digits_sse2(const char* p, const char* end) {
+    return skip_class_sse2<digit_mask_sse2, is_digit>(p, end);
+}
+
+inline const char* find_byte_sse2(const char* p, const char* end, char c) {
+    __m128i needle = _mm_set1_epi8(c);
+    while (end - p >= 16) {
+        unsigned hits = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), needle));
+        if (hits) return p + __builtin_ctz(hits);
+        p += 16;
+    }
+    return find_byte_scalar(p, end, c);
+}
+
+inline const char* find_comment_end_sse2(const char* p, const char* end) {
+    __m128i star = _mm_set1_epi8('*');
+    __m128i slash = _mm_set1_epi8('/');
+    while (end - p >= 17) {
+        __m128i a = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), star);
+        __m128i b = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + 1)), slash);
+        unsigned hits = _mm_movemask_epi8(_mm_and_si128(a, b));
+        if (hits) return p + __builtin_ctz(hits);
+        p += 16;
+    }
+    return find_comment_end_scalar(p, end);
+}
+
+inline size_t count_byte_sse2(const char* p, const char* end, char c) {
+    __m128i needle = _mm_set1_epi8(c);
+    size_t n = 0;
+    while (end - p >= 16) {
+        n += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), needle)));
+        p += 16;
+    }
+    return n + count_byte_scalar(p, end, c);
+}
+
+inline void find_line_starts_sse2(const char* p, const char* end, uint64_t* out) {
+    __m128i newline = _mm_set1_epi8('\n');
+    const char* q = p;
+    for (; end - q >= 16; q += 16) {
+        unsigned hits = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)q), newline));
+        for (; hits; hits &= hits - 1) *out++ = q - p + __builtin_ctz(hits) + 1;
+    }
+    for (; q < end; q++) {
+        if (*q == '\n') *out++ = q - p + 1;
+    }
+}
+
+// ---- AVX2 (selected at runtime) ----
+
+#define SIMD_SCAN_AVX2 __attribute__((target("avx2")))
+
+SIMD_SCAN_AVX2 inline __m256i space_mask_avx2(__m256i v) {
+    __m256i ctrl = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('\t' - 1)),
+                                    _mm256_cmpgt_epi8(_mm256_set1_epi8('\r' + 1), v));
+    return _mm256_or_si256(ctrl, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')));
+}
+
+SIMD_SCAN_AVX2 inline __m256i digit_mask_avx2(__m256i v) {
+    return _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('0' - 1)),
+                            _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), v));
+}
+
+SIMD_SCAN_AVX2 inline __m256i ident_mask_avx2(__m256i v) {
+    __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+    __m256i alpha = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)),
+                                     _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), lower));
+    __m256i under = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_'));
+    return _mm256_or_si256(_mm256_or_si256(alpha, under), digit_mask_avx2(v));
+}
+
+SIMD_SCAN_AVX2 inline const char* skip_whitespace_avx2(const char* p, const char* end) {
+    for (const char* stop = p + SIMD_SCAN_SHORT_RUN; p < stop; p++) {
+        if (p == end || !is_space(*p)) return p;
+    }
+    while (end - p >= 32) {
+        unsigned outside = ~(unsigned)_mm256_movemask_epi8(space_mask_avx2(_mm256_loadu_si256((const __m256i*)p)));
+        if (outside) return p + __builtin_ctz(outside);
+        p += 32;
+    }
+    return skip_whitespace_sse2(p, end);
+}
+
+SIMD_SCAN_AVX2 inline const char* skip_identifier_avx2(const char* p, const char* end) {
+    for (const char* stop = p + SIMD_SCAN_SHORT_RUN; p < stop; p++) {
+        if (p == end || !is_ident(*p)) return p;
+    }
+    while (end - p >= 32) {
+        unsigned outside = ~(unsigned)_mm256_movemask_epi8(ident_mask_avx2(_mm256_loadu_si256((const __m256i*)p)));
+        if (outside) return p + __builtin_ctz(outside);
+        p += 32;
+    }
+    return skip_identifier_sse2(p, end);
+}
+
+SIMD_SCAN_AVX2 inline const char* skip_digits_avx2(const char* p, const char* end) {
+    for (const char* stop = p + SIMD_SCAN_SHORT_RUN; p < stop; p++) {
+        if (p == end || !is_digit(*p)) return p;
+    }
+    while (end - p >= 32) {
+        unsigned outside = ~(unsigned)_mm256_movemask_epi8(digit_mask_avx2(_mm256_loadu_si256((const __m256i*)p)));
+        if (outside) return p + __builtin_ctz(outside);
+        p += 32;
+    }
+    return skip_digits_sse2(p, end);
+}
+
+SIMD_SCAN_AVX2 inline const char* find_byte_avx2(const char* p, const char* end, char c) {
+    __m256i needle = _mm256_set1_epi8(c);
+    while (end - p >= 32) {
+        unsigned hits = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)p), needle));
+        if (hits) return p + __builtin_ctz(hits);
+        p += 32;
+    }
+    return find_byte_sse2(p, end, c);
+}
+
+SIMD_SCAN_AVX2 inline const char* find_comment_end_avx2(const char* p, const char* end) {
+    __m256i star = _mm256_set1_epi8('*');
+    __m256i slash = _mm256_set1_epi8('/');
+    while (end - p >= 33) {
+        __m256i a = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)p), star);
+        __m256i b = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p + 1)), slash);
+        unsigned hits = _mm256_movemask_epi8(_mm256_and_si256(a, b));
+        if (hits) return p + __builtin_ctz(hits);
+        p += 32;
+    }
+    return find_comment_end_sse2(p, end);
+}
+
+SIMD_SCAN_AVX2 inline size_t count_byte_avx2(const char* p, const char* end, char c) {
+    __m256i needle = _mm256_set1_epi8(c);
+    size_t n = 0;
+    while (end - p >= 32) {
+        n += __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)p), needle)));
+        p += 32;
+    }
+    return n + count_byte_sse2(p, end, c);
+}
+
+SIMD_SCAN_AVX2 inline void find_line_starts_avx2(const char* p, const char* end, uint64_t* out) {
+    __m256i newline = _mm256_set1_epi8('\n');
+    const char* q = p;
+    for (; end - q >= 32; q += 32) {
+        unsigned hits = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)q), newline));
+        for (; hits; hits &= hits - 1) *out++ = q - p + __builtin_ctz(hits) + 1;
+    }
+    for (; q < end; q++) {
+        if (*q == '\n') *out++ = q - p + 1;
+    }
+}
+
+#endif // SIMD_SCAN_X86
+
+} // namespace simd_scan
+
+inline bool scan_level_supported(ScanLevel level) {
+    switch (level) {
+        case ScanLevel::Scalar: return true;
+#ifdef SIMD_SCAN_X86
+        case ScanLevel::SSE2: return true;
+        case ScanLevel::AVX2: return __builtin_cpu_supports("avx2");
+#endif
+        default: return false;
+    }
+}
+
+// Kernels for `level`; falls back to the best supported level below it.
+inline const ScanKernels& scan_kernels(ScanLevel level) {
+    using namespace simd_scan;
+    static const ScanKernels scalar = {
+        ScanLevel::Scalar, "scalar", skip_whitespace_scalar, skip_identifier_scalar, skip_digits_scalar,
+        find_byte_scalar, find_comment_end_scalar, count_byte_scalar, find_line_starts_scalar};
+#ifdef SIMD_SCAN_X86
+    static const ScanKernels sse2 = {
+        ScanLevel::SSE2, "sse2", skip_whitespace_scalar, skip_identifier_scalar, skip_digits_scalar,
+        find_byte_sse2, find_comment_end_sse2, count_byte_sse2, find_line_starts_sse2};
+    static const ScanKernels avx2 = {
+        ScanLevel::AVX2, "avx2", skip_whitespace_scalar, skip_identifier_scalar, skip_digits_scalar,
+        find_byte_avx2, find_comment_end_avx2, count_byte_avx2, find_line_starts_avx2};
+    if (level == ScanLevel::AVX2 && scan_level_supported(ScanLevel::AVX2)) return avx2;
+    if (level != ScanLevel::Scalar) return sse2;
+#endif
+    return scalar;
+}
+
+// The fastest kernels this CPU runs, chosen once.
+inline const ScanKernels& best_scan_kernels() {
+    static const ScanKernels& best = scan_kernels(ScanLevel::AVX2);
+    return best;
+}
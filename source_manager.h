@@ -0,0 +1,287 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <cstdint>
+#include <cerrno>
+#include <cstring>
+#include "simd_scan.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define SOURCE_MANAGER_POSIX 1
+#else
+#include <fstream>
+#include <iostream>
+#endif
+
+typedef uint32_t FileID;
+typedef uint64_t SourceOffset;
+
+// A position anywhere in a compilation. Each file owns the range
+// [start, start + size] of locations, handed out by its SourceManager in load
+// order; 0 is no location.
+typedef uint64_t SourceLocation;
+
+// Offsets of the first byte of every line, found with one vectorized newline
+// scan. Line and column are then a binary search away.
+class LineIndex {
+public:
+    explicit LineIndex(std::string_view text, const ScanKernels& kernels = best_scan_kernels()) {
+        const char* begin = text.data();
+        const char* end = begin + text.size();
+        starts.resize(kernels.count_byte(begin, end, '\n') + 1);
+        starts[0] = 0;
+        kernels.find_line_starts(begin, end, &starts[1]);
+    }
+
+    // 1-based line and column of a byte offset.
+    uint32_t line_of(SourceOffset offset) const {
+        return std::upper_bound(starts.begin(), starts.end(), offset) - starts.begin();
+    }
+
+    SourceOffset column_of(SourceOffset offset) const { return offset - starts[line_of(offset) - 1] + 1; }
+
+    // "line L, column C", the form every diagnostic uses.
+    std::string describe(SourceOffset offset) const {
+        return "line " + std::to_string(line_of(offset)) + ", column " + std::to_string(column_of(offset));
+    }
+
+    size_t line_count() const { return starts.size(); }
+    // Offset of the first byte of a 1-based line.
+    SourceOffset line_start(uint32_t line) const { return starts[line - 1]; }
+
+private:
+    std::vector<SourceOffset> starts;
+};
+
+// One loaded input. Regular files are mapped read-only; pipes, stdin and
+// in-memory buffers are owned as a std::string. Either way the text stays at a
+// fixed address until the owning SourceManager is destroyed, so tokens and AST
+// nodes may keep string_views into it.
+class SourceFile {
+public:
+    SourceFile(FileID id, const std::string& name) : file_id(id), file_name(name) {}
+
+    ~SourceFile() {
+#ifdef SOURCE_MANAGER_POSIX
+        if (mapped) munmap(mapped, mapped_size);
+#endif
+    }
+
+    SourceFile(const SourceFile&) = delete;
+    SourceFile& operator=(const SourceFile&) = delete;
+
+    FileID id() const { return file_id; }
+    const std::string& name() const { return file_name; }
+    std::string_view text() const { return contents; }
+    SourceOffset size() const { return contents.size(); }
+    bool is_mapped() const { return mapped != nullptr; }
+
+    SourceLocation start() const { return first_location; }
+    SourceLocation location(SourceOffset offset) const { return first_location + offset; }
+
+    // Positions of a byte offset. The line index is built on first use, so
+    // inputs that never report a position never pay for it.
+    uint32_t line_of(SourceOffset offset) const { return lines().line_of(offset); }
+    SourceOffset column_of(SourceOffset offset) const { return lines().column_of(offset); }
+    std::string describe(SourceOffset offset) const { return lines().describe(offset); }
+    size_t line_count() const { return lines().line_count(); }
+    SourceOffset line_start(uint32_t line) const { return lines().line_start(line); }
+
+private:
+    friend class SourceManager;
+
+    FileID file_id;
+    std::string file_name;
+    std::string_view contents;
+    std::string owned;
+    void* mapped = nullptr;
+    size_t mapped_size = 0;
+    SourceLocation first_location = 0;
+
+    mutable std::once_flag lines_built;
+    mutable std::unique_ptr<LineIndex> line_index;
+
+    const LineIndex& lines() const {
+        std::call_once(lines_built, [this] { line_index.reset(new LineIndex(contents)); });
+        return *line_index;
+    }
+
+    void adopt(std::string text) {
+        owned = std::move(text);
+        contents = owned;
+    }
+};
+
+// Loads and owns every input of a compilation. FileIDs are indices handed out
+// in load order and stay valid for the manager's lifetime.
+//
+// Files may be looked up on any thread while one thread loads more, as the
+// parser's workers do under --jobs while the preprocessor reads on: the
+// file table is kept in chunks that never move, and a file is published
+// only once it is complete. Loads take a lock; lookups do not.
+class SourceManager {
+public:
+    // Maps `path` if it is a regular file, otherwise reads it to the end.
+    // "-" reads standard input.
+    FileID load(const std::string& path) {
+        if (path == "-") return load_stdin();
+        std::unique_ptr<SourceFile> file = create(path);
+#ifdef SOURCE_MANAGER_POSIX
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Could not open file: " + path + " (" + strerror(errno) + ")");
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            size_t size = (size_t)st.st_size;
+            void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED) {
+#ifdef MADV_SEQUENTIAL
+                madvise(data, size, MADV_SEQUENTIAL);
+#endif
+                file->mapped = data;
+                file->mapped_size = size;
+                file->contents = std::string_view((const char*)data, size);
+                close(fd);
+                return finish(std::move(file));
+            }
+        }
+        try {
+            file->adopt(read_fd(fd, path));
+        } catch (...) {
+            close(fd);
+            throw;
+        }
+        close(fd);
+        return finish(std::move(file));
+#else
+        std::ifstream in(path, std::ios::binary);
+        if (!in.is_open()) {
+            throw std::runtime_error("Could not open file: " + path);
+        }
+        std::string text;
+        char chunk[1 << 16];
+        while (in.read(chunk, sizeof(chunk)) || in.gcount() > 0) text.append(chunk, in.gcount());
+        file->adopt(std::move(text));
+        return finish(std::move(file));
+#endif
+    }
+
+    FileID load_stdin() {
+        std::unique_ptr<SourceFile> file = create("<stdin>");
+#ifdef SOURCE_MANAGER_POSIX
+        file->adopt(read_fd(STDIN_FILENO, "<stdin>"));
+#else
+        std::string text;
+        char chunk[1 << 16];
+        while (std::cin.read(chunk, sizeof(chunk)) || std::cin.gcount() > 0) text.append(chunk, std::cin.gcount());
+        file->adopt(std::move(text));
+#endif
+        return finish(std::move(file));
+    }
+
+    // Registers text that did not come from disk (tests, editors, generated code).
+    FileID add_buffer(const std::string& name, std::string text) {
+        std::unique_ptr<SourceFile> file = create(name);
+        file->adopt(std::move(text));
+        return finish(std::move(file));
+    }
+
+    const SourceFile& file(FileID id) const {
+        if (id >= published.load(std::memory_order_acquire)) throw std::out_of_range("invalid file id");
+        return *chunks[id / ChunkFiles][id % ChunkFiles];
+    }
+
+    size_t file_count() const { return published.load(std::memory_order_acquire); }
+
+    // The file a location falls in.
+    const SourceFile& file_at(SourceLocation location) const {
+        // The first file that starts after `location`.
+        size_t low = 0, high = file_count();
+        while (low < high) {
+            size_t mid = (low + high) / 2;
+            if (location < file(mid).start()) high = mid;
+            else low = mid + 1;
+        }
+        if (location == 0 || low == 0) throw std::out_of_range("invalid source location");
+        return file(low - 1);
+    }
+
+    uint32_t line_of(SourceLocation location) const {
+        const SourceFile& f = file_at(location);
+        return f.line_of(location - f.start());
+    }
+
+    SourceOffset column_of(SourceLocation location) const {
+        const SourceFile& f = file_at(location);
+        return f.column_of(location - f.start());
+    }
+
+    std::string describe(SourceLocation location) const {
+        const SourceFile& f = file_at(location);
+        return f.describe(location - f.start());
+    }
+
+private:
+    static constexpr size_t ChunkFiles = 256;
+    static constexpr size_t MaxChunks = 1024;
+
+    // File k is chunks[k / ChunkFiles][k % ChunkFiles]; the first `published`
+    // are complete.
+    std::unique_ptr<std::unique_ptr<SourceFile>[]> chunks[MaxChunks];
+    std::atomic<size_t> published{0};
+    std::mutex loading;
+    // One past the end location of the last file; each file's range also
+    // covers its end-of-file position.
+    SourceLocation next_location = 1;
+
+    // A file that gets its id and locations when finish() publishes it.
+    std::unique_ptr<SourceFile> create(const std::string& name) {
+        return std::unique_ptr<SourceFile>(new SourceFile(0, name));
+    }
+
+    FileID finish(std::unique_ptr<SourceFile> file) {
+        std::lock_guard<std::mutex> lock(loading);
+        size_t id = published.load(std::memory_order_relaxed);
+        if (id == ChunkFiles * MaxChunks) throw std::runtime_error("Too many source files");
+        std::unique_ptr<std::unique_ptr<SourceFile>[]>& chunk = chunks[id / ChunkFiles];
+        if (!chunk) chunk.reset(new std::unique_ptr<SourceFile>[ChunkFiles]);
+        file->file_id = id;
+        file->first_location = next_location;
+        next_location += file->size() + 1;
+        chunk[id % ChunkFiles] = std::move(file);
+        published.store(id + 1, std::memory_order_release);
+        return id;
+    }
+
+#ifdef SOURCE_MANAGER_POSIX
+    static std::string read_fd(int fd, const std::string& name) {
+        std::string text;
+        size_t used = 0;
+        text.resize(1 << 16);
+        while (true) {
+            if (used == text.size()) text.resize(text.size() * 2);
+            ssize_t n = read(fd, &text[used], text.size() - used);
+            if (n == 0) break;
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                throw std::runtime_error("Could not read " + name + " (" + strerror(errno) + ")");
+            }
+            used += n;
+        }
+        text.resize(used);
+        return text;
+    }
+#endif
+};
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// Compile-time token tables. A lexer lists each spelling once, as a constexpr
+// array of Spelling; the tables below are built from those arrays by the
+// compiler, so there is no static initialization at startup and a lookup is an
+// array index plus at most a few compares.
+
+template <typename Type>
+struct Spelling {
+    std::string_view text;
+    Type type;
+};
+
+// Perfect hash over a fixed keyword set. The constructor searches for a seed
+// under which every keyword lands in a slot of its own; a seed that cannot be
+// found fails the build instead of degrading at runtime.
+template <typename Type, size_t N>
+class KeywordTable {
+public:
+    static_assert(N > 0 && N < 255, "keyword slots are stored in a byte");
+
+    constexpr explicit KeywordTable(const Spelling<Type> (&keywords)[N]) {
+        for (size_t i = 0; i < N; i++) {
+            words[i] = keywords[i];
+            if (keywords[i].text.size() < shortest) shortest = keywords[i].text.size();
+            if (keywords[i].text.size() > longest) longest = keywords[i].text.size();
+        }
+        for (seed = 1; !place(); seed++) {
+            if (seed == 1 << 16) throw "no perfect hash seed for this keyword set";
+        }
+    }
+
+    // Sets `type` and returns true if `word` is a keyword.
+    constexpr bool find(std::string_view word, Type& type) const {
+        if (word.size() < shortest || word.size() > longest) return false;
+        uint8_t slot = slots[hash(word, seed) & (Size - 1)];
+        if (slot == 0 || words[slot - 1].text != word) return false;
+        type = words[slot - 1].type;
+        return true;
+    }
+
+private:
+    // At most one slot in four is used, which keeps the seed search short.
+    static constexpr size_t Size = [] {
+        size_t size = 1;
+        while (size < 4 * N) size <<= 1;
+        return size;
+    }();
+
+    Spelling<Type> words[N] = {};
+    uint8_t slots[Size] = {};
+    uint32_t seed = 0;
+    size_t shortest = SIZE_MAX;
+    size_t longest = 0;
+
+    static constexpr uint32_t hash(std::string_view word, uint32_t seed) {
+        uint32_t h = 2166136261u ^ seed;
+        for (char c : word) h = (h ^ (uint8_t)c) * 16777619u;
+        return h ^ (h >> 16);
+    }
+
+    constexpr bool place() {
+        for (uint8_t& slot : slots) slot = 0;
+        for (size_t i = 0; i < N; i++) {
+            uint8_t& slot = slots[hash(words[i].text, seed) & (Size - 1)];
+            if (slot != 0) return false;
+            slot = (uint8_t)(i + 1);
+        }
+        return true;
+    }
+};
+
+// Operator recognizer dispatched on the first byte. Each of the 256 entries
+// holds the one-byte operator spelled by that byte, if any, and the run of
+// longer operators starting with it, longest first.
+template <typename Type, size_t N>
+class OperatorTable {
+public:
+    constexpr explicit OperatorTable(const Spelling<Type> (&operators)[N]) {
+        for (size_t i = 0; i < N; i++) {
+            const Spelling<Type>& op = operators[i];
+            Prefix& prefix = prefixes[(uint8_t)op.text[0]];
+            if (op.text.size() == 1) {
+                prefix.has_single = true;
+                prefix.single = op.type;
+            } else {
+                longer[longer_count++] = op;
+            }
+        }
+        // Group longer operators by first byte, longest first within a group.
+        for (size_t i = 1; i < longer_count; i++) {
+            for (size_t j = i; j > 0 && before(longer[j], longer[j - 1]); j--) {
+                Spelling<Type> moved = longer[j];
+                longer[j] = longer[j - 1];
+                longer[j - 1] = moved;
+            }
+        }
+        for (size_t i = longer_count; i-- > 0;) {
+            Prefix& prefix = prefixes[(uint8_t)longer[i].text[0]];
+            prefix.first = (uint8_t)i;
+            prefix.count++;
+        }
+    }
+
+    // Length of the longest operator at the start of [p, end), or 0 if none;
+    // `type` is set when a match is found.
+    constexpr size_t match(const char* p, const char* end, Type& type) const {
+        const Prefix& prefix = prefixes[(uint8_t)*p];
+        for (size_t i = prefix.first; i < prefix.first + prefix.count; i++) {
+            std::string_view text = longer[i].text;
+            if ((size_t)(end - p) >= text.size() && std::string_view(p, text.size()) == text) {
+                type = longer[i].type;
+                return text.size();
+            }
+        }
+        if (!prefix.has_single) return 0;
+        type = prefix.single;
+        return 1;
+    }
+
+private:
+    struct Prefix {
+        bool has_single = false;
+        Type single = {};
+        uint8_t first = 0;
+        uint8_t count = 0;
+    };
+
+    Prefix prefixes[256] = {};
+    Spelling<Type> longer[N] = {};
+    size_t longer_count = 0;
+
+    static constexpr bool before(const Spelling<Type>& a, const Spelling<Type>& b) {
+        if (a.text[0] != b.text[0]) return (uint8_t)a.text[0] < (uint8_t)b.text[0];
+        return a.text.size() > b.text.size();
+    }
+};
+
+// Display names of a token enum whose values run from 0 to Count - 1. Values
+// missing from the spelling list read as `fallback`.
+template <typename Type, size_t Count>
+class TokenNames {
+public:
+    template <size_t N>
+    constexpr TokenNames(const Spelling<Type> (&spellings)[N], std::string_view fallback) {
+        for (std::string_view& name : names) name = fallback;
+        for (size_t i = 0; i < N; i++) {
+            names[(size_t)spellings[i].type] = spellings[i].text;
+            named[(size_t)spellings[i].type] = true;
+        }
+    }
+
+    constexpr std::string_view operator[](Type type) const { return names[(size_t)type]; }
+
+    // True when every value of the enum has a name of its own.
+    constexpr bool complete() const {
+        for (bool n : named) {
+            if (!n) return false;
+        }
+        return true;
+    }
+
+private:
+    std::string_view names[Count] = {};
+    bool named[Count] = {};
+};
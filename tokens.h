@@ -2,8 +2,14 @@
 #define LEXER_H
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <map>
+#include <cstdint>
+#include <memory>
+#include "source_manager.h"
+#include "interner.h"
+#include "token_spec.h"
 
 enum TokenType
 {
@@ -42,8 +48,8 @@ enum TokenType
     /* "signed" */ T_KW_SIGNED,
     /* "sizeof" */ T_KW_SIZEOF,
     /* "static" */ T_KW_STATIC,
-    
-    /* "struct" */ T_KW_STATIC_ASSERT,
+    /* "static_assert" */ T_KW_STATIC_ASSERT,
+    /* "struct" */ T_KW_STRUCT,
     /* "switch" */ T_KW_SWITCH,
     /* "thread_local" */ T_KW_THREAD_LOCAL,
     /* "true" */ T_KW_TRUE,
@@ -100,6 +106,8 @@ enum TokenType
     /* ">>=" */ T_OP_RSHIFT_ASSIGN,
     /* "&" */ T_OP_AND,
     /* "|" */ T_OP_OR,
+    /* "&&" */ T_OP_LOGICAL_AND,
+    /* "||" */ T_OP_LOGICAL_OR,
     /* "!" */ T_OP_NOT,
     /* "^" */ T_OP_XOR,
     /* "&=" */ T_OP_AND_ASSIGN,
@@ -117,21 +125,374 @@ enum TokenType
     /* invalid/unrecognized */ T_INVALID,
 };
 
+// Keywords shared by every lexer backend; any other identifier spelling is an
+// identifier.
+constexpr Spelling<TokenType> keywordSpellings[] = {
+    {"static_assert", T_KW_STATIC_ASSERT},
+    {"thread_local", T_KW_THREAD_LOCAL},
+    {"constexpr", T_KW_CONSTEXPR},
+    {"continue", T_KW_CONTINUE},
+    {"register", T_KW_REGISTER},
+    {"restrict", T_KW_RESTRICT},
+    {"unsigned", T_KW_UNSIGNED},
+    {"volatile", T_KW_VOLATILE},
+    {"alignas", T_KW_ALIGNAS},
+    {"alignof", T_KW_ALIGNOF},
+    {"default", T_KW_DEFAULT},
+    {"nullptr", T_KW_NULLPTR},
+    {"typedef", T_KW_TYPEDEF},
+    {"extern", T_KW_EXTERN},
+    {"sizeof", T_KW_SIZEOF},
+    {"static", T_KW_STATIC},
+    {"struct", T_KW_STRUCT},
+    {"switch", T_KW_SWITCH},
+    {"return", T_KW_RETURN},
+    {"double", T_KW_DOUBLE},
+    {"typeof", T_KW_TYPEOF},
+    {"inline", T_KW_INLINE},
+    {"signed", T_KW_SIGNED},
+    {"float", T_KW_FLOAT},
+    {"short", T_KW_SHORT},
+    {"break", T_KW_BREAK},
+    {"while", T_KW_WHILE},
+    {"union", T_KW_UNION},
+    {"const", T_KW_CONST},
+    {"true", T_KW_TRUE},
+    {"false", T_KW_FALSE},
+    {"bool", T_KW_BOOL},
+    {"goto", T_KW_GOTO},
+    {"else", T_KW_ELSE},
+    {"case", T_KW_CASE},
+    {"enum", T_KW_ENUM},
+    {"auto", T_KW_AUTO},
+    {"long", T_KW_LONG},
+    {"void", T_KW_VOID},
+    {"char", T_KW_CHAR},
+    {"int", T_KW_INT},
+    {"for", T_KW_FOR},
+    {"if", T_KW_IF},
+    {"do", T_KW_DO},
+    {"#include", T_KW_INCLUDE},
+    {"#define", T_KW_DEFINE},
+};
+constexpr KeywordTable keywords(keywordSpellings);
+
+// A token's lexeme is a view into the SourceFile it was lexed from, so the
+// file's SourceManager must outlive every token and AST node built from it.
+// `offset` is where the token starts; for char and string literals that is the
+// opening quote, which the lexeme leaves out. Identifiers are interned as
+// they are lexed; `symbol` is Interner::None for every other token. Lexers
+// leave `file` at 0; the preprocessor, whose tokens come from many files,
+// sets it to the file `offset` is in. It also sets `no_expand` on a macro
+// name met while that macro's own expansion was being rescanned; such a name
+// never expands again, wherever it is substituted later.
 struct Token {
     TokenType type;
-    std::string lexeme;
-    int line;
-    int column;
+    bool no_expand;
+    std::string_view lexeme;
+    SourceOffset offset;
+    SymbolID symbol;
+    FileID file;
     
-    Token(TokenType t, const std::string& l, int ln, int col) 
-        : type(t), lexeme(l), line(ln), column(col) {}
+    Token() : type(T_INVALID), no_expand(false), offset(0), symbol(Interner::None), file(0) {}
+    Token(TokenType t, std::string_view l, SourceOffset off, SymbolID sym = Interner::None) 
+        : type(t), no_expand(false), lexeme(l), offset(off), symbol(sym), file(0) {}
+};
+
+// A problem found while lexing. The lexers do not stop at one: the offending
+// text becomes a T_INVALID token and lexing goes on after it, so every
+// problem in a file is found in one pass.
+struct LexDiagnostic {
+    SourceOffset offset;
+    std::string message;
+};
+
+// The diagnostic for a T_INVALID token spelled `text` at `offset`. Every
+// backend makes the same invalid tokens, so the message follows from the text:
+// an opening quote with no closing one (the token runs to the end of that
+// line), an identifier like "_1x", a digit run that is not a number, or any
+// other byte no token can start with (a run of non-ASCII bytes is one token).
+inline LexDiagnostic invalid_token_diagnostic(const SourceFile& file, SourceOffset offset, std::string_view text) {
+    std::string where = " at " + file.describe(offset);
+    char first = text.empty() ? '\0' : text[0];
+    if (first == '"') return {offset, "Unterminated string literal" + where};
+    if (first == '\'') return {offset, "Unterminated character literal" + where};
+    if (first == '_') return {offset, "Invalid identifier: " + std::string(text) + where};
+    if (first >= '0' && first <= '9') return {offset, "Invalid numeric literal: " + std::string(text) + where};
+    return {offset, "Unexpected character: '" + std::string(text) + "'" + where};
+}
+
+// End of the T_INVALID token starting at `start`, given the byte there starts
+// no valid token: an unterminated literal runs to the end of its line, a bad
+// identifier or number to the end of its word, non-ASCII bytes to the end of
+// their run, and anything else is one byte.
+inline size_t invalid_token_end(std::string_view text, size_t start) {
+    auto word = [](char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_'; };
+    char first = text[start];
+    size_t end = start + 1;
+    if (first == '"' || first == '\'') {
+        end = text.find('\n', start);
+        return end == std::string_view::npos ? text.size() : end;
+    }
+    if (word(first)) {
+        while (end < text.size() && word(text[end])) end++;
+    } else if ((unsigned char)first >= 0x80) {
+        while (end < text.size() && (unsigned char)text[end] >= 0x80) end++;
+    }
+    return end;
+}
+
+// Tokens of one file in structure-of-arrays form: a byte of kind per token and
+// the start offset, lexeme length and symbol in separate arrays. Lines and columns are
+// not stored; they come from the file's line table when asked for.
+class TokenStream {
+public:
+    static_assert(T_INVALID <= UINT8_MAX, "token kinds must fit in a byte");
+
+    explicit TokenStream(const SourceFile& file) : file(&file) {}
+
+    void push(TokenType type, SourceOffset offset, uint32_t length, SymbolID symbol = Interner::None) {
+        kinds.push_back((uint8_t)type);
+        offsets.push_back(offset);
+        lengths.push_back(length);
+        symbols.push_back(symbol);
+    }
+
+    void push(const Token& token) { push(token.type, token.offset, token.lexeme.size(), token.symbol); }
+
+    // Appends the tokens of `other`, which must come from the same file.
+    void append(const TokenStream& other) { append(other, 0, other.size(), 0); }
+
+    // Appends tokens [begin, end) of `other` with their offsets moved by
+    // `shift`, for copying tokens from before an edit into the edited file.
+    void append(const TokenStream& other, size_t begin, size_t end, int64_t shift) {
+        kinds.insert(kinds.end(), other.kinds.begin() + begin, other.kinds.begin() + end);
+        lengths.insert(lengths.end(), other.lengths.begin() + begin, other.lengths.begin() + end);
+        symbols.insert(symbols.end(), other.symbols.begin() + begin, other.symbols.begin() + end);
+        size_t first = offsets.size();
+        offsets.insert(offsets.end(), other.offsets.begin() + begin, other.offsets.begin() + end);
+        if (shift != 0) {
+            for (size_t i = first; i < offsets.size(); i++) offsets[i] += shift;
+        }
+    }
+
+    void reserve(size_t count) {
+        kinds.reserve(count);
+        offsets.reserve(count);
+        lengths.reserve(count);
+        symbols.reserve(count);
+    }
+
+    size_t size() const { return kinds.size(); }
+    const SourceFile& source() const { return *file; }
+
+    TokenType type(size_t i) const { return (TokenType)kinds[i]; }
+    SourceOffset offset(size_t i) const { return offsets[i]; }
+    std::string_view lexeme(size_t i) const {
+        return file->text().substr(offsets[i] + quote_width(type(i)), lengths[i]);
+    }
+    SymbolID symbol(size_t i) const { return symbols[i]; }
+    // Offset just past the token, closing quote included.
+    SourceOffset end(size_t i) const { return offsets[i] + lengths[i] + 2 * quote_width(type(i)); }
+    uint32_t line(size_t i) const { return file->line_of(offsets[i]); }
+    SourceOffset column(size_t i) const { return file->column_of(offsets[i]); }
+
+    Token operator[](size_t i) const { return Token(type(i), lexeme(i), offsets[i], symbols[i]); }
+
+    // One diagnostic per T_INVALID token, in order. Derived from the tokens,
+    // so streams that were stitched or re-lexed need no extra bookkeeping.
+    std::vector<LexDiagnostic> diagnostics() const {
+        std::vector<LexDiagnostic> found;
+        for (size_t i = 0; i < kinds.size(); i++) {
+            if (kinds[i] == T_INVALID) found.push_back(invalid_token_diagnostic(*file, offsets[i], lexeme(i)));
+        }
+        return found;
+    }
+
+private:
+    const SourceFile* file;
+    std::vector<uint8_t> kinds;
+    std::vector<SourceOffset> offsets;
+    std::vector<uint32_t> lengths;
+    std::vector<SymbolID> symbols;
+
+    static SourceOffset quote_width(TokenType type) {
+        return (type == T_CHARLIT || type == T_STRINGLIT) ? 1 : 0;
+    }
+};
+
+// Where the parser gets its tokens: a Lexer running on demand, or a
+// TokenStream that was lexed up front.
+class TokenSource {
+public:
+    virtual ~TokenSource() {}
+    virtual const SourceFile& source() const = 0;
+    // The next token; T_EOF once the input is used up, and on every call after.
+    virtual Token next() = 0;
+    // Where a token returned by next() is. A lexer's tokens are all in source().
+    virtual SourceLocation location(const Token& token) const { return source().location(token.offset); }
+    virtual std::string describe(const Token& token) const { return source().describe(token.offset); }
+    // One entry per T_INVALID token returned so far.
+    const std::vector<LexDiagnostic>& diagnostics() const { return found; }
+
+protected:
+    std::vector<LexDiagnostic> found;
+
+    Token invalid(std::string_view text, SourceOffset offset) {
+        found.push_back(invalid_token_diagnostic(source(), offset, text));
+        return Token(T_INVALID, text, offset);
+    }
+};
+
+// Lexes one file a token at a time with the DFA built from the token spec in
+// lexer_regex.cpp, so no token list is ever built.
+class Lexer : public TokenSource {
+public:
+    // Lexing may start at any offset where the lexer would otherwise be
+    // between tokens.
+    explicit Lexer(const SourceFile& file, SourceOffset start = 0) : file(&file), pos(start) {}
+    const SourceFile& source() const override { return *file; }
+    Token next() override;
+
+private:
+    const SourceFile* file;
+    size_t pos;
+};
+
+// Replays a TokenStream as a TokenSource.
+class TokenStreamSource : public TokenSource {
+public:
+    explicit TokenStreamSource(const TokenStream& tokens) : tokens(tokens), index(0) {}
+    const SourceFile& source() const override { return tokens.source(); }
+    Token next() override {
+        Token token = tokens[index];
+        if (index + 1 < tokens.size()) index++;
+        if (token.type == T_INVALID) found.push_back(invalid_token_diagnostic(source(), token.offset, token.lexeme));
+        return token;
+    }
+
+private:
+    const TokenStream& tokens;
+    size_t index;
+};
+
+// Replays the tokens [begin, end), then `eof` for good, by default a T_EOF
+// just after the last of them. Locations are resolved by the source the
+// tokens came from.
+class TokenSlice : public TokenSource {
+public:
+    TokenSlice(const TokenSource& origin, const Token* begin, const Token* end, const Token& eof)
+        : origin(origin), at(begin), end(end), eof(eof) {}
+    TokenSlice(const TokenSource& origin, const Token* begin, const Token* end)
+        : origin(origin), at(begin), end(end), eof(T_EOF, "", end[-1].offset + end[-1].lexeme.size()) {
+        eof.file = end[-1].file;
+    }
+
+    const SourceFile& source() const override { return origin.source(); }
+    Token next() override { return at < end ? *at++ : eof; }
+    SourceLocation location(const Token& token) const override { return origin.location(token); }
+    std::string describe(const Token& token) const override { return origin.describe(token); }
+
+private:
+    const TokenSource& origin;
+    const Token* at;
+    const Token* end;
+    Token eof;
+};
+
+// The parser's view of a TokenSource: the current token, a few tokens of
+// lookahead and the token just consumed, kept in a small ring. Tokens are
+// pulled from the source only when looked at and dropped once they fall
+// behind previous(). T_INVALID tokens are passed over; the source keeps their
+// diagnostics, so parsing goes on past lexical errors.
+class TokenWindow {
+public:
+    static constexpr size_t Capacity = 8;
+
+    explicit TokenWindow(TokenSource& input) : input(&input), head(0), ahead(0), consumed(0) {}
+
+    const SourceFile& source() const { return input->source(); }
+    SourceLocation location(const Token& token) const { return input->location(token); }
+    std::string describe(const Token& token) const { return input->describe(token); }
+
+    // The token k places after the current one; k < Capacity - 1.
+    const Token& peek(size_t k = 0) {
+        while (ahead <= k) {
+            Token& slot = ring[(head + ahead) % Capacity];
+            do slot = input->next(); while (slot.type == T_INVALID);
+            ahead++;
+        }
+        return ring[(head + k) % Capacity];
+    }
+
+    const Token& previous() const { return ring[(head + Capacity - 1) % Capacity]; }
+
+    void advance() {
+        peek();
+        head = (head + 1) % Capacity;
+        ahead--;
+        consumed++;
+    }
+
+    // Number of tokens consumed so far.
+    size_t position() const { return consumed; }
+
+private:
+    TokenSource* input;
+    Token ring[Capacity];
+    size_t head;
+    size_t ahead;
+    size_t consumed;
+};
+
+// One way of lexing. Every backend yields the same tokens, invalid ones
+// included, for the same text; they differ only in speed. `lexcheck backends` compares them.
+struct LexerBackend {
+    const char* name;
+    const char* description;
+    // A lexer over `file` starting at `start`, which must be between tokens.
+    std::unique_ptr<TokenSource> (*open)(const SourceFile& file, SourceOffset start);
+};
+
+extern const LexerBackend dfa_backend; // lexer_regex.cpp; the default
+extern const LexerBackend raw_backend; // lexer_raw.cpp
+
+// Every backend, the default first (lexer_backends.cpp).
+const std::vector<const LexerBackend*>& lexer_backends();
+// The backend called `name`; throws std::invalid_argument if there is none.
+const LexerBackend& lexer_backend(std::string_view name);
+
+class ThreadPool;
+
+// Replacement of `removed` bytes at `offset` with `inserted`.
+struct TextEdit {
+    SourceOffset offset;
+    SourceOffset removed;
+    std::string inserted;
+};
+
+// Result of relex(). Tokens [first, new_end) of `tokens` were lexed again and
+// replace tokens [first, old_end) of the old stream; every other token is an
+// old one, moved by the edit's change in length if it came after it.
+struct Relexed {
+    TokenStream tokens;
+    size_t first;
+    size_t old_end;
+    size_t new_end;
 };
 
 // Function declarations
-std::vector<Token> tokenize(const std::string& input);
+TokenStream tokenize(const SourceFile& file, const LexerBackend& backend = dfa_backend);
+// Same tokens as tokenize(), lexed in newline-aligned pieces on `pool`. Small files are lexed in one piece.
+TokenStream tokenize_parallel(const SourceFile& file, ThreadPool& pool, const LexerBackend& backend = dfa_backend);
+std::string apply_edit(std::string_view text, const TextEdit& edit);
+// Tokens of `edited`, the old stream's file with `edit` applied, re-lexing
+// only from just before the edit until the lexer is back in step with the old
+// tokens.
+Relexed relex(const TokenStream& old_tokens, const SourceFile& edited, const TextEdit& edit,
+              const LexerBackend& backend = dfa_backend);
 std::string tokenTypeToString(TokenType type);
 std::string tokenToString(const Token& token);
-std::string readFile(const std::string& filename);
 
 
 
@@ -24,9 +24,66 @@ public:
     TypeError(TypeChkError t, const string& message) : runtime_error(message), type(t) {}
 };
 
-class TypeChecker {
+// How an operator's operands must be typed, which decides the error
+// reported when they are not.
+enum class Operands : uint8_t { None, Numeric, Integer, Boolean, Comparable };
+
+// The type rules as tables built at compile time: the result of every
+// operator on every operand type, or Mismatch, and which types may be given
+// where another is expected. Operators without a rule yield void.
+struct TypeRules {
+    static constexpr uint8_t Mismatch = 0xFF;
+    Operands operands[OperatorCount] = {};
+    uint8_t binary[OperatorCount][TypeCount][TypeCount] = {};
+    uint8_t unary[OperatorCount][TypeCount] = {};
+    bool compatible[TypeCount][TypeCount] = {};
+
+    static constexpr bool numeric(size_t t) {
+        return t == (size_t)Type::Int || t == (size_t)Type::Float || t == (size_t)Type::Double;
+    }
+
+    constexpr TypeRules() {
+        for (Operator op : { Operator::Add, Operator::Subtract, Operator::Multiply, Operator::Divide }) operands[(size_t)op] = Operands::Numeric;
+        for (Operator op : { Operator::Modulo, Operator::ShiftLeft, Operator::ShiftRight, Operator::BitAnd, Operator::BitOr,
+                             Operator::BitXor }) operands[(size_t)op] = Operands::Integer;
+        for (Operator op : { Operator::LogicalAnd, Operator::LogicalOr }) operands[(size_t)op] = Operands::Boolean;
+        for (Operator op : { Operator::Equal, Operator::NotEqual, Operator::Less, Operator::Greater, Operator::LessEqual,
+                             Operator::GreaterEqual }) operands[(size_t)op] = Operands::Comparable;
+        operands[(size_t)Operator::Not] = Operands::Boolean;
+        operands[(size_t)Operator::Negate] = Operands::Numeric;
+        operands[(size_t)Operator::BitNot] = Operands::Integer;
+
+        for (size_t l = 0; l < TypeCount; l++) {
+            for (size_t r = 0; r < TypeCount; r++) compatible[l][r] = l == r || (numeric(l) && numeric(r));
+        }
+        for (size_t op = 0; op < OperatorCount; op++) {
+            for (size_t l = 0; l < TypeCount; l++) {
+                for (size_t r = 0; r < TypeCount; r++) {
+                    uint8_t& result = binary[op][l][r];
+                    switch (operands[op]) {
+                    case Operands::None: break;
+                    // Int, Float and Double are declared narrowest first.
+                    case Operands::Numeric: result = numeric(l) && numeric(r) ? (l > r ? l : r) : Mismatch; break;
+                    case Operands::Integer: result = l == (size_t)Type::Int && r == l ? l : Mismatch; break;
+                    case Operands::Boolean: result = l == (size_t)Type::Bool && r == l ? l : Mismatch; break;
+                    case Operands::Comparable: result = compatible[l][r] ? (uint8_t)Type::Bool : Mismatch; break;
+                    }
+                }
+            }
+        }
+        for (size_t t = 0; t < TypeCount; t++) {
+            unary[(size_t)Operator::Not][t] = t == (size_t)Type::Bool ? t : Mismatch;
+            unary[(size_t)Operator::Negate][t] = numeric(t) ? t : Mismatch;
+            unary[(size_t)Operator::BitNot][t] = t == (size_t)Type::Int ? t : Mismatch;
+        }
+    }
+};
+
+constexpr TypeRules type_rules;
+
+class TypeChecker : AstVisitor<TypeChecker> {
 public:
-    TypeChecker(Scope* global_scope) : global_scope(global_scope) {
+    TypeChecker(Scope* global_scope, const SourceManager& sources) : global_scope(global_scope), sources(sources) {
         current_scope = this->global_scope;
         in_loop = false;
     }
@@ -36,24 +93,22 @@ public:
     }
 
 private:
+    friend class AstVisitor<TypeChecker>;
     Scope* global_scope;
+    const SourceManager& sources;
     Scope* current_scope;
-    string current_function_return_type;
+    Type current_function_return_type;
     bool in_loop;
 
-    bool is_numeric(const string& type) { return type == "int" || type == "float" || type == "double"; }
-    bool is_integer(const string& type) { return type == "int"; }
-    string get_wider_type(const string& t1, const string& t2) {
-        if (t1 == "double" || t2 == "double") return "double";
-        if (t1 == "float" || t2 == "float") return "float";
-        return "int";
-    }
+    static bool compatible(Type expected, Type given) { return type_rules.compatible[(size_t)expected][(size_t)given]; }
+    static string quoted(Type type) { return "'" + string(spelling(type)) + "'"; }
 
-    Symbol* find_symbol(const string& name) {
+    Symbol* find_symbol(SymbolID name) {
         Scope* s = current_scope;
         while(s) {
-            if(s->symbols.count(name)) {
-                return s->symbols[name];
+            auto it = s->symbols.find(name);
+            if(it != s->symbols.end()) {
+                return it->second;
             }
             s = s->parent;
         }
@@ -73,10 +128,38 @@ private:
     }
     
 
+    // The walk runs off explicit stacks instead of recursing, so a deep tree
+    // cannot overflow the call stack. `pending` holds what is left to do,
+    // next last: visit a statement, check an expression, or finish a node
+    // whose children are done. Each expression checked leaves its type on
+    // `types` for the step that finishes its parent.
+    enum class Step : uint8_t {
+        Statement, Expression, ExitScope, EndFunction, RestoreLoop, Discard,
+        VariableDeclaration, IfCondition, WhileCondition, ForCondition, ForBody, Return,
+        BinaryOperation, Assignment, UnaryOp, Argument, CallResult
+    };
+    struct Task {
+        Step step;
+        void* node;
+        size_t index;
+    };
+    vector<Task> pending;
+    vector<Type> types;
+
+    void push(Statement* node) { pending.push_back(Task{Step::Statement, node, 0}); }
+    void push(Expression* node) { pending.push_back(Task{Step::Expression, node, 0}); }
+    void push(Step step, void* node, size_t index = 0) { pending.push_back(Task{step, node, index}); }
+    Type pop_type() {
+        Type type = types.back();
+        types.pop_back();
+        return type;
+    }
+    void run();
+    void finish(const Task& task);
+
     void visit(Program* node);
     void visit(FunctionDeclaration* node);
     void visit(BlockStatement* node);
-    void visit(Statement* node);
     void visit(VariableDeclarationStatement* node);
     void visit(ExpressionStatement* node);
     void visit(IfStatement* node);
@@ -85,193 +168,286 @@ private:
     void visit(ReturnStatement* node);
     void visit(BreakStatement* node);
     void visit(ContinueStatement* node);
-    string check(Expression* node);
-    string check(BinaryOperation* node);
-    string check(Assignment* node);
-    string check(Identifier* node);
-    string check(FunctionCall* node);
-    string check(UnaryOp* node);
-    string check(NumberLiteral* node);
-    string check(StringLiteral* node) { return "string"; }
-    string check(BoolLiteral* node) { return "bool"; }
+    void visit(ErrorStatement*) {}
+    void visit(BinaryOperation* node);
+    void visit(Assignment* node);
+    void visit(UnaryOp* node);
+    void visit(FunctionCall* node);
+    void visit(Identifier* node);
+    void visit(NumberLiteral* node);
+    void visit(StringLiteral*) { types.push_back(Type::String); }
+    void visit(BoolLiteral*) { types.push_back(Type::Bool); }
+    void visit(ErrorExpression*) { types.push_back(Type::Void); }
+    Type check_operator(Operator op, Type left_type, Type right_type, SourceLocation loc);
+    Type check_unary(UnaryOp* node, Type right_type);
 };
 
+void TypeChecker::run() {
+    while (!pending.empty()) {
+        Task task = pending.back();
+        pending.pop_back();
+        if (task.step == Step::Statement) {
+            if (task.node) dispatch(static_cast<Statement*>(task.node));
+        } else if (task.step == Step::Expression) {
+            dispatch(static_cast<Expression*>(task.node));
+        }
+        else finish(task);
+    }
+}
+
 void TypeChecker::visit(Program* node) {
-    for (auto g : node->globals) visit(g);
-    for (auto f : node->functions) visit(f);
+    pending.clear();
+    types.clear();
+    for (auto g : node->globals) {
+        visit(g);
+        run();
+    }
+    for (auto f : node->functions) {
+        visit(f);
+        run();
+    }
 }
 
 void TypeChecker::visit(FunctionDeclaration* node) {
     current_function_return_type = node->returnType;
     enter_scope(node);
-    visit(node->body);
-    exit_scope();
-    current_function_return_type = "";
+    push(Step::EndFunction, node);
+    push(node->body);
 }
 
 void TypeChecker::visit(BlockStatement* node) {
     enter_scope(node);
-    for(auto s : node->statements) visit(s);
-    exit_scope();
-}
-
-void TypeChecker::visit(Statement* node) {
-    if (!node) return;
-    if (auto p = dynamic_cast<BlockStatement*>(node)) visit(p);
-    else if (auto p = dynamic_cast<VariableDeclarationStatement*>(node)) visit(p);
-    else if (auto p = dynamic_cast<ExpressionStatement*>(node)) visit(p);
-    else if (auto p = dynamic_cast<IfStatement*>(node)) visit(p);
-    else if (auto p = dynamic_cast<WhileStatement*>(node)) visit(p);
-    else if (auto p = dynamic_cast<ForStatement*>(node)) visit(p);
-    else if (auto p = dynamic_cast<ReturnStatement*>(node)) visit(p);
-    else if (auto p = dynamic_cast<BreakStatement*>(node)) visit(p);
-    else if (auto p = dynamic_cast<ContinueStatement*>(node)) visit(p);
+    push(Step::ExitScope, node);
+    for (size_t i = node->statements.size(); i-- > 0;) push(node->statements[i]);
 }
 
 void TypeChecker::visit(VariableDeclarationStatement* node) {
-    if (node->initializer) {
-        string init_type = check(node->initializer);
-        if (node->type != init_type && !(is_numeric(node->type) && is_numeric(init_type))) {
-            throw TypeError(TypeChkError::ErroneousVarDecl, "Initializer type '" + init_type + "' does not match variable type '" + node->type + "' on line " + to_string(node->line));
-        }
+    if (node->initializer && node->initializer->kind != NodeKind::ErrorExpression) {
+        push(Step::VariableDeclaration, node);
+        push(node->initializer);
     }
 }
 
-void TypeChecker::visit(ExpressionStatement* node) { check(node->expression); }
+void TypeChecker::visit(ExpressionStatement* node) {
+    push(Step::Discard, node);
+    push(node->expression);
+}
 
 void TypeChecker::visit(IfStatement* node) {
-    string cond_type = check(node->condition);
-    if (cond_type != "bool") {
-        throw TypeError(TypeChkError::NonBooleanCondStmt, "If statement condition must be a boolean, but got '" + cond_type + "' on line " + to_string(node->line));
-    }
-    visit(node->thenBranch);
-    if (node->elseBranch) visit(node->elseBranch);
+    push(Step::IfCondition, node);
+    push(node->condition);
 }
 
 void TypeChecker::visit(WhileStatement* node) {
-    string cond_type = check(node->condition);
-    if (cond_type != "bool") {
-        throw TypeError(TypeChkError::NonBooleanCondStmt, "While loop condition must be a boolean, but got '" + cond_type + "' on line " + to_string(node->line));
-    }
-    bool prev_in_loop = in_loop;
-    in_loop = true;
-    visit(node->body);
-    in_loop = prev_in_loop;
+    push(Step::WhileCondition, node);
+    push(node->condition);
 }
 
 void TypeChecker::visit(ForStatement* node) {
     enter_scope(node);
-    if(node->initializer) visit(node->initializer);
+    push(Step::ExitScope, node);
+    push(Step::ForBody, node);
+    if(node->increment) {
+        push(Step::Discard, node);
+        push(node->increment);
+    }
     if(node->condition) {
-        string cond_type = check(node->condition);
-        if (cond_type != "bool") {
-            throw TypeError(TypeChkError::NonBooleanCondStmt, "For loop condition must be a boolean, but got '" + cond_type + "' on line " + to_string(node->line));
-        }
+        push(Step::ForCondition, node);
+        push(node->condition);
     }
-    if(node->increment) check(node->increment);
-    bool prev_in_loop = in_loop;
-    in_loop = true;
-    visit(node->body);
-    in_loop = prev_in_loop;
-    exit_scope();
+    if(node->initializer) push(node->initializer);
 }
 
 void TypeChecker::visit(ReturnStatement* node) {
-    string return_type = "void";
-    if (node->returnValue) {
-        return_type = check(node->returnValue);
-    }
-    if (return_type != current_function_return_type && !(is_numeric(return_type) && is_numeric(current_function_return_type))) {
-        throw TypeError(TypeChkError::ErroneousReturnType, "Return type '" + return_type + "' does not match function's declared return type '" + current_function_return_type + "' on line " + to_string(node->line));
-    }
+    push(Step::Return, node);
+    if (node->returnValue) push(node->returnValue);
 }
 
 void TypeChecker::visit(BreakStatement* node) {
-    if (!in_loop) throw TypeError(TypeChkError::ErroneousBreak, "'break' statement used outside of a loop on line " + to_string(node->line));
+    if (!in_loop) throw TypeError(TypeChkError::ErroneousBreak, "'break' statement used outside of a loop on " + sources.describe(node->loc));
 }
 
 void TypeChecker::visit(ContinueStatement* node) {
-    if (!in_loop) throw TypeError(TypeChkError::ErroneousContinue, "'continue' statement used outside of a loop on line " + to_string(node->line));
+    if (!in_loop) throw TypeError(TypeChkError::ErroneousContinue, "'continue' statement used outside of a loop on " + sources.describe(node->loc));
+}
+
+// Leaves push their type at once; other expressions push their operands and
+// a step that combines the operand types.
+void TypeChecker::visit(BinaryOperation* node) {
+    push(Step::BinaryOperation, node);
+    push(node->right);
+    push(node->left);
+}
+
+void TypeChecker::visit(Assignment* node) {
+    push(Step::Assignment, node);
+    push(node->value);
+    push(node->identifier);
 }
 
-string TypeChecker::check(Expression* node) {
-    if (!node) return "void";
-    if (auto p = dynamic_cast<BinaryOperation*>(node)) return check(p);
-    if (auto p = dynamic_cast<Assignment*>(node)) return check(p);
-    if (auto p = dynamic_cast<Identifier*>(node)) return check(p);
-    if (auto p = dynamic_cast<FunctionCall*>(node)) return check(p);
-    if (auto p = dynamic_cast<UnaryOp*>(node)) return check(p);
-    if (auto p = dynamic_cast<NumberLiteral*>(node)) return check(p);
-    if (auto p = dynamic_cast<StringLiteral*>(node)) return check(p);
-    if (auto p = dynamic_cast<BoolLiteral*>(node)) return check(p);
-    return "void";
+void TypeChecker::visit(UnaryOp* node) {
+    push(Step::UnaryOp, node);
+    push(node->right);
 }
 
-string TypeChecker::check(Assignment* node) {
-    string var_type = check(node->identifier);
-    string val_type = check(node->value);
-    if (var_type != val_type && !(is_numeric(var_type) && is_numeric(val_type))) {
-        throw TypeError(TypeChkError::InvalidAssignment, "Cannot assign type '" + val_type + "' to variable '" + node->identifier->name + "' of type '" + var_type + "' on line " + to_string(node->line));
+// Called once the children of `task.node` are done and their types are on `types`.
+void TypeChecker::finish(const Task& task) {
+    switch (task.step) {
+    case Step::ExitScope:
+        exit_scope();
+        break;
+    case Step::EndFunction:
+        exit_scope();
+        current_function_return_type = Type::Void;
+        break;
+    case Step::RestoreLoop:
+        in_loop = task.index;
+        break;
+    case Step::Discard:
+        types.pop_back();
+        break;
+    case Step::VariableDeclaration: {
+        auto node = static_cast<VariableDeclarationStatement*>(task.node);
+        Type init_type = pop_type();
+        if (!compatible(node->type, init_type)) {
+            throw TypeError(TypeChkError::ErroneousVarDecl, "Initializer type " + quoted(init_type) + " does not match variable type " + quoted(node->type) + " on " + sources.describe(node->loc));
+        }
+        break;
+    }
+    case Step::IfCondition: {
+        auto node = static_cast<IfStatement*>(task.node);
+        Type cond_type = pop_type();
+        if (cond_type != Type::Bool) {
+            throw TypeError(TypeChkError::NonBooleanCondStmt, "If statement condition must be a boolean, but got " + quoted(cond_type) + " on " + sources.describe(node->loc));
+        }
+        if (node->elseBranch) push(node->elseBranch);
+        push(node->thenBranch);
+        break;
+    }
+    case Step::WhileCondition: {
+        auto node = static_cast<WhileStatement*>(task.node);
+        Type cond_type = pop_type();
+        if (cond_type != Type::Bool) {
+            throw TypeError(TypeChkError::NonBooleanCondStmt, "While loop condition must be a boolean, but got " + quoted(cond_type) + " on " + sources.describe(node->loc));
+        }
+        push(Step::RestoreLoop, node, in_loop);
+        push(node->body);
+        in_loop = true;
+        break;
+    }
+    case Step::ForCondition: {
+        auto node = static_cast<ForStatement*>(task.node);
+        Type cond_type = pop_type();
+        if (cond_type != Type::Bool) {
+            throw TypeError(TypeChkError::NonBooleanCondStmt, "For loop condition must be a boolean, but got " + quoted(cond_type) + " on " + sources.describe(node->loc));
+        }
+        break;
+    }
+    case Step::ForBody: {
+        auto node = static_cast<ForStatement*>(task.node);
+        push(Step::RestoreLoop, node, in_loop);
+        push(node->body);
+        in_loop = true;
+        break;
+    }
+    case Step::Return: {
+        auto node = static_cast<ReturnStatement*>(task.node);
+        Type return_type = node->returnValue ? pop_type() : Type::Void;
+        if (!compatible(current_function_return_type, return_type)) {
+            throw TypeError(TypeChkError::ErroneousReturnType, "Return type " + quoted(return_type) + " does not match function's declared return type " + quoted(current_function_return_type) + " on " + sources.describe(node->loc));
+        }
+        break;
+    }
+    case Step::BinaryOperation: {
+        auto node = static_cast<BinaryOperation*>(task.node);
+        Type right_type = pop_type();
+        Type left_type = pop_type();
+        types.push_back(check_operator(node->op, left_type, right_type, node->loc));
+        break;
+    }
+    case Step::Assignment: {
+        auto node = static_cast<Assignment*>(task.node);
+        Type val_type = pop_type();
+        Type var_type = pop_type();
+        // "x op= v" checks as "x op v" and stores the result in x.
+        if (node->op != Operator::Assign) val_type = check_operator(node->op, var_type, val_type, node->loc);
+        if (!compatible(var_type, val_type)) {
+            throw TypeError(TypeChkError::InvalidAssignment, "Cannot assign type " + quoted(val_type) + " to variable '" + string(symbol_name(node->identifier->name)) + "' of type " + quoted(var_type) + " on " + sources.describe(node->loc));
+        }
+        types.push_back(var_type);
+        break;
+    }
+    case Step::UnaryOp:
+        types.push_back(check_unary(static_cast<UnaryOp*>(task.node), pop_type()));
+        break;
+    case Step::Argument: {
+        auto node = static_cast<FunctionCall*>(task.node);
+        size_t i = task.index;
+        Type arg_type = pop_type();
+        Type param_type = find_symbol(node->callee)->params[i].type;
+        if (!compatible(param_type, arg_type)) {
+             throw TypeError(TypeChkError::FnCallParamType, "Argument " + to_string(i+1) + " for function '" + string(symbol_name(node->callee)) + "' has wrong type. Expected " + quoted(param_type) + ", but got " + quoted(arg_type) + " on " + sources.describe(node->loc));
+        }
+        break;
+    }
+    case Step::CallResult:
+        types.push_back(find_symbol(static_cast<FunctionCall*>(task.node)->callee)->type);
+        break;
+    default:
+        break;
     }
-    return var_type;
 }
 
-string TypeChecker::check(Identifier* node) {
+void TypeChecker::visit(Identifier* node) {
     Symbol* sym = find_symbol(node->name);
-    return sym->type_name;
+    types.push_back(sym->type);
 }
 
-string TypeChecker::check(NumberLiteral* node) {
-    return (node->value.find('.') != string::npos) ? "double" : "int";
+void TypeChecker::visit(NumberLiteral* node) {
+    types.push_back((node->value.find('.') != string_view::npos) ? Type::Double : Type::Int);
 }
 
-string TypeChecker::check(UnaryOp* node) {
-    string right_type = check(node->right);
-    if (node->op == "!") {
-        if(right_type != "bool") throw TypeError(TypeChkError::ExpressionTypeMismatch, "Logical NOT '!' operator requires a boolean operand, but got '" + right_type + "' on line " + to_string(node->line));
-        return "bool";
-    }
-    if (node->op == "-") {
-         if(!is_numeric(right_type)) throw TypeError(TypeChkError::AttemptedOpOnNonNumeric, "Unary minus '-' operator requires a numeric operand, but got '" + right_type + "' on line " + to_string(node->line));
-        return right_type;
+Type TypeChecker::check_unary(UnaryOp* node, Type right_type) {
+    uint8_t result = type_rules.unary[(size_t)node->op][(size_t)right_type];
+    if (result != TypeRules::Mismatch) return Type(result);
+    string got = quoted(right_type) + " on " + sources.describe(node->loc);
+    switch (node->op) {
+    case Operator::Not:
+        throw TypeError(TypeChkError::ExpressionTypeMismatch, "Logical NOT '!' operator requires a boolean operand, but got " + got);
+    case Operator::Negate:
+        throw TypeError(TypeChkError::AttemptedOpOnNonNumeric, "Unary minus '-' operator requires a numeric operand, but got " + got);
+    default:
+        throw TypeError(TypeChkError::AttemptedOpOnNonInt, "Bitwise NOT '~' operator requires an integer operand, but got " + got);
     }
-    return "void";
 }
 
-string TypeChecker::check(FunctionCall* node) {
+// The argument count is checked before any argument; each argument's type
+// right after the argument itself.
+void TypeChecker::visit(FunctionCall* node) {
     Symbol* sym = find_symbol(node->callee);
     if (node->arguments.size() != sym->params.size()) {
-        throw TypeError(TypeChkError::FnCallParamCount, "Function '" + node->callee + "' expects " + to_string(sym->params.size()) + " arguments, but got " + to_string(node->arguments.size()) + " on line " + to_string(node->line));
+        throw TypeError(TypeChkError::FnCallParamCount, "Function '" + string(symbol_name(node->callee)) + "' expects " + to_string(sym->params.size()) + " arguments, but got " + to_string(node->arguments.size()) + " on " + sources.describe(node->loc));
     }
-    for (size_t i = 0; i < node->arguments.size(); ++i) {
-        string arg_type = check(node->arguments[i]);
-        string param_type = sym->params[i].type;
-        if (arg_type != param_type && !(is_numeric(arg_type) && is_numeric(param_type))) {
-             throw TypeError(TypeChkError::FnCallParamType, "Argument " + to_string(i+1) + " for function '" + node->callee + "' has wrong type. Expected '" + param_type + "', but got '" + arg_type + "' on line " + to_string(node->line));
-        }
+    push(Step::CallResult, node);
+    for (size_t i = node->arguments.size(); i-- > 0;) {
+        push(Step::Argument, node, i);
+        push(node->arguments[i]);
     }
-    return sym->type_name;
 }
 
-string TypeChecker::check(BinaryOperation* node) {
-    string left_type = check(node->left);
-    string right_type = check(node->right);
-    const string& op = node->op;
-    if (op == "+" || op == "-" || op == "*" || op == "/") {
-        if (!is_numeric(left_type) || !is_numeric(right_type)) throw TypeError(TypeChkError::AttemptedOpOnNonNumeric, "Binary operator '" + op + "' requires numeric operands, but got '" + left_type + "' and '" + right_type + "' on line " + to_string(node->line));
-        return get_wider_type(left_type, right_type);
-    }
-    if (op == "%" || op == "<<" || op == ">>" || op == "&" || op == "|" || op == "^") {
-        if (!is_integer(left_type) || !is_integer(right_type)) throw TypeError(TypeChkError::AttemptedOpOnNonInt, "Binary operator '" + op + "' requires integer operands, but got '" + left_type + "' and '" + right_type + "' on line " + to_string(node->line));
-        return "int";
+Type TypeChecker::check_operator(Operator op, Type left_type, Type right_type, SourceLocation loc) {
+    uint8_t result = type_rules.binary[(size_t)op][(size_t)left_type][(size_t)right_type];
+    if (result != TypeRules::Mismatch) return Type(result);
+    string name = "'" + string(spelling(op)) + "'";
+    string got = quoted(left_type) + " and " + quoted(right_type) + " on " + sources.describe(loc);
+    switch (type_rules.operands[(size_t)op]) {
+    case Operands::Numeric:
+        throw TypeError(TypeChkError::AttemptedOpOnNonNumeric, "Binary operator " + name + " requires numeric operands, but got " + got);
+    case Operands::Integer:
+        throw TypeError(TypeChkError::AttemptedOpOnNonInt, "Binary operator " + name + " requires integer operands, but got " + got);
+    case Operands::Boolean:
+        throw TypeError(TypeChkError::ExpressionTypeMismatch, "Logical operator " + name + " requires boolean operands, but got " + got);
+    default:
+        throw TypeError(TypeChkError::ExpressionTypeMismatch, "Comparison operator " + name + " cannot compare incompatible types " + got);
     }
-    if (op == "&&" || op == "||") {
-        if (left_type != "bool" || right_type != "bool") throw TypeError(TypeChkError::ExpressionTypeMismatch, "Logical operator '" + op + "' requires boolean operands, but got '" + left_type + "' and '" + right_type + "' on line " + to_string(node->line));
-        return "bool";
-    }
-    if (op == "==" || op == "!=" || op == "<" || op == ">" || op == "<=" || op == ">=") {
-        if (left_type != right_type && !(is_numeric(left_type) && is_numeric(right_type))) throw TypeError(TypeChkError::ExpressionTypeMismatch, "Comparison operator '" + op + "' cannot compare incompatible types '" + left_type + "' and '" + right_type + "' on line " + to_string(node->line));
-        return "bool";
-    }
-    return "void";
-}
\ No newline at end of file
+}